@@ -0,0 +1,87 @@
+#!/bin/bash
+
+# Runs svndumpsanitizer over a matrix of dumps generated by dumpgen, and prints one CSV
+# line per run and phase. Phase times, bytes read and written, and memory come from the
+# --progress-fd output: the rss of a phase is the largest one reported during it, and the
+# "total" line has the rss at the end and the peak, which are read together. It also has
+# the wall time and the size of the outfile.
+#
+# The generated dumps are kept in WORKDIR (default: bench) between runs, so later
+# runs skip the generating. Set SIZES to change the revision counts, e.g.
+# SIZES="1000 10000" ./benchmark.sh ../svndumpsanitizer ./dumpgen
+
+usage() {
+	echo "Usage: $0 path/to/svndumpsanitizer path/to/dumpgen [WORKDIR]" >&2
+	exit 1
+}
+
+sds=$1
+gen=$2
+work=${3:-bench}
+if [ ! -x "$sds" ] || [ ! -x "$gen" ] ; then
+	usage
+fi
+sizes=${SIZES:-"1000 10000 100000"}
+
+shapes=(
+	"flat:--width 200 --depth 1"
+	"deep:--width 3 --depth 12"
+	"branchy:--branch-every 10 --tag-every 25 --mergeinfo-density 0.1"
+	"storms:--delete-storm-every 100 --delete-storm-size 500"
+	"deltas:--deltas --size-dist lognormal"
+)
+filters=(
+	"include:-n trunk/dir1"
+	"exclude:-e branches"
+	"redefine:-n trunk -r trunk -d -a"
+)
+
+mkdir -p "$work" || exit 1
+echo "shape,revisions,dump_bytes,filter,phase,seconds,bytes_read,bytes_written,rss,peak_rss,out_bytes"
+for size in $sizes ; do
+	for shape in "${shapes[@]}" ; do
+		name=${shape%%:*}
+		dump=$work/$name-$size.dump
+		if [ ! -f "$dump" ] ; then
+			"$gen" --revisions $size ${shape#*:} --outfile "$dump" || exit 1
+		fi
+		dump_bytes=`stat -c%s "$dump"`
+		for filter in "${filters[@]}" ; do
+			fname=${filter%%:*}
+			start=`date +%s.%N`
+			"$sds" -i "$dump" -o "$work/out.dump" ${filter#*:} --progress-fd 3 3>"$work/progress.txt" >/dev/null 2>&1
+			status=$?
+			end=`date +%s.%N`
+			if [ $status -ne 0 ] ; then
+				echo "$name-$size $fname: svndumpsanitizer exited with $status" >&2
+				continue
+			fi
+			out_bytes=`stat -c%s "$work/out.dump"`
+			awk -v prefix="$name,$size,$dump_bytes,$fname" -v start=$start -v end=$end -v out=$out_bytes '
+				function value(key,    i) {
+					for (i = 2; i <= NF; ++i) {
+						if (index($i, key "=") == 1) {
+							return substr($i, length(key) + 2)
+						}
+					}
+					return ""
+				}
+				$1 == "progress" {
+					phase = value("phase")
+					bytes[phase] = value("bytes")
+					if (value("rss") + 0 > rss[phase] + 0) {
+						rss[phase] = value("rss")
+					}
+				}
+				$1 == "summary" && value("phase") != "total" {
+					phase = value("phase")
+					print prefix "," phase "," value("seconds") "," bytes[phase] "," value("written") "," rss[phase] ",,"
+				}
+				$1 == "summary" && value("phase") == "total" {
+					print prefix ",total," sprintf("%.3f", end - start) ",," value("written") "," value("rss") "," value("peak_rss") "," out
+				}
+			' "$work/progress.txt"
+		done
+		rm -f "$work/out.dump" "$work/progress.txt"
+	done
+done
@@ -0,0 +1,573 @@
+/*
+dumpgen-0.1
+
+May be distrubuted under the terms of the GNU GPL v3 or later.
+
+Generates synthetic svn dump files, for benchmarking svndumpsanitizer on repositories of
+a known size and shape. The output is deterministic for a given set of options.
+
+Compile with "gcc -O2 dumpgen.c -o dumpgen -lm"
+
+Use with e.g. "dumpgen --outfile foo.dump --revisions 100000 --width 20 --depth 6"
+Run "dumpgen --help" for all the options.
+ */
+#define _FILE_OFFSET_BITS 64
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#define INCREMENT 1024
+#define DELTA_WINDOW 102400
+#define RANDOM_DATA_SIZE 1048576
+
+typedef struct {
+	char *path;
+	int depth;
+	int children;
+} dir;
+
+typedef struct {
+	char *path;
+	int rev;
+} file;
+
+typedef struct {
+	// Shape of the repository
+	int revisions;
+	int width;
+	int depth;
+	int nodes_per_rev;
+	int branch_every;
+	int tag_every;
+	int delete_storm_every;
+	int delete_storm_size;
+	double mergeinfo_density;
+	double add_ratio;
+	double delete_ratio;
+	// File sizes
+	char *size_dist;
+	double size_mean;
+	long max_size;
+	// Output format
+	int deltas;
+	unsigned long long seed;
+} options;
+
+// The state of the generated repository. Only trunk is tracked in detail. Branches and
+// tags are copies of trunk that are merged from, and eventually deleted.
+typedef struct {
+	dir *dirs;
+	file *files;
+	int *branches;
+	int dir_len;
+	int dir_max;
+	int file_len;
+	int file_max;
+	int branch_len;
+	int tag_len;
+	int next_branch;
+} repo;
+
+unsigned long long rng_state;
+char *random_data;
+
+void exit_with_error(char *message, int exit_code) {
+	fprintf(stderr,"ERROR: %s\n", message);
+	exit(exit_code);
+}
+
+void show_help_and_exit() {
+	printf("dumpgen usage:\n\n");
+	printf("dumpgen [-o, --outfile OUTFILE] [OPTIONS]\n\n");
+	printf("If OUTFILE is omitted the dump is written to stdout.\n\n");
+	printf("OPTIONS (defaults in parentheses)\n");
+	printf("\t--revisions N (1000)          Number of revisions after revision 0.\n");
+	printf("\t--width N (10)                Maximum number of subdirectories per directory.\n");
+	printf("\t--depth N (4)                 Maximum directory depth below trunk.\n");
+	printf("\t--nodes-per-rev N (4)         Maximum number of file nodes per ordinary revision.\n");
+	printf("\t--add-ratio F (0.3)           Share of file nodes that add a new file.\n");
+	printf("\t--delete-ratio F (0.05)       Share of file nodes that delete a file.\n");
+	printf("\t--branch-every N (100)        Copy trunk to a new branch every N revisions. 0 = never.\n");
+	printf("\t--tag-every N (250)           Copy trunk to a new tag every N revisions. 0 = never.\n");
+	printf("\t--delete-storm-every N (0)    Delete many files in one revision every N revisions.\n");
+	printf("\t--delete-storm-size N (1000)  Number of files deleted by a delete storm.\n");
+	printf("\t--mergeinfo-density F (0.02)  Probability of a revision merging branches into trunk.\n");
+	printf("\t--size-dist DIST (exp)        File size distribution: fixed, uniform, exp or lognormal.\n");
+	printf("\t--size-mean BYTES (2000)      Mean file size.\n");
+	printf("\t--max-size BYTES (10000000)   Largest file size.\n");
+	printf("\t--deltas                      Write a version 3 dump with text deltas.\n");
+	printf("\t--seed N (1)                  Seed for the random number generator.\n");
+	exit(0);
+}
+
+char* str_malloc(size_t sz) {
+	char* str;
+	if ((str = (char*)malloc(sz)) == NULL) {
+		exit_with_error("malloc failed", 2);
+	}
+	return str;
+}
+
+/*******************************************************************************
+ *
+ * Random numbers
+ *
+ ******************************************************************************/
+
+// xorshift64*, so that the output is the same on every platform.
+unsigned long long next_random() {
+	rng_state ^= rng_state >> 12;
+	rng_state ^= rng_state << 25;
+	rng_state ^= rng_state >> 27;
+	return rng_state * 2685821657736338717ULL;
+}
+
+// Returns a random number in [0, 1)
+double random_double() {
+	return (next_random() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+int random_int(int max) {
+	return (int)(random_double() * max);
+}
+
+long get_file_size(options *opt) {
+	double size;
+	if (strcmp(opt->size_dist, "fixed") == 0) {
+		size = opt->size_mean;
+	}
+	else if (strcmp(opt->size_dist, "uniform") == 0) {
+		size = random_double() * 2 * opt->size_mean;
+	}
+	else if (strcmp(opt->size_dist, "lognormal") == 0) {
+		// Sigma 1.5 gives the long tail typical of real repositories. Mu is chosen to keep the mean.
+		size = exp(log(opt->size_mean) - 1.125 + 1.5 * sqrt(-2 * log(1 - random_double())) * cos(6.283185307179586 * random_double()));
+	}
+	else {
+		size = -opt->size_mean * log(1 - random_double());
+	}
+	if (size > opt->max_size) {
+		size = opt->max_size;
+	}
+	return (long)size;
+}
+
+/*******************************************************************************
+ *
+ * Writing
+ *
+ ******************************************************************************/
+
+void write_revision(FILE *out, int rev, char *log) {
+	char props[512];
+	char date[32];
+	int len;
+	// One commit a minute, starting from the beginning of 2011.
+	time_t t = 1293840000 + (time_t)rev * 60;
+	strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S.000000Z", gmtime(&t));
+	if (rev == 0) {
+		len = sprintf(props, "K 8\nsvn:date\nV 27\n%s\nPROPS-END\n", date);
+	}
+	else {
+		len = sprintf(props, "K 10\nsvn:author\nV 7\ndumpgen\nK 8\nsvn:date\nV 27\n%s\nK 7\nsvn:log\nV %d\n%s\nPROPS-END\n", date, (int)strlen(log), log);
+	}
+	fprintf(out, "Revision-number: %d\nProp-content-length: %d\nContent-length: %d\n\n%s\n", rev, len, len, props);
+}
+
+void write_dir(FILE *out, char *path, char *action, char *copyfrom, int copyfrom_rev) {
+	fprintf(out, "Node-path: %s\nNode-kind: dir\nNode-action: %s\n", path, action);
+	if (copyfrom) {
+		fprintf(out, "Node-copyfrom-rev: %d\nNode-copyfrom-path: %s\n\n\n", copyfrom_rev, copyfrom);
+	}
+	else {
+		fprintf(out, "Prop-content-length: 10\nContent-length: 10\n\nPROPS-END\n\n\n");
+	}
+}
+
+void write_delete(FILE *out, char *path) {
+	fprintf(out, "Node-path: %s\nNode-action: delete\n\n\n", path);
+}
+
+void write_varint(FILE *out, unsigned long value) {
+	unsigned char bytes[10];
+	int i = 0;
+	do {
+		bytes[i++] = value & 0x7f;
+		value >>= 7;
+	} while (value);
+	while (--i > 0) {
+		fputc(bytes[i] | 0x80, out);
+	}
+	fputc(bytes[0], out);
+}
+
+int varint_len(unsigned long value) {
+	int i = 0;
+	do {
+		value >>= 7;
+		++i;
+	} while (value);
+	return i;
+}
+
+// The size of an svndiff0 delta that builds the text from new data only. One window per
+// DELTA_WINDOW bytes, each holding a single "copy from new data" instruction.
+long get_delta_size(long size) {
+	long done = 0;
+	long delta = 4;
+	long chunk;
+	int insn;
+	while (done < size) {
+		chunk = size - done > DELTA_WINDOW ? DELTA_WINDOW : size - done;
+		insn = chunk < 64 ? 1 : 1 + varint_len(chunk);
+		delta += 2 + varint_len(chunk) + varint_len(insn) + varint_len(chunk) + insn + chunk;
+		done += chunk;
+	}
+	return delta;
+}
+
+void write_text(FILE *out, long size) {
+	long offset = random_int(RANDOM_DATA_SIZE);
+	long chunk;
+	while (size > 0) {
+		chunk = RANDOM_DATA_SIZE - offset;
+		if (chunk > size) {
+			chunk = size;
+		}
+		fwrite(&random_data[offset], 1, chunk, out);
+		size -= chunk;
+		offset = 0;
+	}
+}
+
+void write_delta(FILE *out, long size) {
+	long chunk;
+	fwrite("SVN\0", 1, 4, out);
+	while (size > 0) {
+		chunk = size > DELTA_WINDOW ? DELTA_WINDOW : size;
+		write_varint(out, 0); // Source view offset
+		write_varint(out, 0); // Source view length
+		write_varint(out, chunk); // Target view length
+		write_varint(out, chunk < 64 ? 1 : 1 + varint_len(chunk)); // Instructions length
+		write_varint(out, chunk); // New data length
+		if (chunk < 64) {
+			fputc(0x80 | chunk, out);
+		}
+		else {
+			fputc(0x80, out);
+			write_varint(out, chunk);
+		}
+		write_text(out, chunk);
+		size -= chunk;
+	}
+}
+
+void write_file(FILE *out, char *path, char *action, options *opt) {
+	long size = get_file_size(opt);
+	long content = opt->deltas ? get_delta_size(size) : size;
+	int props = strcmp(action, "add") == 0;
+	fprintf(out, "Node-path: %s\nNode-kind: file\nNode-action: %s\n", path, action);
+	if (opt->deltas) {
+		fprintf(out, "Text-delta: true\n");
+	}
+	if (props) {
+		fprintf(out, "Prop-content-length: 10\n");
+	}
+	fprintf(out, "Text-content-length: %ld\nContent-length: %ld\n\n", content, content + (props ? 10 : 0));
+	if (props) {
+		fprintf(out, "PROPS-END\n");
+	}
+	if (opt->deltas) {
+		write_delta(out, size);
+	}
+	else {
+		write_text(out, size);
+	}
+	fprintf(out, "\n\n");
+}
+
+// Sets svn:mergeinfo on trunk, claiming merges from a few of the existing branches.
+void write_merge(FILE *out, repo *r, int rev) {
+	char *value, *props;
+	int i, count, len;
+	count = 1 + random_int(r->branch_len < 5 ? r->branch_len : 5);
+	value = str_malloc(count * 64 + 1);
+	props = str_malloc(count * 64 + 64);
+	len = 0;
+	for (i = 0; i < count; ++i) {
+		len += sprintf(&value[len], "%s/branches/b%d:%d-%d", i ? "\n" : "", r->branches[random_int(r->branch_len)], 1 + random_int(rev - 1), rev - 1);
+	}
+	len = sprintf(props, "K 13\nsvn:mergeinfo\nV %d\n%s\nPROPS-END\n", len, value);
+	fprintf(out, "Node-path: trunk\nNode-kind: dir\nNode-action: change\nProp-content-length: %d\nContent-length: %d\n\n%s\n\n", len, len, props);
+	free(value);
+	free(props);
+}
+
+/*******************************************************************************
+ *
+ * Repository model
+ *
+ ******************************************************************************/
+
+void add_dir(repo *r, char *path, int depth) {
+	if (r->dir_len == r->dir_max) {
+		r->dir_max += INCREMENT;
+		if ((r->dirs = (dir*)realloc(r->dirs, r->dir_max * sizeof(dir))) == NULL) {
+			exit_with_error("realloc failed", 2);
+		}
+	}
+	r->dirs[r->dir_len].path = path;
+	r->dirs[r->dir_len].depth = depth;
+	r->dirs[r->dir_len].children = 0;
+	++r->dir_len;
+}
+
+void add_file_path(repo *r, char *path, int rev) {
+	if (r->file_len == r->file_max) {
+		r->file_max += INCREMENT;
+		if ((r->files = (file*)realloc(r->files, r->file_max * sizeof(file))) == NULL) {
+			exit_with_error("realloc failed", 2);
+		}
+	}
+	r->files[r->file_len].path = path;
+	r->files[r->file_len].rev = rev;
+	++r->file_len;
+}
+
+// Removes the file from the model, and returns its path, which the caller must free.
+char* remove_file(repo *r, int i) {
+	char *path = r->files[i].path;
+	--r->file_len;
+	r->files[i] = r->files[r->file_len];
+	return path;
+}
+
+// Adds a new file to trunk, first creating a directory for it if the tree has room to grow.
+void add_new_file(FILE *out, repo *r, options *opt, int rev, int *counter) {
+	int d = random_int(r->dir_len);
+	char *path;
+	if (r->dirs[d].depth < opt->depth && r->dirs[d].children < opt->width && random_double() < 0.3) {
+		path = str_malloc(strlen(r->dirs[d].path) + 24);
+		sprintf(path, "%s/dir%d", r->dirs[d].path, ++*counter);
+		++r->dirs[d].children;
+		write_dir(out, path, "add", NULL, 0);
+		add_dir(r, path, r->dirs[d].depth + 1);
+		d = r->dir_len - 1;
+	}
+	path = str_malloc(strlen(r->dirs[d].path) + 36);
+	sprintf(path, "%s/file%d-%d.txt", r->dirs[d].path, rev, ++*counter);
+	write_file(out, path, "add", opt);
+	add_file_path(r, path, rev);
+}
+
+/*******************************************************************************
+ *
+ * Main method
+ *
+ ******************************************************************************/
+
+int main(int argc, char **argv) {
+	int i, j, rev, nodes, counter;
+	double action;
+	char log[128];
+	char path[64];
+	char *temp;
+	FILE *outfile = stdout;
+	options opt;
+	repo r;
+
+	opt.revisions = 1000;
+	opt.width = 10;
+	opt.depth = 4;
+	opt.nodes_per_rev = 4;
+	opt.add_ratio = 0.3;
+	opt.delete_ratio = 0.05;
+	opt.branch_every = 100;
+	opt.tag_every = 250;
+	opt.delete_storm_every = 0;
+	opt.delete_storm_size = 1000;
+	opt.mergeinfo_density = 0.02;
+	opt.size_dist = "exp";
+	opt.size_mean = 2000;
+	opt.max_size = 10000000;
+	opt.deltas = 0;
+	opt.seed = 1;
+
+	// Analyze the given parameters
+	for (i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0) {
+			show_help_and_exit();
+		}
+		else if (strcmp(argv[i], "--deltas") == 0) {
+			opt.deltas = 1;
+		}
+		else if (i + 1 == argc) {
+			exit_with_error(strcat(argv[i], " is not a valid parameter, or lacks a value"), 1);
+		}
+		else if (strcmp(argv[i], "--outfile") == 0 || strcmp(argv[i], "-o") == 0) {
+			if ((outfile = fopen(argv[++i], "wb")) == NULL) {
+				exit_with_error(strcat(argv[i], " can not be opened as outfile"), 3);
+			}
+		}
+		else if (strcmp(argv[i], "--revisions") == 0) {
+			opt.revisions = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--width") == 0) {
+			opt.width = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--depth") == 0) {
+			opt.depth = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--nodes-per-rev") == 0) {
+			opt.nodes_per_rev = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--add-ratio") == 0) {
+			opt.add_ratio = atof(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--delete-ratio") == 0) {
+			opt.delete_ratio = atof(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--branch-every") == 0) {
+			opt.branch_every = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--tag-every") == 0) {
+			opt.tag_every = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--delete-storm-every") == 0) {
+			opt.delete_storm_every = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--delete-storm-size") == 0) {
+			opt.delete_storm_size = atoi(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--mergeinfo-density") == 0) {
+			opt.mergeinfo_density = atof(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--size-dist") == 0) {
+			opt.size_dist = argv[++i];
+		}
+		else if (strcmp(argv[i], "--size-mean") == 0) {
+			opt.size_mean = atof(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--max-size") == 0) {
+			opt.max_size = atol(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--seed") == 0) {
+			opt.seed = strtoull(argv[++i], NULL, 10);
+		}
+		else {
+			exit_with_error(strcat(argv[i], " is not a valid parameter"), 1);
+		}
+	}
+	if (opt.revisions < 1 || opt.width < 1 || opt.depth < 0 || opt.nodes_per_rev < 1 || opt.size_mean < 1) {
+		exit_with_error("Invalid repository shape", 1);
+	}
+	rng_state = opt.seed * 2654435761ULL + 88172645463325252ULL;
+	random_data = str_malloc(RANDOM_DATA_SIZE);
+	for (i = 0; i < RANDOM_DATA_SIZE; ++i) {
+		// Printable characters and the occasional newline, so the content looks like text.
+		random_data[i] = random_int(40) ? ' ' + random_int(95) : '\n';
+	}
+	r.dirs = NULL;
+	r.files = NULL;
+	r.branches = NULL;
+	r.dir_len = r.dir_max = r.file_len = r.file_max = 0;
+	r.branch_len = r.tag_len = r.next_branch = 0;
+	counter = 0;
+
+	fprintf(outfile, "SVN-fs-dump-format-version: %d\n\nUUID: 5ca1ab1e-0000-4000-8000-%.12llx\n\n", opt.deltas ? 3 : 2, opt.seed);
+	write_revision(outfile, 0, "");
+	write_revision(outfile, 1, "Create the standard layout");
+	write_dir(outfile, "trunk", "add", NULL, 0);
+	write_dir(outfile, "branches", "add", NULL, 0);
+	write_dir(outfile, "tags", "add", NULL, 0);
+	temp = str_malloc(6);
+	strcpy(temp, "trunk");
+	add_dir(&r, temp, 0);
+
+	for (rev = 2; rev <= opt.revisions; ++rev) {
+		if (opt.branch_every > 0 && rev % opt.branch_every == 0) {
+			sprintf(log, "Create branch b%d", r.next_branch);
+			write_revision(outfile, rev, log);
+			sprintf(path, "branches/b%d", r.next_branch);
+			write_dir(outfile, path, "add", "trunk", rev - 1);
+			if ((r.branches = (int*)realloc(r.branches, (r.branch_len + 1) * sizeof(int))) == NULL) {
+				exit_with_error("realloc failed", 2);
+			}
+			r.branches[r.branch_len] = r.next_branch;
+			++r.branch_len;
+			++r.next_branch;
+			// Keep the number of live branches bounded, like real projects do.
+			if (r.branch_len > 20) {
+				sprintf(path, "branches/b%d", r.branches[0]);
+				write_delete(outfile, path);
+				memmove(r.branches, &r.branches[1], (r.branch_len - 1) * sizeof(int));
+				--r.branch_len;
+			}
+		}
+		else if (opt.tag_every > 0 && rev % opt.tag_every == 0) {
+			sprintf(log, "Tag release %d", r.tag_len);
+			write_revision(outfile, rev, log);
+			sprintf(path, "tags/release%d", r.tag_len);
+			write_dir(outfile, path, "add", "trunk", rev - 1);
+			++r.tag_len;
+		}
+		else if (opt.delete_storm_every > 0 && rev % opt.delete_storm_every == 0) {
+			write_revision(outfile, rev, "Delete storm");
+			for (i = 0; i < opt.delete_storm_size && r.file_len > 0; ++i) {
+				temp = remove_file(&r, random_int(r.file_len));
+				write_delete(outfile, temp);
+				free(temp);
+			}
+		}
+		else if (r.branch_len > 0 && random_double() < opt.mergeinfo_density) {
+			write_revision(outfile, rev, "Merge from branches");
+			write_merge(outfile, &r, rev);
+		}
+		else {
+			sprintf(log, "Commit %d", rev);
+			write_revision(outfile, rev, log);
+			nodes = 1 + random_int(opt.nodes_per_rev);
+			for (i = 0; i < nodes; ++i) {
+				action = random_double();
+				if (r.file_len == 0 || action < opt.add_ratio) {
+					add_new_file(outfile, &r, &opt, rev, &counter);
+				}
+				else {
+					// A file can only be touched once per revision.
+					j = random_int(r.file_len);
+					if (r.files[j].rev == rev) {
+						continue;
+					}
+					if (action < opt.add_ratio + opt.delete_ratio) {
+						temp = remove_file(&r, j);
+						write_delete(outfile, temp);
+						free(temp);
+					}
+					else {
+						write_file(outfile, r.files[j].path, "change", &opt);
+						r.files[j].rev = rev;
+					}
+				}
+			}
+		}
+	}
+
+	// Clean everything up
+	if (outfile != stdout) {
+		fclose(outfile);
+	}
+	for (i = 0; i < r.dir_len; ++i) {
+		free(r.dirs[i].path);
+	}
+	for (i = 0; i < r.file_len; ++i) {
+		free(r.files[i].path);
+	}
+	free(r.dirs);
+	free(r.files);
+	free(r.branches);
+	free(random_data);
+	return 0;
+}
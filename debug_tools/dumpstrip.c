@@ -1,11 +1,17 @@
 /*
-dumpstrip-0.1 Copyright 2011 Daniel Suni
+dumpstrip-0.2 Copyright 2011 Daniel Suni
 
 May be distrubuted under the terms of the GNU GPL v3 or later.
 
 Compile with "gcc dumpstrip.c -o dumpstrip"
 
 Use with "dumpstrip --infile foo.dump --outfile bar.dump"
+
+With --sparse the dump keeps its size and structure: the node headers and properties are
+kept, and the text of every node is replaced with zeros. Large runs of zeros are left as
+holes in the outfile, so it takes up little space on disk, but svndumpsanitizer has to read
+just as much as from the original. Use with
+"dumpstrip --sparse --infile foo.dump --outfile bar.dump"
  */
 #define _FILE_OFFSET_BITS 64
 
@@ -14,8 +20,20 @@ Use with "dumpstrip --infile foo.dump --outfile bar.dump"
 #include <string.h>
 
 #define CONTENT_PADDING 2
-#define INCREMENT 10
 #define NEWLINE 10
+#define BUFFER_SIZE 1048576
+#define MIN_HOLE 65536 // Smaller runs of zeros are written, since a hole wouldn't save anything
+
+// The infile is read in large blocks, and the lines are handed out from the buffer.
+typedef struct {
+	FILE *file;
+	char *buffer;
+	size_t size;
+	size_t pos;
+	size_t len;
+} input;
+
+char zeros[MIN_HOLE];
 
 void exit_with_error(char *message, int exit_code) {
 	fprintf(stderr,"ERROR: %s\n", message);
@@ -34,31 +52,115 @@ int starts_with(char *a, char *b) {
 	return 1;
 }
 
+// Moves what hasn't been used yet to the beginning of the buffer, and fills the rest.
+// Returns 0 if nothing more could be read.
+int fill_buffer(input *in) {
+	size_t read;
+	if (in->pos > 0) {
+		memmove(in->buffer, &in->buffer[in->pos], in->len - in->pos);
+		in->len -= in->pos;
+		in->pos = 0;
+	}
+	// A line longer than the buffer needs a bigger one.
+	if (in->len == in->size) {
+		in->size *= 2;
+		if ((in->buffer = (char*)realloc(in->buffer, in->size + 1)) == NULL) {
+			exit_with_error("realloc failed", 2);
+		}
+	}
+	read = fread(&in->buffer[in->len], 1, in->size - in->len, in->file);
+	in->len += read;
+	return read > 0;
+}
+
+// Returns the next line, without the newline, and its length through len. The line stays
+// valid until the next call. A line that isn't terminated by a newline at the end of the file
+// isn't returned.
+char* next_line(input *in, size_t *len) {
+	char *line, *end;
+	size_t scanned = 0;
+	while ((end = (char*)memchr(&in->buffer[in->pos + scanned], NEWLINE, in->len - in->pos - scanned)) == NULL) {
+		scanned = in->len - in->pos;
+		if (!fill_buffer(in)) {
+			return NULL;
+		}
+	}
+	line = &in->buffer[in->pos];
+	*end = '\0';
+	*len = end - line;
+	in->pos += *len + 1;
+	return line;
+}
+
+// Skips count bytes of the infile.
+void skip_input(input *in, off_t count) {
+	if (count <= (off_t)(in->len - in->pos)) {
+		in->pos += count;
+		return;
+	}
+	count -= in->len - in->pos;
+	in->pos = 0;
+	in->len = 0;
+	fseeko(in->file, count, SEEK_CUR);
+}
+
+// Copies count bytes of the infile to the outfile.
+void copy_input(input *in, FILE *outfile, off_t count) {
+	size_t chunk;
+	while (count > 0) {
+		if (in->pos == in->len && !fill_buffer(in)) {
+			return;
+		}
+		chunk = in->len - in->pos;
+		if ((off_t)chunk > count) {
+			chunk = count;
+		}
+		fwrite(&in->buffer[in->pos], 1, chunk, outfile);
+		in->pos += chunk;
+		count -= chunk;
+	}
+}
+
+// Writes count zeros to the outfile, leaving large runs of them as holes. Something is
+// always written after a hole, so the file never ends in one.
+void write_zeros(FILE *outfile, off_t count) {
+	if (count <= 0) {
+		return;
+	}
+	if (count >= MIN_HOLE) {
+		fseeko(outfile, count, SEEK_CUR);
+		return;
+	}
+	fwrite(zeros, 1, count, outfile);
+}
+
 int main(int argc, char **argv) {
 	// Misc temporary variables
-	int i, ch;
+	int i;
 	int in = 0;
 	int out = 0;
-	int cur_len = 0;
-	int cur_max = 80;
+	int sparse = 0;
 	int reading_node = 0;
+	size_t len;
 	off_t con_len;
-	FILE *infile = NULL;
+	off_t pcon_len = 0;
+	input infile;
 	FILE *outfile = NULL;
 	char *current_line;
-	if ((current_line = (char*)calloc(cur_max, 1)) == NULL) {
-		exit_with_error("calloc failed", 2);
-	}
+	infile.file = NULL;
 
 	// Analyze the given parameters
 	for (i = 1 ; i < argc ; ++i) {
 		if (starts_with(argv[i], "-")) {
 			in = (!strcmp(argv[i], "--infile") || !strcmp(argv[i], "-i"));
 			out = (!strcmp(argv[i], "--outfile") || !strcmp(argv[i], "-o"));
+			if (!strcmp(argv[i], "--sparse") || !strcmp(argv[i], "-s")) {
+				sparse = 1;
+			}
 		}
-		else if (in && infile == NULL) {
-			infile = fopen(argv[i],"rb");
-			if (infile == NULL) {
+		else if (in && infile.file == NULL) {
+			infile.file = fopen(argv[i],"rb");
+			if (infile.file == NULL) {
 				exit_with_error(strcat(argv[i], " can not be opened as infile") , 3);
 			}
 		}
@@ -72,51 +174,57 @@ int main(int argc, char **argv) {
 			exit_with_error(strcat(argv[i], " is not a valid parameter"), 1);
 		}
 	}
-	if (infile == NULL) {
+	if (infile.file == NULL) {
 		exit_with_error("You must specify an infile", 1);
 	}
 	if (outfile == NULL) {
 		exit_with_error("You must specify an outfile", 1);
 	}
+	infile.size = BUFFER_SIZE;
+	infile.pos = 0;
+	infile.len = 0;
+	if ((infile.buffer = (char*)malloc(infile.size + 1)) == NULL) {
+		exit_with_error("malloc failed", 2);
+	}
 
 	// Copy the infile to the outfile skipping the data.
 	reading_node = 0;
-	while ((ch = fgetc(infile)) != EOF) {
-		if (ch == NEWLINE) {
-			if (reading_node) {
-				if (strlen(current_line) == 0) {
-					reading_node = 0;
-				}
-				else if (starts_with(current_line, "Content-length: ")) {
-					con_len = (off_t)atol(&current_line[16]);
-					fseeko(infile, con_len + CONTENT_PADDING, SEEK_CUR);
-					reading_node = 0;
-				}
+	while ((current_line = next_line(&infile, &len)) != NULL) {
+		// Without --sparse, the lines are cut at NULL characters as they always have been.
+		fwrite(current_line, 1, sparse ? len : strlen(current_line), outfile);
+		fputc('\n', outfile);
+		if (reading_node) {
+			if (current_line[0] == '\0') {
+				reading_node = 0;
 			}
-			else if (starts_with(current_line, "Node-path: ")) {
-				reading_node = 1;
+			else if (starts_with(current_line, "Prop-content-length: ")) {
+				pcon_len = (off_t)atol(&current_line[21]);
 			}
-			fprintf(outfile, "%s\n", current_line);
-			current_line[0] = '\0';
-			cur_len = 0;
-		}
-		else {
-			if (cur_len == cur_max - 1) {
-				cur_max += INCREMENT;
-				if ((current_line = (char*)realloc(current_line, cur_max)) == NULL) {
-					exit_with_error("realloc failed", 2);
+			else if (starts_with(current_line, "Content-length: ")) {
+				con_len = (off_t)atol(&current_line[16]);
+				if (sparse) {
+					// The empty line and the properties are kept, the text replaced with zeros.
+					copy_input(&infile, outfile, 1 + pcon_len);
+					skip_input(&infile, con_len - pcon_len);
+					write_zeros(outfile, con_len - pcon_len);
+					copy_input(&infile, outfile, CONTENT_PADDING - 1);
 				}
+				else {
+					skip_input(&infile, con_len + CONTENT_PADDING);
+				}
+				reading_node = 0;
 			}
-			current_line[cur_len] = ch;
-			++cur_len;
-			current_line[cur_len] = '\0';
+		}
+		else if (starts_with(current_line, "Node-path: ")) {
+			reading_node = 1;
+			pcon_len = 0;
 		}
 	}
 
 	// Clean everything up
-	fclose(infile);
+	fclose(infile.file);
 	fclose(outfile);
-	free(current_line);
+	free(infile.buffer);
 
 	return 0;
 }
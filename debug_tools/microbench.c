@@ -0,0 +1,567 @@
+/*
+microbench-0.1
+
+May be distrubuted under the terms of the GNU GPL v3 or later.
+
+Times the helper functions every phase of svndumpsanitizer depends on, on generated paths
+and histories of a few shapes: deep trees, wide directories, long histories and large
+mergeinfo. svndumpsanitizer.c is compiled in, so compile from the directory it is in with
+"gcc -O2 -pthread -I. debug_tools/microbench.c -o microbench"
+
+For every function and shape it prints the time and the number of allocations per call.
+With --output the results are also written to a baseline file, which a later build can be
+compared to with --compare, e.g. to see what a change did:
+
+microbench --output before.txt
+(change svndumpsanitizer.c and build again)
+microbench --compare before.txt
+
+The functions are called directly, with the types and signatures of the svndumpsanitizer.c
+next to this file, so a baseline can only be taken from the same version of both files,
+i.e. before the change. Older releases of svndumpsanitizer can't be built with it.
+ */
+#define _FILE_OFFSET_BITS 64
+
+// The same headers as svndumpsanitizer.c, before the allocation functions are redefined.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <pthread.h>
+#include <sched.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+#include <setjmp.h>
+
+#define MIN_TIME 0.2 // Seconds each benchmark runs at least, by default
+#define MAX_BENCHMARKS 64
+#define NAME_SIZE 64
+#define MERGEINFO_CALLS 100 // Calls per round of add_mergedata, which is slow with many rows
+
+long long allocations = 0;
+
+void* counted_malloc(size_t size) {
+	++allocations;
+	return malloc(size);
+}
+
+void* counted_calloc(size_t count, size_t size) {
+	++allocations;
+	return calloc(count, size);
+}
+
+void* counted_realloc(void *p, size_t size) {
+	++allocations;
+	return realloc(p, size);
+}
+
+#define malloc(size) counted_malloc(size)
+#define calloc(count, size) counted_calloc(count, size)
+#define realloc(p, size) counted_realloc(p, size)
+#define SDS_LIBRARY
+#include "svndumpsanitizer.c"
+
+// A shape of repository: the paths in it, and how the nodes are spread over them.
+typedef struct {
+	char *name;
+	char **paths; // Every directory and file, parents before children
+	int len;
+	char **events; // The path of each node, in the order they're added
+	int event_len;
+} shape;
+
+typedef struct {
+	char name[NAME_SIZE];
+	double ns;
+	double allocs;
+} result;
+
+unsigned int seed = 1;
+double min_time = MIN_TIME;
+char *only = NULL; // Only run the benchmarks with this in their names
+
+// xorshift, so that the same seed gives the same paths everywhere
+unsigned int next_random() {
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+	return seed;
+}
+
+double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void add_path(shape *s, char *parent, char *name) {
+	char *path = str_malloc(strlen(parent) + strlen(name) + 2);
+	if (parent[0] == '\0') {
+		strcpy(path, name);
+	}
+	else {
+		sprintf(path, "%s/%s", parent, name);
+	}
+	if ((s->paths = (char**)realloc(s->paths, (s->len + 1) * sizeof(char*))) == NULL) {
+		exit_with_error("realloc failed", 2);
+	}
+	s->paths[s->len] = path;
+	++s->len;
+}
+
+// Fills the directory with width subdirectories and files each, depth levels down.
+void add_tree(shape *s, char *parent, int width, int depth) {
+	int i, first;
+	char name[32];
+	first = s->len;
+	for (i = 0; i < width; ++i) {
+		sprintf(name, depth > 0 ? "dir%d" : "file%d.c", i);
+		add_path(s, parent, name);
+	}
+	if (depth == 0) {
+		return;
+	}
+	for (i = 0; i < width; ++i) {
+		add_tree(s, s->paths[first + i], width, depth - 1);
+	}
+}
+
+// Every path is added once, and then changed events_per_path - 1 times at random.
+void add_events(shape *s, int events_per_path) {
+	int i;
+	s->event_len = s->len * events_per_path;
+	if ((s->events = (char**)malloc(s->event_len * sizeof(char*))) == NULL) {
+		exit_with_error("malloc failed", 2);
+	}
+	for (i = 0; i < s->event_len; ++i) {
+		s->events[i] = s->paths[i < s->len ? i : (int)(next_random() % s->len)];
+	}
+}
+
+void init_shape(shape *s, char *name, int width, int depth, int events_per_path) {
+	s->name = name;
+	s->paths = NULL;
+	s->len = 0;
+	add_path(s, "", "trunk");
+	add_tree(s, "trunk", width, depth);
+	add_events(s, events_per_path);
+}
+
+void free_shape(shape *s) {
+	int i;
+	for (i = 0; i < s->len; ++i) {
+		free(s->paths[i]);
+	}
+	free(s->paths);
+	free(s->events);
+}
+
+// Returns a path of the shape picked at random.
+char* any_path(shape *s) {
+	return s->paths[next_random() % s->len];
+}
+
+// Returns the parent directory of a path picked at random, in a buffer of its own.
+char* any_dir(shape *s, char *buffer) {
+	char *slash;
+	strcpy(buffer, any_path(s));
+	if ((slash = strrchr(buffer, '/')) != NULL) {
+		*slash = '\0';
+	}
+	return buffer;
+}
+
+// The arguments of the calls are set up before the timing starts, so that only the calls
+// are measured.
+typedef struct {
+	shape *s;
+	char **a; // Paths
+	char **b; // Prefixes of them, or other directories
+	char **c; // More paths
+	int *n; // Revisions
+	int ops;
+	repotree rt;
+	repotree **targets; // The subtree of each path in a
+	node_id first;
+	char *minfo;
+	size_t minfo_len;
+	char *scratch;
+	char **include;
+	char **inc_slash;
+	int inc_len;
+} bench_args;
+
+typedef void (*bench_fn)(bench_args *args);
+
+// Keeps the compiler from leaving out calls whose results aren't used.
+volatile long long sink;
+
+void run_starts_with(bench_args *args) {
+	int i;
+	for (i = 0; i < args->ops; ++i) {
+		sink += starts_with(args->a[i], args->b[i]);
+	}
+}
+
+void run_matches_path_start(bench_args *args) {
+	int i;
+	for (i = 0; i < args->ops; ++i) {
+		sink += matches_path_start(args->a[i], args->b[i]);
+	}
+}
+
+void run_reduce_path(bench_args *args) {
+	int i;
+	for (i = 0; i < args->ops; ++i) {
+		sink += *reduce_path(args->b[i], args->a[i]);
+	}
+}
+
+void run_get_dir_after_copyfrom(bench_args *args) {
+	int i;
+	char *path = NULL;
+	size_t max = 0;
+	for (i = 0; i < args->ops; ++i) {
+		sink += *get_dir_after_copyfrom(args->c[i], args->a[i], args->b[i], &path, &max);
+	}
+	free(path);
+}
+
+void run_is_cluded(bench_args *args) {
+	int i;
+	for (i = 0; i < args->ops; ++i) {
+		sink += is_cluded(args->a[i], args->include, args->inc_slash, args->inc_len);
+	}
+}
+
+// Every node of the shape is a revision of its own.
+void prepare_add_event(bench_args *args) {
+	int i;
+	args->first = alloc_nodes(args->s->event_len);
+	for (i = 0; i < args->s->event_len; ++i) {
+		init_node(args->first + i, intern_path(args->s->events[i]), i + 1, i < args->s->len ? ADD : CHANGE);
+	}
+	memset(&args->rt, 0, sizeof(repotree));
+}
+
+void run_add_event(bench_args *args) {
+	int i;
+	for (i = 0; i < args->s->event_len; ++i) {
+		add_event(&args->rt, args->first + i);
+	}
+}
+
+void clean_add_event(bench_args *args) {
+	free_tree(&args->rt);
+	free(args->rt.children);
+	memset(&args->rt, 0, sizeof(repotree));
+	free_pool();
+	free_paths();
+}
+
+void run_get_subtree(bench_args *args) {
+	int i;
+	for (i = 0; i < args->ops; ++i) {
+		sink += get_subtree(&args->rt, args->a[i], 0) != NULL;
+	}
+}
+
+void prepare_get_node_at_revision(bench_args *args) {
+	int i;
+	for (i = 0; i < args->ops; ++i) {
+		args->targets[i] = get_subtree(&args->rt, args->a[i], 1);
+	}
+}
+
+void run_get_node_at_revision(bench_args *args) {
+	int i;
+	for (i = 0; i < args->ops; ++i) {
+		sink += get_node_at_revision(args->targets[i]->map, args->n[i], args->targets[i]->map_len);
+	}
+}
+
+// add_mergedata writes into the mergeinfo, so it gets a fresh copy for every call. The
+// copying is part of the time, but doesn't allocate anything.
+void run_add_mergedata(bench_args *args) {
+	int i, j, size;
+	mergedata *md;
+	for (i = 0; i < MERGEINFO_CALLS; ++i) {
+		memcpy(args->scratch, args->minfo, args->minfo_len);
+		md = add_mergedata(args->scratch, &size);
+		sink += md->size;
+		for (j = 0; j < md->size; ++j) {
+			free(md->path[j]);
+		}
+		free(md->path);
+		free(md->from);
+		free(md->to);
+		free(md);
+	}
+}
+
+// Runs the function over and over until min_time has passed, and notes how long a call took
+// and how much it allocated. Only run is timed; prepare and clean, if given, are called before
+// and after each round.
+void measure(result *res, int *res_len, char *name, char *shape_name, bench_args *args, int ops, bench_fn prepare, bench_fn run, bench_fn clean) {
+	long long calls = 0;
+	long long allocs = 0;
+	long long before;
+	double start;
+	double elapsed = 0;
+	char full[NAME_SIZE];
+	snprintf(full, sizeof(full), "%s/%s", name, shape_name);
+	if (only && strstr(full, only) == NULL) {
+		return;
+	}
+	do {
+		if (prepare) {
+			prepare(args);
+		}
+		before = allocations;
+		start = now();
+		run(args);
+		elapsed += now() - start;
+		allocs += allocations - before;
+		calls += ops;
+		if (clean) {
+			clean(args);
+		}
+	} while (elapsed < min_time);
+	strcpy(res[*res_len].name, full);
+	res[*res_len].ns = elapsed * 1e9 / calls;
+	res[*res_len].allocs = (double)allocs / calls;
+	printf("%-36s %10.1f ns/op %8.2f allocs/op\n", full, res[*res_len].ns, res[*res_len].allocs);
+	fflush(stdout);
+	++*res_len;
+}
+
+// Fills the arguments with ops random paths of the shape, and the prefixes to test them with.
+void init_args(bench_args *args, shape *s, int ops) {
+	int i;
+	char buffer[4096];
+	args->s = s;
+	args->ops = ops;
+	if ((args->a = (char**)malloc(ops * sizeof(char*))) == NULL || (args->b = (char**)malloc(ops * sizeof(char*))) == NULL || (args->c = (char**)malloc(ops * sizeof(char*))) == NULL || (args->n = (int*)malloc(ops * sizeof(int))) == NULL || (args->targets = (repotree**)malloc(ops * sizeof(repotree*))) == NULL) {
+		exit_with_error("malloc failed", 2);
+	}
+	for (i = 0; i < ops; ++i) {
+		args->a[i] = any_path(s);
+		// Half of the prefixes are directories the path is in.
+		if (next_random() % 2) {
+			any_dir(s, buffer);
+		}
+		else {
+			strcpy(buffer, args->a[i]);
+			while (strlen(buffer) > 0 && next_random() % 3) {
+				*(strrchr(buffer, '/') ? strrchr(buffer, '/') : buffer) = '\0';
+			}
+		}
+		args->b[i] = str_malloc(strlen(buffer) + 1);
+		strcpy(args->b[i], buffer);
+		args->c[i] = any_path(s);
+		args->n[i] = next_random() % (s->event_len + 1);
+	}
+	args->include = NULL;
+	args->inc_slash = NULL;
+	args->inc_len = 0;
+	args->minfo = NULL;
+	args->scratch = NULL;
+	memset(&args->rt, 0, sizeof(repotree));
+}
+
+void free_args(bench_args *args) {
+	int i;
+	for (i = 0; i < args->ops; ++i) {
+		free(args->b[i]);
+	}
+	for (i = 0; i < args->inc_len; ++i) {
+		free(args->include[i]);
+		free(args->inc_slash[i]);
+	}
+	free(args->a);
+	free(args->b);
+	free(args->c);
+	free(args->n);
+	free(args->targets);
+	free(args->include);
+	free(args->inc_slash);
+	free(args->minfo);
+	free(args->scratch);
+}
+
+// Picks len directories of the shape to include.
+void set_includes(bench_args *args, int len) {
+	int i;
+	char buffer[4096];
+	if ((args->include = (char**)malloc(len * sizeof(char*))) == NULL || (args->inc_slash = (char**)malloc(len * sizeof(char*))) == NULL) {
+		exit_with_error("malloc failed", 2);
+	}
+	for (i = 0; i < len; ++i) {
+		any_dir(args->s, buffer);
+		args->include[i] = str_malloc(strlen(buffer) + 1);
+		strcpy(args->include[i], buffer);
+		args->inc_slash[i] = add_slash_to(buffer);
+	}
+	args->inc_len = len;
+}
+
+// Makes the value of an svn:mergeinfo property with rows rows, the way it is when it has been
+// read: each row ends in a NULL instead of a newline.
+void set_mergeinfo(bench_args *args, int rows) {
+	int i, j, from;
+	char row[4096];
+	size_t len = 0;
+	args->minfo = NULL;
+	for (i = 0; i < rows; ++i) {
+		sprintf(row, "/branches/%s:", any_path(args->s));
+		from = next_random() % 1000 + 1;
+		for (j = next_random() % 8; j >= 0; --j) {
+			sprintf(&row[strlen(row)], "%d-%d%s", from, from + (int)(next_random() % 50), j > 0 ? "," : "");
+			from += 100;
+		}
+		if ((args->minfo = (char*)realloc(args->minfo, len + strlen(row) + 1)) == NULL) {
+			exit_with_error("realloc failed", 2);
+		}
+		strcpy(&args->minfo[len], row);
+		len += strlen(row) + 1;
+	}
+	if ((args->minfo = (char*)realloc(args->minfo, len + 10)) == NULL || (args->scratch = (char*)malloc(len + 10)) == NULL) {
+		exit_with_error("realloc failed", 2);
+	}
+	strcpy(&args->minfo[len], "PROPS-END");
+	args->minfo_len = len + 10;
+}
+
+int read_baseline(char *path, result *res) {
+	int len = 0;
+	char line[256];
+	FILE *file;
+	if ((file = fopen(path, "r")) == NULL) {
+		exit_with_error(strcat(path, " can not be opened as baseline"), 3);
+	}
+	while (len < MAX_BENCHMARKS && fgets(line, sizeof(line), file)) {
+		if (line[0] == '#' || sscanf(line, "%63s %lf %lf", res[len].name, &res[len].ns, &res[len].allocs) != 3) {
+			continue;
+		}
+		++len;
+	}
+	fclose(file);
+	return len;
+}
+
+void write_baseline(char *path, result *res, int len, unsigned int first_seed) {
+	int i;
+	FILE *file;
+	if ((file = fopen(path, "w")) == NULL) {
+		exit_with_error(strcat(path, " can not be opened as outfile"), 3);
+	}
+	fprintf(file, "# microbench of svndumpsanitizer %s, seed %u, %.2f s per benchmark\n", SDS_VERSION, first_seed, min_time);
+	fprintf(file, "# benchmark ns_per_op allocs_per_op\n");
+	for (i = 0; i < len; ++i) {
+		fprintf(file, "%s %.2f %.3f\n", res[i].name, res[i].ns, res[i].allocs);
+	}
+	fclose(file);
+}
+
+void compare(result *old, int old_len, result *res, int len) {
+	int i, j;
+	printf("\n%-40s %10s %10s %8s %10s %10s\n", "benchmark", "old ns/op", "new ns/op", "change", "old allocs", "new allocs");
+	for (i = 0; i < len; ++i) {
+		for (j = 0; j < old_len && strcmp(old[j].name, res[i].name) != 0; ++j);
+		if (j == old_len) {
+			printf("%-40s %10s %10.1f %8s %10s %10.2f\n", res[i].name, "-", res[i].ns, "-", "-", res[i].allocs);
+			continue;
+		}
+		printf("%-40s %10.1f %10.1f %+7.1f%% %10.2f %10.2f\n", res[i].name, old[j].ns, res[i].ns, 100 * (res[i].ns - old[j].ns) / old[j].ns, old[j].allocs, res[i].allocs);
+	}
+}
+
+int main(int argc, char **argv) {
+	int i;
+	int res_len = 0;
+	int old_len = 0;
+	unsigned int first_seed;
+	char *output_path = NULL;
+	char *compare_path = NULL;
+	result res[MAX_BENCHMARKS];
+	result old[MAX_BENCHMARKS];
+	shape shapes[3];
+	bench_args args;
+
+	for (i = 1; i < argc; ++i) {
+		if (!strcmp(argv[i], "--output") && i + 1 < argc) {
+			output_path = argv[++i];
+		}
+		else if (!strcmp(argv[i], "--compare") && i + 1 < argc) {
+			compare_path = argv[++i];
+		}
+		else if (!strcmp(argv[i], "--only") && i + 1 < argc) {
+			only = argv[++i];
+		}
+		else if (!strcmp(argv[i], "--time") && i + 1 < argc) {
+			min_time = atof(argv[++i]);
+		}
+		else if (!strcmp(argv[i], "--seed") && i + 1 < argc) {
+			seed = (unsigned int)atol(argv[++i]);
+		}
+		else {
+			printf("Usage: %s [--output BASELINE] [--compare BASELINE] [--only NAME] [--time SECONDS] [--seed N]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (seed == 0) {
+		seed = 1;
+	}
+	first_seed = seed;
+	if (compare_path) {
+		old_len = read_baseline(compare_path, old);
+	}
+
+	// Deep: two subdirectories per directory, twelve levels down. Wide: two hundred files
+	// in each of two hundred directories. History: a few hundred paths, each changed
+	// hundreds of times.
+	init_shape(&shapes[0], "deep", 2, 12, 4);
+	init_shape(&shapes[1], "wide", 200, 1, 4);
+	init_shape(&shapes[2], "history", 6, 2, 400);
+
+	for (i = 0; i < 3; ++i) {
+		init_args(&args, &shapes[i], 10000);
+		measure(res, &res_len, "starts_with", shapes[i].name, &args, args.ops, NULL, run_starts_with, NULL);
+		measure(res, &res_len, "matches_path_start", shapes[i].name, &args, args.ops, NULL, run_matches_path_start, NULL);
+		measure(res, &res_len, "reduce_path", shapes[i].name, &args, args.ops, NULL, run_reduce_path, NULL);
+		measure(res, &res_len, "get_dir_after_copyfrom", shapes[i].name, &args, args.ops, NULL, run_get_dir_after_copyfrom, NULL);
+		set_includes(&args, 10);
+		measure(res, &res_len, "is_cluded", shapes[i].name, &args, args.ops, NULL, run_is_cluded, NULL);
+		measure(res, &res_len, "add_event", shapes[i].name, &args, shapes[i].event_len, prepare_add_event, run_add_event, clean_add_event);
+		// The lookups are made in the tree of the whole shape.
+		prepare_add_event(&args);
+		run_add_event(&args);
+		measure(res, &res_len, "get_subtree", shapes[i].name, &args, args.ops, NULL, run_get_subtree, NULL);
+		measure(res, &res_len, "get_node_at_revision", shapes[i].name, &args, args.ops, prepare_get_node_at_revision, run_get_node_at_revision, NULL);
+		clean_add_event(&args);
+		// Mergeinfo from a few branches, or from hundreds of them.
+		if (i < 2) {
+			set_mergeinfo(&args, i == 0 ? 10 : 500);
+			measure(res, &res_len, "add_mergedata", i == 0 ? "few" : "many", &args, MERGEINFO_CALLS, NULL, run_add_mergedata, NULL);
+		}
+		free_args(&args);
+	}
+	for (i = 0; i < 3; ++i) {
+		free_shape(&shapes[i]);
+	}
+
+	if (output_path) {
+		write_baseline(output_path, res, res_len, first_seed);
+	}
+	if (compare_path) {
+		compare(old, old_len, res, res_len);
+	}
+	return 0;
+}
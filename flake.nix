@@ -31,7 +31,7 @@
           version = "v0.6.4";
           src = ./.;
           buildPhase = ''
-            gcc svndumpsanitizer.c -o svndumpsanitizer
+            gcc -pthread svndumpsanitizer.c -o svndumpsanitizer
           '';
           installPhase = ''
             mkdir -p $out/bin
@@ -46,6 +46,32 @@
             mainProgram = "svndumpsanitizer";
           };
         };
+        microbench = pkgs.stdenv.mkDerivation {
+          pname = "svndumpsanitizer-microbench";
+          version = "v0.6.4";
+          src = ./.;
+          buildPhase = ''
+            gcc -O2 -pthread -I. debug_tools/microbench.c -o microbench
+          '';
+          installPhase = ''
+            mkdir -p $out/bin
+            cp microbench $out/bin
+          '';
+          nativeBuildInputs = with pkgs; [gcc];
+        };
+        dumpgen = pkgs.stdenv.mkDerivation {
+          pname = "svndumpsanitizer-dumpgen";
+          version = "v0.6.4";
+          src = ./.;
+          buildPhase = ''
+            gcc -O2 debug_tools/dumpgen.c -o dumpgen -lm
+          '';
+          installPhase = ''
+            mkdir -p $out/bin
+            cp dumpgen $out/bin
+          '';
+          nativeBuildInputs = with pkgs; [gcc];
+        };
       in {
         # Pre-commit hooks.
         pre-commit = {
@@ -57,7 +83,7 @@
 
         # `nix build`
         packages = {
-          inherit svndumpsanitizer;
+          inherit svndumpsanitizer microbench dumpgen;
           default = svndumpsanitizer;
         };
 
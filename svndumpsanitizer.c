@@ -24,6 +24,7 @@
 #include <io.h>
 #include <fcntl.h>
 #define fseeko _fseeki64
+#define ftello _ftelli64
 #endif
 
 #define _FILE_OFFSET_BITS 64
@@ -32,6 +33,28 @@
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <unistd.h>
+#include <sys/resource.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <pthread.h>
+#include <sched.h>
+#endif
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+#include <setjmp.h>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "svndumpsanitizer.h"
 
 #define SDS_VERSION "2.0.7"
 #define ADD 0
@@ -41,39 +64,145 @@
 #define CONTENT_PADDING 2
 #define INCREMENT 10
 #define NEWLINE 10
+#define INPUT_BUFFER_SIZE 1048576
+#define INPUT_PREFETCH_SIZE 67108864 // How much of the next infile to ask the kernel to read ahead
+#define SLICE_HEADER_MAX 4096 // How far into an infile after the first its dump header is looked for
+// Compressed infiles
+#define FRAMES_BGZF 1
+#define FRAMES_ZSTD 2
+#define ZSTD_MAGIC 0xfd2fb528
+#define ZSTD_SEEKABLE_MAGIC 0x8f92eab1
+#define FRAME_BATCH_SIZE 16777216 // Decompressed bytes of frames decompressed together
+#define MAX_PHASES 16
+#define PROGRESS_INTERVAL 0.5
+#define ARENA_CHUNK_SIZE 268435456
+#define MEMORY_CHECK_INTERVAL 256
+#define CHECKPOINT_INTERVAL 10.0
+#define MAX_THREADS 256
+#define VERIFY_QUEUE_SIZE 67108864 // Bytes of node text waiting to be hashed
+#define PIPELINE_DEPTH 256 // Revisions read ahead of the analysis
+#define FNV_OFFSET 2166136261u // For hashing paths
+#define FNV_PRIME 16777619u
+// What the merge path index knows about a path
+#define PATH_UNKNOWN 0
+#define PATH_FOUND 1
+#define PATH_MISSING 2
+#define PROFILE_DEPTH 3 // Levels of directories reported by --profile-repo
+#define MAX_EXTENT 67108864 // Bytes copied at most between progress updates and checkpoints
+#define CHECKPOINT_MAGIC "svndumpsanitizer checkpoint 2\n"
+// Kinds of dependencies, for --stats
+#define DEP_HISTORY 0
+#define DEP_DIR 1
+#define DEP_FILE 2
+#define DEP_MERGE 3
+#define DEP_SUBTREE 4
+#define DEP_KINDS 5
+// Nodes and dependency edges are stored in blocks that never move
+#define NODE_BLOCK_BITS 16
+#define NODE_BLOCK_SIZE (1 << NODE_BLOCK_BITS)
+#define NODE_BYTES (3 * 4 + 2 + 1) // Bytes of the columns of a node, not counting the wanted bit
+#define NODE_BLOCK_BYTES ((size_t)NODE_BLOCK_SIZE * NODE_BYTES + NODE_BLOCK_SIZE / 8)
+#define EDGE_BLOCK_BITS 20
+#define EDGE_BLOCK_SIZE (1 << EDGE_BLOCK_BITS)
+#define NO_NODE 0xffffffff
+#define PATH_CHUNK_SIZE 1048576
+#define NO_PATH 0xffffffff
+// Flags kept with the action of a node
+#define ACTION_MASK 3
+#define NODE_FAKE 4
+#define NODE_COPY 8
 
 // For details on the svn dump file format see:
 // http://svn.apache.org/repos/asf/subversion/trunk/notes/dump-load-format.txt
 
-// A node from an svn dump file can contain a lot of data. This
-// struct only holds the parts relevant to filtering.
-typedef struct node {
-	struct node **deps;
+// Nodes are referred to by 32-bit ids, which index the node pool.
+typedef unsigned int node_id;
+
+// Paths are referred to by 32-bit ids, which index the path table.
+typedef unsigned int path_id;
+
+// A node from an svn dump file can contain a lot of data. This struct only holds the
+// parts relevant to filtering, as read from the file. Once its revision has been read,
+// the node is moved to the node pool.
+typedef struct {
 	char *path;
 	char *copyfrom;
 	int copyfrom_rev;
-	int revision;
-	unsigned short dep_len;
 	char action;
-	char wanted;
-} node;
+} parsed_node;
 
 typedef struct {
-	node *nodes;
-	node **fakes;
+	node_id first; // Id of the first node
+	node_id first_fake; // The fakes of a revision have consecutive ids
+	off_t offset; // Where its Revision-number line starts in the infile
 	int size;
 	int fake_size;
 	int number;
+	char plain; // Whether its revision numbers are written the way the writer would rewrite them
 } revision;
 
 typedef struct repotree {
 	struct repotree *children;
-	char *path;
-	node **map;
+	char *path; // Belongs to the path table
+	node_id *map;
 	unsigned short chi_len;
 	unsigned short map_len;
 } repotree;
 
+// The nodes of a block, with every field in an array of its own, so that a pass over the
+// nodes only touches the fields it needs. All the arrays are in one allocation.
+typedef struct {
+	path_id *path;
+	int *revision;
+	unsigned int *deps; // Position of the first dependency in the edge pool
+	unsigned short *dep_len;
+	char *action; // And the flags NODE_FAKE and NODE_COPY
+	unsigned char *wanted; // One bit per node
+} node_block;
+
+// Where a real node was copied from. Only a few nodes are copies, so this isn't a column.
+typedef struct {
+	node_id node;
+	path_id path;
+	int rev;
+} copy_source;
+
+// All nodes live in blocks of NODE_BLOCK_SIZE, so that the id of a node tells where it is.
+// The nodes of a revision have consecutive ids. The dependencies of each node are a
+// contiguous run of node ids in the edge pool, which is likewise split into blocks.
+typedef struct {
+	node_block *blocks;
+	int block_len;
+	copy_source *copies; // In the order of the nodes
+	int copy_len;
+	int copy_max;
+	node_id len; // The next free id
+	node_id **edge_blocks;
+	int edge_block_len;
+	long long edge_len; // The next free position in the edge pool
+} node_pool;
+
+// Every path is stored once, in large chunks that never move, and looked up through a
+// hash table of the ids.
+typedef struct {
+	char **strings; // Indexed by id
+	path_id len;
+	path_id max;
+	path_id *slots; // NO_PATH if empty
+	unsigned int size; // A power of 2, or 0
+	char **chunks;
+	int chunk_len;
+	size_t used; // Of the last chunk
+	size_t chunk_size; // Of the last chunk
+	long long bytes; // Of all chunks
+} path_table;
+
+static node_pool pool;
+static path_table node_paths;
+
+// Incremented whenever a path is added to the repotree, which may move subtrees in memory.
+static int tree_generation = 0;
+
 typedef struct {
 	char **path;
 	int *from;
@@ -88,65 +217,267 @@ typedef struct {
 	int orig_size;
 } mergeinfo;
 
-void exit_with_error(char *message, int exit_code) {
-	fprintf(stderr, "ERROR: %s\n", message);
+typedef struct {
+	FILE *file; // The one of files being read
+	FILE *spill; // Only used when reading from a stream. Receives a copy of everything read.
+	FILE **files; // Several infiles are read one after the other as one dump
+	struct framed_file **framed; // The compressed ones of them, NULL for the others
+	off_t *offsets; // Where each of the files starts in the dump, and where the last one ends
+	off_t *skips; // Size of the dump header each file after the first starts with, which isn't read
+	int file_len;
+	int current; // Index of file in files
+	unsigned char *buffer;
+	off_t start; // File offset of buffer[0]
+	off_t size; // 0 if unknown
+	size_t pos;
+	size_t len;
+} input;
+
+static input *opening = NULL; // Set while an input is being opened
+
+typedef struct {
+	char **include; // Holds the paths the user wants to keep
+	char **exclude; // Holds the paths the user wants to discard
+	char **inc_slash;
+	char **exc_slash;
+	char *redefined_root;
+	int inc_len;
+	int exc_len;
+} filter;
+
+#ifndef _WIN32
+// A thread that helps another one catches its own errors, and keeps the first of them here
+// for the thread that started it. That one reports it once it has joined the thread, as if it
+// had happened there. The other threads of the same work look at code to know when to stop.
+typedef struct {
+	int code; // 0 while there's no error, accessed atomically
+	int taken; // Whether a thread is keeping its error
+	char message[1024];
+} thread_error;
+#endif
+
+// A finished file of an output written in chunks, for the manifest.
+typedef struct {
+	char *name;
+	int first;
+	int last;
+	char sha1[41];
+#ifndef _WIN32
+	pthread_t thread; // Computing the checksum
+	int threaded; // 0 if it was computed right away
+	thread_error err;
+#endif
+} chunk_sum;
+
+// A sanitized dump being written. With --split there are several of these, all sharing
+// the same analyzed repository and the same read of the infile.
+typedef struct sds_output {
+	FILE *file;
+	char *path; // NULL for stdout
+	filter filt;
+	unsigned char *wanted; // Bitset of the (non-fake) nodes to write, in file order.
+	int *numbers; // The new revision numbers. -1 means dropped.
+	char **to_delete;
+	int del_len;
+	int drop_empty;
+	int add_delete;
+	int writing;
+	int toggle;
+	int crosses; // Needs the dependencies, see crosses_boundary
+	// With --split-output-every the output is written as a series of files
+	int chunk_revisions; // Revisions per file, 0 if the files are limited by size
+	off_t chunk_size; // Bytes after which a new file is started, 0 if limited by revisions
+	int chunk; // Number of the file being written
+	int chunk_revs; // Revisions written to it so far
+	int chunk_first;
+	int chunk_last;
+	char *header; // The dump header, which starts every file
+	size_t header_len;
+	FILE *manifest; // NULL unless written in chunks
+	chunk_sum **sums; // The finished files
+	off_t finished_bytes; // Their total size
+	int sum_len;
+	int sum_written; // How many of them are in the manifest
+} output;
+
+// The nodes and mergeinfo of a revision as read from the dump, before they're added to the model.
+typedef struct {
+	parsed_node *nodes;
+	int size;
+	mergeinfo *mi; // Numbered by the revision and the place of the node in it
+	int mi_len;
+	off_t start; // Where in the infile the revision starts
+	off_t position; // Where in the infile the revision ends
+	int plain;
+} parsed_revision;
+
+// The state of reading the metadata of a dump, revision by revision.
+typedef struct {
+	input *infile;
+	char *line;
+	int line_max;
+	int rev; // The number of the revision being read
+	int started; // Whether a revision is being read
+	off_t start; // Where the revision being read starts
+	int plain; // Whether the revision numbers in it are plain, see is_plain_number
+	int is_dir;
+	parsed_node *nodes; // The nodes of the revision being read
+	int size;
+	int max;
+	mergeinfo *mi;
+	int mi_len;
+	int record_sizes;
+	off_t *content_sizes;
+	int node_total;
+	int size_max;
+} reader;
+
+// A dump that has been read and analyzed. It can be filtered any number of times.
+typedef struct sds_model {
+	input *infile;
+	revision *revisions;
+	int rev_len;
+	int rev_max;
+	repotree rt;
+	mergeinfo *mi;
+	int mi_len;
+	off_t *content_sizes; // Content-length of every node in file order, only recorded for --plan
+	int shallow; // Read without the dependencies
+} model;
+
+typedef struct {
+	FILE *out; // Human readable progress
+	FILE *machine; // Machine readable progress (--progress-fd), or NULL
+	char *phase;
+	double start; // When the current phase started
+	double last; // When progress was last printed
+	off_t bytes; // Bytes of the infile consumed so far in the current phase
+	off_t total_bytes; // Size of the infile, 0 if unknown
+	output *outs; // The outputs written in the current phase, or NULL
+	int out_len;
+	off_t written_start; // What had been written to them when the phase started
+	off_t written; // Bytes written to them so far in the current phase
+	int done; // Revisions done in the current phase
+	int total; // Revisions in the current phase, 0 if unknown
+	int phase_len;
+	char *phases[MAX_PHASES];
+	double seconds[MAX_PHASES];
+	off_t written_bytes[MAX_PHASES];
+} progress;
+
+// Counters for --stats. Incrementing them is cheap enough to always be done. Everything
+// that requires walking the data structures is only computed when the stats are written.
+typedef struct {
+	long long deps[DEP_KINDS];
+	long long fakes_copy;
+	long long fakes_delete;
+	long long get_subtree_calls;
+	long long reduce_path_calls;
+	long long relevant_nodes_calls;
+	long long relevant_nodes_max; // Largest list returned by get_relevant_nodes_at_revision
+	long long mergeinfo_rows;
+	long long merge_path_hits; // Lookups answered by the merge path index
+	long long merge_path_missing; // ... with a path known to be missing
+	long long merge_path_walks; // Lookups that had to walk the repotree
+} statistics;
+
+static statistics stats;
+
+// With --memory-limit, once the budget is exceeded, the node and edge blocks are allocated
+// from (and moved to) chunks of a memory mapped temporary file instead of the heap. The
+// kernel can then write them out to disk under memory pressure rather than the process
+// being killed. Blocks are filled in revision order, so the passes over the revisions
+// mostly read the file sequentially. Nothing in the arena is freed individually; the
+// whole file goes away when it is closed.
+typedef struct {
+	long long limit; // 0 = no limit
+	long long bytes; // Heap bytes in the node pool, used if the RSS can't be determined
+	int spilling;
+	FILE *file;
+	off_t file_size;
+	unsigned char **chunks;
+	size_t *chunk_sizes;
+	int chunk_len;
+	size_t used; // Bytes used in the last chunk
+} budget;
+
+static budget mem;
+
+// With --checkpoint the result of the analysis is saved to a file. During the write pass the
+// position reached is appended to it every CHECKPOINT_INTERVAL seconds, at the start of a
+// revision, once everything before it is safely on disk. --resume loads the analysis and
+// the last position, cuts the outfiles back to it and continues writing from there.
+typedef struct {
+	FILE *file; // NULL if not used
+	char *path;
+	double last; // When the last position was saved
+	off_t input; // Offset of the Revision-number line to continue from
+	off_t node_index;
+	off_t *offsets; // Size of each outfile at the position
+	int rev;
+	int act_mi;
+} checkpoint;
+
+// There are no threads on Windows, so nothing there needs to be kept per thread.
+#ifdef _WIN32
+#define THREAD_LOCAL
+#else
+#define THREAD_LOCAL __thread
+#endif
+
+// Set while a library function runs, and in the threads it starts. Errors then return to it
+// instead of exiting. Each thread has its own, so an error returns to where it happened.
+static THREAD_LOCAL jmp_buf *error_jump = NULL;
+static THREAD_LOCAL char error_message[1024];
+
+// Passes on an error that has been caught on the way, with the message it already has.
+static void rethrow_error(int exit_code) {
+	if (error_jump) {
+		longjmp(*error_jump, exit_code);
+	}
+	fprintf(stderr, "ERROR: %s\n", error_message);
 	exit(exit_code);
 }
 
-void show_help_and_exit() {
-	printf("svndumpsanitizer usage:\n\n");
-	printf("svndumpsanitizer [-i, --infile INFILE] [-o, --outfile OUTFILE] [OPTIONS]\n\n");
-	printf("INFILE is mandatory; OUTFILE is optional. If omitted the output will be printed to\n");
-	printf("stdout. Reading from stdin is not supported because svndumpsanitizer needs the data\n");
-	printf("twice. (Once for analyzing, once for copying the selected parts.)\n\n");
-	printf("OPTIONS\n");
-	printf("\t-n, --include [PATHS]\n");
-	printf("\t\tList of repository paths to include.\n\n");
-	printf("\t-e, --exclude [PATHS]\n");
-	printf("\t\tList of repository paths to exclude.\n\n");
-	printf("\t\tYou must specify at least one path to include OR at least one path to exclude\n");
-	printf("\t\tYou may not specify includes and excludes at the same time.\n\n");
-	printf("\t\tPATHS are space separated paths as they appear in the svn repository\n");
-	printf("\t\twithout leading or trailing slashes. E.g. \"-n trunk/foo/bar branches/baz\".\n\n");
-	printf("\t\tThe only exception to this are directories in the repository root that start with a\n");
-	printf("\t\thyphen. In order to not have this hyphen misinterpreted as a command, it must be\n");
-	printf("\t\tescaped using a slash. E.g. \"-n /--foobar branches/baz\". Please notice that only\n");
-	printf("\t\ta leading hyphen should be escaped, and only for the repository root.\n\n");
-	printf("\t-d, --drop-empty\n");
-	printf("\t\tAny revision that after sanitizing, contains no actions will be dropped altogether.\n");
-	printf("\t\tThe remaining revisions will be renumbered. You will lose the commit messages for\n");
-	printf("\t\tthe dropped revisions.\n\n");
-	printf("\t-a, --add-delete\n");
-	printf("\t\tAutomatically add a deleting revision to the end of the file that removes stuff that\n");
-	printf("\t\tsvndumpsanitizer has been forced to keep due to dependencies, but actually resides in\n");
-	printf("\t\tdirectories the user has specified he doesn't want. If no such files exist, no revision\n");
-	printf("\t\twill be added. This was the default behavior prior to version 2.\n\n");
-	printf("\t-r, --redefine-root [PATH]\n");
-	printf("\t\tRedefines the repository root. This option can only be used with the include option.\n");
-	printf("\t\tThe path provided to this option must be the beginning of (or the whole) path\n");
-	printf("\t\tprovided to the include option. If more than one path is provided you can provide\n");
-	printf("\t\ta path only up to the point where the paths diverge. The operation is not guaranteed\n");
-	printf("\t\tto succeed on every repository. If the repository layout prevents redefining, a warning\n");
-	printf("\t\twill be displayed, and the sanitizing will be performed without changing any paths.\n\n");
-	printf("\t\tE.g.\n\t\t\"-n foo/bar/trunk -r foo/bar\" - OK. (This is probably the typical case.)\n");
-	printf("\t\t\"-n foo/bar/trunk -r foo/bar/trunk\" - OK.\n");
-	printf("\t\t\"-n foo/bar/trunk foo/baz/trunk -r foo\" - OK.\n");
-	printf("\t\t\"-n foo/bar/trunk foo/baz/trunk -r foo/bar\" - WRONG.\n\n");
-	printf("\t-q, --query\n");
-	printf("\t\tOption used mostly for debugging purposes. If passed, svndumpsanitizer will after\n");
-	printf("\t\treading and analyzing (but before writing) enter an interactive state where the user\n");
-	printf("\t\tcan query the rationale why specific files are being included with the given options.\n");
-	printf("\t\tThis query will locate the *first* dependency it can find that will include the file,\n");
-	printf("\t\tnot all the dependencies, which might be numerous. When done, one can opt to either\n");
-	printf("\t\tquit or proceed with writing the outfile.\n\n");
-	printf("\t-v, --version\n");
-	printf("\t\tPrint version and exit.\n");
-	exit(0);
+static void exit_with_error(char *message, int exit_code) {
+	snprintf(error_message, sizeof(error_message), "%s", message);
+	rethrow_error(exit_code);
 }
 
-void show_version_and_exit() {
-	printf("svndumpsanitizer %s\n", SDS_VERSION);
-	exit(0);
+#ifndef _WIN32
+// Errors of threads, see thread_error.
+static void init_thread_error(thread_error *e) {
+	e->code = 0;
+	e->taken = 0;
+	e->message[0] = '\0';
+}
+
+// Keeps the error that the current thread just caught, unless another thread was first.
+static void keep_thread_error(thread_error *e, int code) {
+	int none = 0;
+	if (__atomic_compare_exchange_n(&e->taken, &none, 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+		snprintf(e->message, sizeof(e->message), "%s", error_message);
+		__atomic_store_n(&e->code, code, __ATOMIC_SEQ_CST);
+	}
+}
+
+static int has_thread_error(thread_error *e) {
+	return __atomic_load_n(&e->code, __ATOMIC_SEQ_CST) != 0;
+}
+
+// Reports the error that a thread kept, if any. The threads have to be joined first.
+static void rethrow_thread_error(thread_error *e) {
+	if (e->code) {
+		exit_with_error(e->message, e->code);
+	}
+}
+#endif
+
+// Exits with an error about a file, without touching the path, which may not be ours.
+static void exit_with_file_error(const char *path, char *problem, int exit_code) {
+	char message[1024];
+	snprintf(message, sizeof(message), "%s%s", path, problem);
+	exit_with_error(message, exit_code);
 }
 
 /*******************************************************************************
@@ -155,12 +486,7 @@ void show_version_and_exit() {
  *
  ******************************************************************************/
 
-void print_progress(FILE *out, char *message, int progress) {
-	fprintf(out, "%s %d\r", message, progress);
-	fflush(out);
-}
-
-char* str_malloc(size_t sz) {
+static char* str_malloc(size_t sz) {
 	char* str;
 	if ((str = (char*)malloc(sz)) == NULL) {
 		exit_with_error("malloc failed", 2);
@@ -168,7 +494,7 @@ char* str_malloc(size_t sz) {
 	return str;
 }
 
-char* add_slash_to(char *str) {
+static char* add_slash_to(char *str) {
 	char* new_str = str_malloc(strlen(str) + 2);
 	strcpy(new_str, str);
 	strcat(new_str, "/");
@@ -176,7 +502,7 @@ char* add_slash_to(char *str) {
 }
 
 // Returns 1 if string a starts with string b, otherwise 0
-int starts_with(char *a, char *b) {
+static int starts_with(char *a, char *b) {
 	int i = 0;
 	while (b[i] != '\0') {
 		if (a[i] != b[i]) {
@@ -187,9 +513,26 @@ int starts_with(char *a, char *b) {
 	return 1;
 }
 
+// Returns 1 if str is n written the way "%d" writes it, otherwise 0.
+static int is_plain_number(char *str, int n) {
+	char plain[16];
+	sprintf(plain, "%d", n);
+	return strcmp(str, plain) == 0;
+}
+
+// FNV-1a of the first len chars of path.
+static unsigned int hash_path(const char *path, size_t len) {
+	unsigned int hash = FNV_OFFSET;
+	size_t i;
+	for (i = 0; i < len; ++i) {
+		hash = (hash ^ (unsigned char)path[i]) * FNV_PRIME;
+	}
+	return hash;
+}
+
 // Tries to match the beginning of a path to a name. Returns 1 if successful, otherwise 0.
 // E.g. foo/bar/baz will match foo, or foo/bar but not foobar. 
-int matches_path_start(char *path, char *name) {
+static int matches_path_start(char *path, char *name) {
 	int i = 0;
 	while (name[i] != '\0') {
 		if (path[i] != name[i]) {
@@ -205,19 +548,19 @@ int matches_path_start(char *path, char *name) {
 
 // Reduces path as far as the redefined root allows. E.g. if foo/trunk is the redefined root
 // foo/bar/baz.txt will be reduced to bar/baz.txt and foo/trunk/quux.txt will become quux.txt
-char* reduce_path(char* redefined_root, char* path) {
-	char* str;
+// The reduced path is always the end of path, so instead of a copy, a pointer into path is
+// returned. It stays valid as long as path does.
+static char* reduce_path(char* redefined_root, char* path) {
 	int i = 0;
 	int mark = -1;
-	str = str_malloc(strlen(path) + 1);
+	++stats.reduce_path_calls;
 	while (redefined_root[i] != '\0') {
 		if (path[i] != redefined_root[i]) {
-			strcpy(str, &path[mark + 1]);
 			// We've found a part of the redifined root, e.g. "trunk" when redefined_root is "trunk/foo"
-			if (matches_path_start(redefined_root, str)) {
-				str[0] = '\0';
+			if (matches_path_start(redefined_root, &path[mark + 1])) {
+				return &path[strlen(path)];
 			}
-			return str;
+			return &path[mark + 1];
 		}
 		if (path[i] == '/') {
 			mark = i;
@@ -228,69 +571,63 @@ char* reduce_path(char* redefined_root, char* path) {
 	// matches the beginning of the path. E.g. redefined_root == foo/bar path == foo/bar/baz. i == 7 and
 	// therefore points at the second slash. We return everything following that slash, but not the slash.
 	if (path[i] == '/') {
-		strcpy(str, &path[i + 1]);
-		return str;
+		return &path[i + 1];
 	}
 	// This means that redefined_root == path. We return an empty string.
 	else if (path[i] == '\0') {
-		str[0] = '\0';
-		return str;
+		return &path[i];
 	}
 	// This means we've found a fake match. E.g. redefined_root == trunk/foo, path == trunk/foobar
-	strcpy(str, &path[mark + 1]);
-	return str;
+	return &path[mark + 1];
 }
 
 // Returns the new file path after a copyfrom. E.g. New dir = branches/foo, old file is
 // trunk/project/bar.txt branches/foo is copied from trunk. The method should return the
 // location of the file after the copyfrom, i.e. branches/foo/project/bar.txt
-char* get_dir_after_copyfrom(char *new, char *old, char *copyfrom) {
+// The path is built in *buf, which is grown as needed, so that a copy affecting a large
+// subtree doesn't allocate a path for every file in it.
+static char* get_dir_after_copyfrom(char *new, char *old, char *copyfrom, char **buf, size_t *max) {
 	char* temp_str = reduce_path(copyfrom, old);
-	char* path = str_malloc(strlen(new) + strlen(temp_str) + 2);
-	strcpy(path, new);
-	strcat(path, "/");
-	strcat(path, temp_str);
-	free(temp_str);
-	return path;
-}
-
-void init_new_node(node *n) {
-	n[0].deps = NULL;
-	n[0].path = NULL;
-	n[0].copyfrom = NULL;
-	n[0].copyfrom_rev = 0;
-	n[0].revision = 0;
-	n[0].action = 0;
-	n[0].wanted = 0;
-	n[0].dep_len = 0;
+	size_t len = strlen(new);
+	size_t size = len + strlen(temp_str) + 2;
+	if (size > *max) {
+		*max = 2 * size;
+		if ((*buf = (char*)realloc(*buf, *max)) == NULL) {
+			exit_with_error("realloc failed", 2);
+		}
+	}
+	memcpy(*buf, new, len);
+	(*buf)[len] = '/';
+	strcpy(&(*buf)[len + 1], temp_str);
+	return *buf;
 }
 
-node* get_new_node() {
-	node *n;
-	if ((n = (node*)malloc(sizeof(node))) == NULL) {
-		exit_with_error("malloc failed", 2);
-	}
-	init_new_node(n);
-	return n;
+// Returns 1 if path is what get_dir_after_copyfrom would return, without building it.
+static int is_dir_after_copyfrom(char *path, char *new, char *old, char *copyfrom) {
+	size_t len = strlen(new);
+	return strncmp(path, new, len) == 0 && path[len] == '/' && strcmp(&path[len + 1], reduce_path(copyfrom, old)) == 0;
 }
 
-// Cleans up memory reserved by tree (except root node's children)
-void free_tree(repotree *rt) {
+// Cleans up memory reserved by tree (except root node's children). The children may be
+// missing if growing them failed.
+static void free_tree(repotree *rt) {
 	int i;
+	if (rt->children == NULL) {
+		return;
+	}
 	for (i = 0; i < rt->chi_len; ++i) {
 		if (rt->children[i].chi_len > 0) {
 			free_tree(&rt->children[i]);
 		}
 	}
 	for (i = 0; i < rt->chi_len; ++i) {
-		free(rt->children[i].path);
 		free(rt->children[i].map);
 		free(rt->children[i].children);
 	}
 }
 
 // Returns the number of digits in an int
-int num_len(int num) {
+static int num_len(int num) {
 	int i = 0;
 	do {
 		num /= 10;
@@ -302,503 +639,2319 @@ int num_len(int num) {
 // Returns the new revision number of a renumbered revision, OR the number of the first
 // previous still included revision, should the revision in question have been dropped.
 // Returns -1 if no such revision exists.
-int get_new_revision_number(revision *revisions, int num) {
+static int get_new_revision_number(int *numbers, int num) {
 	int i = num;
 	while (i > 0) {
-		if (revisions[i].number > 0) {
-			return revisions[i].number;
+		if (numbers[i] > 0) {
+			return numbers[i];
 		}
 		--i;
 	}
 	return -1;
 }
 
-// Returns 1 if the node is a fake, otherwise 0.
-int is_node_fake(node *n, revision *revisions) {
-	int i;
-	for (i = 0; i < revisions[n->revision].fake_size; ++i) {
-		if (revisions[n->revision].fakes[i] == n) {
-			return 1;
-		}
+
+static int max_threads = 0; // 0 = one per processor
+
+// The number of threads to use for the work that can be done in parallel.
+static int get_threads(void) {
+	int threads = max_threads;
+#ifdef _WIN32
+	threads = 1;
+#else
+	if (threads <= 0) {
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
 	}
-	return 0;
+#endif
+	return threads < 1 ? 1 : threads > MAX_THREADS ? MAX_THREADS : threads;
 }
 
 /*******************************************************************************
  *
- * Include/exclude-related functions
+ * Progress reporting
  *
  ******************************************************************************/
 
-// Is path [in/ex]cluded? paths_slash contain a copy of the paths with slashes
-// appended to them. Yes, it could be done here, but this function is typically called
-// from within nested for loops, and not building the path + slash over and over again
-// will be much cheaper computationally.
-int is_cluded(char *path, char **paths, char **paths_slash, int len) {
-	int i;
-	for (i = 0; i < len; ++i) {
-		if (strcmp(path, paths[i]) == 0 || starts_with(path, paths_slash[i])) {
-			return 1;
-		}
-	}
-	return 0;
+// Returns a monotonic time in seconds.
+static double get_time() {
+#ifdef _WIN32
+	return (double)clock() / CLOCKS_PER_SEC;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+#endif
 }
 
-void print_why(node **nptr, char **inc, char **i_slash, char **exc, char **e_slash, char *why, int n_len, int i_len, int e_len) {
-	int i, j;
-	if (n_len < 0) {
-		printf("Path %s does not seem to be included.\n", why);
+// Gets the current resident set size and the largest one seen during the run in bytes, 0 if
+// unknown. On Linux both come from the same read of /proc/self/status, so the peak is never
+// below the current size, as it can be with getrusage.
+static void get_memory_use(long long *rss, long long *peak) {
+#ifdef __linux__
+	char line[128];
+	FILE *f = fopen("/proc/self/status", "r");
+	*rss = 0;
+	*peak = 0;
+	if (f == NULL) {
 		return;
 	}
-	for (i = n_len; i >= 0; --i) {
-		printf("Revision %d: Path: %s  ", nptr[i]->revision, nptr[i]->path);
-		for (j = 0; j < nptr[i]->dep_len; ++j) {
-			if (nptr[i]->revision == nptr[i]->deps[j]->revision && nptr[i]->deps[j]->copyfrom) {
-				printf(" (created by \"%s\" copyfrom \"%s\")", nptr[i]->deps[j]->path, nptr[i]->deps[j]->copyfrom);
-				break;
-			}
-		}
-		if (inc) {
-			if (is_cluded(nptr[i]->path, inc, i_slash, i_len)) {
-				printf(" PULLED BY INCLUDE");
-			}
+	while (fgets(line, sizeof(line), f) != NULL) {
+		if (starts_with(line, "VmRSS:")) {
+			*rss = atoll(&line[6]) * 1024;
 		}
-		else if (!is_cluded(nptr[i]->path, exc, e_slash, e_len)) {
-			printf(" NOT EXCLUDED");
+		else if (starts_with(line, "VmHWM:")) {
+			*peak = atoll(&line[6]) * 1024;
 		}
-		if (i > 0) {
-			printf(" depends on:");
+	}
+	fclose(f);
+#elif defined(_WIN32)
+	*rss = 0;
+	*peak = 0;
+#else
+	struct rusage usage;
+	*rss = 0;
+	*peak = 0;
+	if (getrusage(RUSAGE_SELF, &usage) == 0) {
+#ifdef __APPLE__
+		*peak = usage.ru_maxrss;
+#else
+		*peak = (long long)usage.ru_maxrss * 1024;
+#endif
+	}
+#endif
+}
+
+// Returns the current resident set size in bytes, or 0 if it can't be determined.
+static long long get_rss() {
+	long long rss, peak;
+	get_memory_use(&rss, &peak);
+	return rss;
+}
+
+// Returns the largest resident set size seen during the run in bytes, or 0 if unknown.
+static long long get_peak_rss() {
+	long long rss, peak;
+	get_memory_use(&rss, &peak);
+	return peak;
+}
+
+// Returns the number of bytes written to the outputs so far, including the finished files
+// of a series. Outputs that can't tell, like a pipe, count as nothing.
+static off_t get_output_bytes(output *outs, int out_len) {
+	int o;
+	off_t pos;
+	off_t bytes = 0;
+	for (o = 0; o < out_len; ++o) {
+		bytes += outs[o].finished_bytes;
+		if (outs[o].file && (pos = ftello(outs[o].file)) > 0) {
+			bytes += pos;
 		}
-		printf("\n");
 	}
+	return bytes;
 }
 
-// Dumb exclude that just marks excludes as unwanted. We'll have to come back
-// later to check which ones are still needed due to dependencies
-void parse_exclude_preparation(revision *r, char **excludes, char **ex_slash, int rev_len, int ex_len) {
-	int i, j;
-	for (i = 0; i < rev_len; ++i) {
-		for (j = 0; j < r[i].size; ++j) {
-			if (is_cluded(r[i].nodes[j].path, excludes, ex_slash, ex_len)) {
-				r[i].nodes[j].wanted = 0;
-			}
+// Prints the phase name in lower case with underscores, e.g. "Restoring deletes" -> "restoring_deletes".
+static void print_phase_id(FILE *out, char *phase) {
+	int i;
+	for (i = 0; phase[i] != '\0'; ++i) {
+		if (phase[i] == ' ') {
+			fputc('_', out);
 		}
-		for (j = 0; j < r[i].fake_size; ++j) {
-			if (is_cluded(r[i].fakes[j]->path, excludes, ex_slash, ex_len)) {
-				r[i].fakes[j]->wanted = 0;
-			}
+		else if (phase[i] >= 'A' && phase[i] <= 'Z') {
+			fputc(phase[i] + 32, out);
+		}
+		else {
+			fputc(phase[i], out);
 		}
 	}
 }
 
-// Sets the node and all its dependencies to "wanted"
-void set_wanted(node *n) {
-	int i;
-	// Been here, done that...
-	if (n->wanted == 1) {
+static void init_progress(progress *p, FILE *out, FILE *machine, off_t total_bytes) {
+	p->out = out;
+	p->machine = machine;
+	p->phase = NULL;
+	p->total_bytes = total_bytes;
+	p->bytes = 0;
+	p->outs = NULL;
+	p->written = 0;
+	p->phase_len = 0;
+}
+
+// Prints the progress of the current phase. Bytes are only shown for phases that read the infile.
+// Nothing is printed if out is NULL.
+static void print_progress(progress *p, double now) {
+	double elapsed = now - p->start;
+	double fraction = -1;
+	double eta;
+	long long rss;
+	off_t bytes = p->bytes;
+	p->last = now;
+	if (p->out == NULL) {
 		return;
 	}
-	n->wanted = 1;
-	for (i = 0; i < n->dep_len; ++i) {
-		set_wanted(n->deps[i]);
+	rss = get_rss();
+	if (p->outs) {
+		p->written = get_output_bytes(p->outs, p->out_len) - p->written_start;
+	}
+	if (p->total > 0) {
+		fraction = (double)p->done / p->total;
+	}
+	else if (p->total_bytes > 0 && bytes > 0) {
+		fraction = (double)p->bytes / p->total_bytes;
+	}
+	fprintf(p->out, "%s revision %d", p->phase, p->done);
+	if (p->total > 0) {
+		fprintf(p->out, " of %d", p->total);
+	}
+	fprintf(p->out, " (");
+	if (fraction >= 0) {
+		fprintf(p->out, "%d%%, ", (int)(fraction * 100));
+	}
+	if (bytes > 0 && elapsed > 0) {
+		fprintf(p->out, "%.1f MB/s, ", bytes / elapsed / 1048576);
+	}
+	if (elapsed > 0) {
+		fprintf(p->out, "%.0f rev/s, ", p->done / elapsed);
+	}
+	if (fraction > 0 && fraction < 1) {
+		eta = elapsed / fraction - elapsed;
+		fprintf(p->out, "ETA %d:%.2d:%.2d, ", (int)eta / 3600, ((int)eta / 60) % 60, (int)eta % 60);
+	}
+	fprintf(p->out, "RSS %lld MB)   \r", rss / 1048576);
+	fflush(p->out);
+	if (p->machine) {
+		fprintf(p->machine, "progress phase=");
+		print_phase_id(p->machine, p->phase);
+		fprintf(p->machine, " revision=%d revisions=%d bytes=%lld total_bytes=%lld written=%lld elapsed=%.3f rss=%lld\n",
+				p->done, p->total, (long long)bytes, (long long)p->total_bytes, (long long)p->written, elapsed, rss);
+		fflush(p->machine);
 	}
 }
 
-// Returns the node that is relevant to the revision in question, or NULL if no such node exists.
-node* get_node_at_revision(node **map, int rev, int map_len) {
-	int i;
-	for (i = map_len - 1; i >=0; --i) {
-		if (map[i]->revision <= rev) {
-			return map[i];
-		}
+// Starts timing a phase. total is the number of revisions it will go through, 0 if unknown.
+static void start_phase(progress *p, char *phase, int total) {
+	p->phase = phase;
+	p->total = total;
+	p->done = 0;
+	p->bytes = 0;
+	p->outs = NULL;
+	p->written = 0;
+	p->start = get_time();
+	p->last = p->start;
+}
+
+// Counts what is written to the outputs during the current phase from now on.
+static void count_written(progress *p, output *outs, int out_len) {
+	p->outs = outs;
+	p->out_len = out_len;
+	p->written_start = get_output_bytes(outs, out_len);
+}
+
+// Called once per revision. Printing is rate limited, so this is cheap.
+static void update_progress(progress *p, int done, off_t bytes) {
+	double now;
+	p->done = done;
+	if (bytes >= 0) {
+		p->bytes = bytes;
+	}
+	now = get_time();
+	if (now - p->last >= PROGRESS_INTERVAL) {
+		print_progress(p, now);
 	}
-	return NULL;
 }
 
-// Returns the ADD node that is relevant to the revision in question, or NULL if no such node exists.
-node* get_add_node_at_revision(node **map, int rev, int map_len) {
+static void end_phase(progress *p) {
 	int i;
-	for (i = map_len - 1; i >=0; --i) {
-		if (map[i]->revision <= rev) {
-			if (map[i]->action == ADD) {
-				return map[i];
-			}
-			if (map[i]->action == DELETE) {
-				return NULL;
-			}
+	double now = get_time();
+	print_progress(p, now);
+	if (p->out) {
+		fprintf(p->out, "\n");
+	}
+	// Phases run several times (e.g. once per output when splitting) are added up.
+	for (i = 0; i < p->phase_len; ++i) {
+		if (strcmp(p->phases[i], p->phase) == 0) {
+			break;
 		}
 	}
-	return NULL;
+	if (i == p->phase_len && i < MAX_PHASES) {
+		p->phases[i] = p->phase;
+		p->seconds[i] = 0;
+		p->written_bytes[i] = 0;
+		++p->phase_len;
+	}
+	if (i < MAX_PHASES) {
+		p->seconds[i] += now - p->start;
+		p->written_bytes[i] += p->written;
+	}
 }
 
-// Returns the node that is actually present at a certain revision when wanted status is considered.
-node* get_wanted_node_at_revision(node **map, int rev, int map_len) {
+static void print_phase_summary(progress *p) {
 	int i;
-	for (i = map_len - 1; i >=0; --i) {
-		if (map[i]->revision <= rev && map[i]->wanted) {
-			if (map[i]->action == DELETE) {
-				return NULL;
-			}
-			return map[i];
+	double total = 0;
+	off_t written = 0;
+	long long rss, peak;
+	fprintf(p->out, "\nPhase timing:\n");
+	for (i = 0; i < p->phase_len; ++i) {
+		fprintf(p->out, "  %-22s %10.2f s\n", p->phases[i], p->seconds[i]);
+		if (p->machine) {
+			fprintf(p->machine, "summary phase=");
+			print_phase_id(p->machine, p->phases[i]);
+			fprintf(p->machine, " seconds=%.3f written=%lld\n", p->seconds[i], (long long)p->written_bytes[i]);
 		}
+		total += p->seconds[i];
+		written += p->written_bytes[i];
 	}
-	return NULL;
-}
-
-node* get_node_at(node **map, int rev, int map_len, int wanted_only) {
-	if (wanted_only) {
-		return get_wanted_node_at_revision(map, rev, map_len);
+	fprintf(p->out, "  %-22s %10.2f s\n", "Total", total);
+	if (p->machine) {
+		get_memory_use(&rss, &peak);
+		fprintf(p->machine, "summary phase=total seconds=%.3f written=%lld rss=%lld peak_rss=%lld\n", total, (long long)written, rss, peak);
+		fflush(p->machine);
 	}
-	return get_node_at_revision(map, rev, map_len);
 }
 
 /*******************************************************************************
  *
- * Repotree/dependency-related functions
+ * Input-related functions
  *
  ******************************************************************************/
 
-// Returns subtree where the root node matches the provided path.
-repotree* get_subtree(repotree *rt, char *path, int fail_if_not_found) {
-	int i = 0;
-	while (i < rt->chi_len) {
-		if (matches_path_start(path, rt->children[i].path)) {
-			if (strcmp(path, rt->children[i].path) == 0) {
-				return &rt->children[i];
-			}
-			rt = &rt->children[i];
-			i = -1;
-		}
-		++i;
+// Creates an anonymous temporary file in TMPDIR. The file is unlinked right away, so
+// it will disappear once closed, or should we exit prematurely.
+static FILE* open_spill_file() {
+#ifdef _WIN32
+	return tmpfile();
+#else
+	FILE *f;
+	int fd;
+	char *dir = getenv("TMPDIR");
+	char *name;
+	if (dir == NULL || strlen(dir) == 0) {
+		dir = "/tmp";
 	}
-	// If it's the root dir, return entire tree.
-	if (strlen(path) == 0) {
-		return rt;
+	name = str_malloc(strlen(dir) + 30);
+	strcpy(name, dir);
+	strcat(name, "/svndumpsanitizer-XXXXXX");
+	if ((fd = mkstemp(name)) < 0) {
+		free(name);
+		return NULL;
 	}
-	if (fail_if_not_found) {
-		fprintf(stderr, "Could not find requested subtree: %s\n", path);
-		exit_with_error("Internal logic error.", 3);
+	unlink(name);
+	free(name);
+	if ((f = fdopen(fd, "w+b")) == NULL) {
+		close(fd);
 	}
-	return NULL;
+	return f;
+#endif
 }
 
-// This function tries to detect any colliding add or delete nodes when using redefine root.
-// These situations can arise when something is copied from outside the included scope to a position
-// where the redefine root operation will cause it to fall back to the original position, e.g.
-// 1) Create foo/bar/baz.txt
-// 2) Create trunk/project/foo/quux.txt
-// 3) Copy bar (from foo/bar) to trunk/project/foo
-// svndumpsanitizer ... -n trunk/project -r trunk/project => won't import due to double add of dir "foo"
-int has_redefine_collisions(repotree *root, repotree *current, char *redefined_root) {
-	int i, wanted;
-	char *temp;
-	node *n;
-	repotree *subtree = NULL;
-	if (current->path) {
-		temp = reduce_path(redefined_root, current->path);
-		if (strlen(temp) > 0 && strcmp(current->path, temp) != 0) {
-			subtree = get_subtree(root, temp, 0);
-		}
-		free(temp);
-		if (subtree) {
-			wanted = 0; // We don't care about "collisions" that are unwanted, and won't be in the final repo.
-			for (i = subtree->map_len - 1; i >= 0; --i) {
-				if (subtree->map[i]->wanted) {
-					wanted = 1;
-				}
-				// If the potential collision was deleted prior to the existence of the redefined path, it's not really a collision.
-				if (subtree->map[i]->revision < current->map[0]->revision && subtree->map[i]->action == DELETE && subtree->map[i]->wanted) {
-					break;
-				}
-				// Houston, we have a problem...
-				if (wanted && (subtree->map[i]->action == DELETE || subtree->map[i]->action == ADD)) {
-					return 1;
-				}
-			}
-		}
-	}
-	for (i = 0; i < current->chi_len; ++i) {
-		if (has_redefine_collisions(root, &current->children[i], redefined_root)) {
-			return 1;
+// An infile compressed in independent frames: bgzf, the blocked gzip written by bgzip, or
+// zstd in the seekable format. Any frame can be decompressed on its own, so a seek only has
+// to find its frame in the index, and decompress from there. The frames are decompressed
+// a batch at a time, which is spread over the threads.
+typedef struct framed_file {
+	FILE *file;
+	int kind;
+	off_t *comp; // Where each frame starts in the file, and where the last one ends
+	off_t *plain; // Where each frame starts decompressed, and where the last one ends
+	int len;
+	int max;
+	unsigned char *packed; // The compressed batch
+	size_t packed_max;
+	unsigned char *data; // The decompressed batch
+	size_t data_max;
+	int first; // The frames in the batch
+	int last;
+	off_t pos; // The next byte to be read, decompressed
+} framed_file;
+
+// A share of a batch, for one thread.
+typedef struct {
+	framed_file *ff;
+	int first;
+	int last;
+	int failed;
+} frame_job;
+
+static unsigned int read_le32(unsigned char *b) {
+	return b[0] | b[1] << 8 | b[2] << 16 | (unsigned int)b[3] << 24;
+}
+
+static unsigned long long read_le64(unsigned char *b) {
+	return read_le32(b) | (unsigned long long)read_le32(&b[4]) << 32;
+}
+
+// Reads count bytes at offset of the file. Returns 0 if they're not all there.
+static int read_at(FILE *f, off_t offset, unsigned char *buffer, size_t count) {
+	return fseeko(f, offset, SEEK_SET) == 0 && fread(buffer, 1, count, f) == count;
+}
+
+static void add_frame(framed_file *ff, off_t comp, off_t plain) {
+	if (ff->len + 2 > ff->max) {
+		ff->max = ff->max ? 2 * ff->max : 1024;
+		if ((ff->comp = (off_t*)realloc(ff->comp, ff->max * sizeof(off_t))) == NULL || (ff->plain = (off_t*)realloc(ff->plain, ff->max * sizeof(off_t))) == NULL) {
+			exit_with_error("realloc failed", 2);
 		}
 	}
-	return 0;
+	ff->comp[ff->len] = comp;
+	ff->plain[ff->len] = plain;
+	++ff->len;
 }
 
-// Returns 1 if file (or dir) is still present after applying sanitazion rules, otherwise 0.
-// no_search -> correct pointer is already given, skip searching for it.
-int is_file_present(repotree *rt, revision *revisions, node *n, int no_search) {
-	repotree *target = get_subtree(rt, n->path, 1);
-	int i = target->map_len - 1;
-	int j;
-	char *temp;
-	// Find the right pointer...
-	while (i >= 0 && target->map[i] != n) {
-		--i;
+// Returns what the file is compressed with, or 0 if it isn't.
+static int get_frame_kind(FILE *f, char *path) {
+	unsigned char head[18];
+	size_t len = fread(head, 1, sizeof(head), f);
+	rewind(f);
+	if (len >= 4 && read_le32(head) == ZSTD_MAGIC) {
+		return FRAMES_ZSTD;
 	}
-	if (!no_search) {
-		--i; // And back up to the previous one...
+	if (len < 2 || head[0] != 0x1f || head[1] != 0x8b) {
+		return 0;
 	}
-	while (i >= 0 && target->map[i]->action != DELETE) {
-		if (target->map[i]->wanted) {
-			return 1;
-		}
-		// If it's a fake add node we need to dig deeper...
-		if (target->map[i]->action == ADD && is_node_fake(target->map[i], revisions)) {
-			// Is the dependency responsible for the fake wanted?
-			if (target->map[i]->dep_len > 0 && target->map[i]->deps[0]->wanted && target->map[i]->deps[0]->copyfrom) {
-				temp = add_slash_to(target->map[i]->deps[0]->path);
-				if (starts_with(n->path, temp)) {
-					free(temp);
-					// Get the origin of the fake node. E.g. If the file trunk/project2/foo.txt has come to be
-					// by copying trunk/project1 to trunk/project2, the origin would be trunk/project1/foo.txt.
-					temp = get_dir_after_copyfrom(target->map[i]->deps[0]->copyfrom, n->path, target->map[i]->deps[0]->path);
-					// Find the correct dependency
-					for (j = 1; j < target->map[i]->dep_len; ++j) {
-						if (strcmp(target->map[i]->deps[j]->path, temp) == 0) {
-							// If it's wanted, we're done
-							if (target->map[i]->deps[j]->wanted) {
-								free(temp);
-								return 1;
-							}
-							// If it's another fake add node, we need another go.
-							else if (target->map[i]->deps[j]->action == ADD && is_node_fake(target->map[i]->deps[j], revisions)) {
-								free(temp);
-								return is_file_present(rt, revisions, target->map[i]->deps[j], 1);
-							}
-						}
-					}
-				}
-				free(temp);
-			}
-		}
-		--i;
+	// The first extra subfield of a bgzf block is BC, with the size of the block.
+	if (len == sizeof(head) && head[2] == 8 && (head[3] & 4) && head[12] == 'B' && head[13] == 'C') {
+		return FRAMES_BGZF;
 	}
+	exit_with_file_error(path, " is gzip compressed, but not with bgzip, so it can't be seeked in", 3);
 	return 0;
 }
 
-void restore_delete_node_if_needed(repotree *rt, revision *revisions, node *n) {
-	if (is_file_present(rt, revisions, n, 0)) {
-		n->wanted = 2;
+// Finds the bgzf blocks from offset on. Each block tells its own size in its header, and
+// its decompressed size at its end, so only those are read.
+static void index_bgzf(framed_file *ff, off_t comp, off_t plain, off_t file_size) {
+	unsigned char b[18];
+	off_t size;
+	while (comp < file_size) {
+		if (!read_at(ff->file, comp, b, sizeof(b)) || b[0] != 0x1f || b[1] != 0x8b || b[12] != 'B' || b[13] != 'C') {
+			exit_with_error("Invalid bgzf block in infile", 3);
+		}
+		size = (b[16] | b[17] << 8) + 1;
+		if (!read_at(ff->file, comp + size - 4, b, 4)) {
+			exit_with_error("Invalid bgzf block in infile", 3);
+		}
+		// The empty block bgzip ends the file with has nothing to read.
+		if (read_le32(b) > 0) {
+			add_frame(ff, comp, plain);
+			plain += read_le32(b);
+		}
+		comp += size;
 	}
+	add_frame(ff, comp, plain);
+	--ff->len;
 }
 
-void add_dependency(node *master, node *slave) {
-	if ((slave->deps = (node**)realloc(slave->deps, (slave->dep_len + 1) * sizeof(node*))) == NULL) {
-		exit_with_error("realloc failed", 2);
+// A .gzi index next to the file, as bgzip -i writes it, lists where the blocks start, so the
+// blocks only have to be looked at from the last one it lists.
+static void index_bgzf_file(framed_file *ff, char *path, off_t file_size) {
+	FILE *gzi;
+	unsigned char b[16];
+	unsigned long long i, len;
+	off_t comp = 0;
+	off_t plain = 0;
+	char *gzi_path = str_malloc(strlen(path) + 5);
+	sprintf(gzi_path, "%s.gzi", path);
+	if ((gzi = fopen(gzi_path, "rb")) != NULL && fread(b, 1, 8, gzi) == 8) {
+		len = read_le64(b);
+		for (i = 0; i < len && fread(b, 1, 16, gzi) == 16; ++i) {
+			if (i == 0) {
+				add_frame(ff, 0, 0);
+			}
+			comp = (off_t)read_le64(b);
+			plain = (off_t)read_le64(&b[8]);
+			if (i + 1 < len) {
+				add_frame(ff, comp, plain);
+			}
+		}
+	}
+	if (gzi) {
+		fclose(gzi);
 	}
-	slave->deps[slave->dep_len] = master;
-	++slave->dep_len;
+	free(gzi_path);
+	index_bgzf(ff, comp, plain, file_size);
 }
 
-// Adds dependency to the relevant parent directory node. I.e. foo/bar/baz.txt depends
-// on foo/bar, and foo/bar depends on foo. foo doesn't depend on anything.
-void add_dir_dep_to_node(repotree *rt, node *n, int rev) {
-	int i = strlen(n->path);
-	char *path = str_malloc(i + 1);
-	repotree *target;
-	node *temp_n;
-	strcpy(path, n->path);
-	while (i && path[i] != '/') {
-		--i;
+// The seek table of the seekable format is a skippable frame at the end of the file, listing
+// the compressed and decompressed size of every frame.
+static void index_zstd(framed_file *ff, off_t file_size) {
+	unsigned char b[12];
+	unsigned int i, len, entry;
+	off_t comp = 0;
+	off_t plain = 0;
+	off_t table;
+	if (file_size < 17 || !read_at(ff->file, file_size - 9, b, 9) || read_le32(&b[5]) != ZSTD_SEEKABLE_MAGIC) {
+		exit_with_error("The zstd compressed infile is not in the seekable format", 3);
 	}
-	// The node exists in root, and doesn't have this dependency.
-	if (!i) {
-		free(path);
-		return;
+	len = read_le32(b);
+	entry = (b[4] & 0x80) ? 12 : 8;
+	table = file_size - 9 - (off_t)len * entry;
+	if (table < 8) {
+		exit_with_error("Invalid zstd seek table in infile", 3);
 	}
-	path[i] = '\0';
-	target = get_subtree(rt, path, 1);
-	free(path);
-	temp_n = get_add_node_at_revision(target->map, rev, target->map_len);
-	if (temp_n && temp_n->action != DELETE) {
-		add_dependency(temp_n, n);
+	if (fseeko(ff->file, table, SEEK_SET) != 0) {
+		exit_with_error("Could not seek in infile", 3);
 	}
-	else {
-		fprintf(stderr, "Tried to add dependency to non-existing parent/revision. %d %s\n", rev, n->path);
-		exit_with_error("Internal logic error", 3);
+	for (i = 0; i < len; ++i) {
+		if (fread(b, 1, entry, ff->file) != entry) {
+			exit_with_error("Invalid zstd seek table in infile", 3);
+		}
+		add_frame(ff, comp, plain);
+		comp += read_le32(b);
+		plain += read_le32(&b[4]);
 	}
+	if (comp != table - 8) {
+		exit_with_error("Invalid zstd seek table in infile", 3);
+	}
+	add_frame(ff, comp, plain);
+	--ff->len;
 }
 
-// Adds dependency to previous version of file (which can actually be a dir).
-// Only "ADD" nodes with copyfrom attribute should need this. All others should be
-// handled immediately when the event is added.
-void add_file_dep_to_node(repotree *rt, node *n) {
-	repotree *target;
-	node *temp_n;
-	if (n->action != ADD || !n->copyfrom) {
-		return;
+static framed_file* open_framed(FILE *f, int kind, char *path) {
+	framed_file *ff;
+	struct stat st;
+#ifndef HAVE_ZLIB
+	if (kind == FRAMES_BGZF) {
+		exit_with_error("Reading bgzf compressed infiles needs a build with HAVE_ZLIB defined", 1);
 	}
-	target = get_subtree(rt, n->copyfrom, 1);
-	// If we have the special case of the root directory being copied, we don't need any
-	// additional dependencies since everything implicitly depends on the root dir anyway.
-	if (target == rt) {
-		return;
+#endif
+#ifndef HAVE_ZSTD
+	if (kind == FRAMES_ZSTD) {
+		exit_with_error("Reading zstd compressed infiles needs a build with HAVE_ZSTD defined", 1);
+	}
+#endif
+	if ((ff = (framed_file*)calloc(1, sizeof(framed_file))) == NULL) {
+		exit_with_error("calloc failed", 2);
 	}
-	temp_n = get_node_at_revision(target->map, n->copyfrom_rev, target->map_len);
-	if (temp_n && temp_n->action != DELETE) {
-		add_dependency(temp_n, n);
+	if (fstat(fileno(f), &st) != 0) {
+		exit_with_error("The size of an infile can not be determined", 3);
+	}
+	ff->file = f;
+	ff->kind = kind;
+	if (kind == FRAMES_BGZF) {
+		index_bgzf_file(ff, path, st.st_size);
 	}
 	else {
-		fprintf(stderr, "Tried to add dependency to non-existing parent/revision. %d %d %d %s %s\n", n->revision, n->copyfrom_rev, n->action, n->path, n->copyfrom);
-		exit_with_error("Internal logic error", 3);
+		index_zstd(ff, st.st_size);
 	}
+	return ff;
 }
 
-// If a file is merged into another we need to add a dependency...
-void add_merge_dep_to_node(repotree *rt, node *n, char *mergefrom, char *mergeto, int rev) {
-	repotree *subtree;
-	node *temp_n;
-	int alloc = 0;
-	char *temp = add_slash_to(mergeto);
-	// Check that file is actually relevant to merge before proceeding.
-	if (!(starts_with(n->path, temp) || strcmp(n->path, mergeto) == 0)) {
-		free(temp);
-		return;
+// Returns the decompressed size of the file.
+static off_t get_framed_size(framed_file *ff) {
+	return ff->plain[ff->len];
+}
+
+#if defined(HAVE_ZLIB) || defined(HAVE_ZSTD)
+// Decompresses a frame of src_len bytes to dst_len bytes with the thread's own stream (bgzf)
+// or context (zstd). Returns 0 if that failed.
+static int decompress_frame(framed_file *ff, void *stream, unsigned char *src, size_t src_len, unsigned char *dst, size_t dst_len) {
+#ifdef HAVE_ZLIB
+	z_stream *z = (z_stream*)stream;
+	if (ff->kind == FRAMES_BGZF) {
+		z->next_in = src;
+		z->avail_in = src_len;
+		z->next_out = dst;
+		z->avail_out = dst_len;
+		return inflate(z, Z_FINISH) == Z_STREAM_END && z->avail_out == 0 && inflateReset(z) == Z_OK;
 	}
-	free(temp);
-	if (strcmp(n->path, mergeto) == 0) {
-		temp = mergefrom;
+#endif
+#ifdef HAVE_ZSTD
+	if (ff->kind == FRAMES_ZSTD) {
+		return ZSTD_decompressDCtx((ZSTD_DCtx*)stream, dst, dst_len, src, src_len) == dst_len;
 	}
-	else {
-		temp = get_dir_after_copyfrom(mergefrom, n->path, mergeto);
-		alloc = 1;
+#endif
+	return 0;
+}
+#endif
+
+static void* decompress_frames(void *arg) {
+	frame_job *job = (frame_job*)arg;
+#if defined(HAVE_ZLIB) || defined(HAVE_ZSTD)
+	framed_file *ff = job->ff;
+	void *stream = NULL;
+	int i;
+#endif
+#ifdef HAVE_ZLIB
+	z_stream z;
+	memset(&z, 0, sizeof(z));
+	if (ff->kind == FRAMES_BGZF) {
+		if (inflateInit2(&z, 31) != Z_OK) {
+			job->failed = 1;
+			return NULL;
+		}
+		stream = &z;
+	}
+#endif
+#ifdef HAVE_ZSTD
+	if (ff->kind == FRAMES_ZSTD && (stream = ZSTD_createDCtx()) == NULL) {
+		job->failed = 1;
+		return NULL;
 	}
-	// Get subtree without failing on error, because svn mergeinfo is an unholy mess.
-	subtree = get_subtree(rt, temp, 0);
-	if (alloc) {
-		free(temp);
+#endif
+#if defined(HAVE_ZLIB) || defined(HAVE_ZSTD)
+	for (i = job->first; i < job->last && !job->failed; ++i) {
+		job->failed = !decompress_frame(ff, stream, &ff->packed[ff->comp[i] - ff->comp[ff->first]], ff->comp[i + 1] - ff->comp[i], &ff->data[ff->plain[i] - ff->plain[ff->first]], ff->plain[i + 1] - ff->plain[i]);
 	}
-	if (!subtree) {
-		return;
+#else
+	// Framed files can't be opened without a decompressor, so this is never reached.
+	job->failed = 1;
+#endif
+#ifdef HAVE_ZLIB
+	if (ff->kind == FRAMES_BGZF) {
+		inflateEnd(&z);
 	}
-	temp_n = get_node_at_revision(subtree->map, rev, subtree->map_len);
-	if (temp_n && temp_n->action != DELETE) {
-		add_dependency(temp_n, n);
+#endif
+#ifdef HAVE_ZSTD
+	if (ff->kind == FRAMES_ZSTD) {
+		ZSTD_freeDCtx((ZSTD_DCtx*)stream);
 	}
+#endif
+	return NULL;
 }
 
-int get_max_path_size(repotree *rt) {
-	int i, current;
-	int max = 0;
-	if (rt->chi_len == 0) {
-		return strlen(rt->path);
+// Decompresses the frames from first on, until there's FRAME_BATCH_SIZE of data.
+static void decompress_batch(framed_file *ff, int first) {
+	int i, last;
+	int threads = get_threads();
+	size_t packed_len, data_len;
+	frame_job jobs[MAX_THREADS];
+#ifndef _WIN32
+	pthread_t ids[MAX_THREADS];
+	int started[MAX_THREADS];
+#endif
+	for (last = first + 1; last < ff->len && ff->plain[last] - ff->plain[first] < FRAME_BATCH_SIZE; ++last) {}
+	packed_len = ff->comp[last] - ff->comp[first];
+	data_len = ff->plain[last] - ff->plain[first];
+	if (packed_len > ff->packed_max) {
+		ff->packed_max = packed_len;
+		if ((ff->packed = (unsigned char*)realloc(ff->packed, packed_len)) == NULL) {
+			exit_with_error("realloc failed", 2);
+		}
 	}
-	for (i = 0; i < rt->chi_len; ++i) {
-		current = get_max_path_size(&rt->children[i]);
-		if (current > max) {
-			max = current;
+	if (data_len > ff->data_max) {
+		ff->data_max = data_len;
+		if ((ff->data = (unsigned char*)realloc(ff->data, data_len)) == NULL) {
+			exit_with_error("realloc failed", 2);
+		}
+	}
+	if (!read_at(ff->file, ff->comp[first], ff->packed, packed_len)) {
+		exit_with_error("Could not read from infile", 3);
+	}
+	ff->first = first;
+	ff->last = last;
+	if (threads > last - first) {
+		threads = last - first;
+	}
+	for (i = 0; i < threads; ++i) {
+		jobs[i].ff = ff;
+		jobs[i].first = first + (last - first) * i / threads;
+		jobs[i].last = first + (last - first) * (i + 1) / threads;
+		jobs[i].failed = 0;
+	}
+#ifndef _WIN32
+	// The frames of a thread that can't be started are decompressed on this one instead.
+	for (i = 1; i < threads; ++i) {
+		started[i] = pthread_create(&ids[i], NULL, decompress_frames, &jobs[i]) == 0;
+	}
+#endif
+	decompress_frames(&jobs[0]);
+	for (i = 1; i < threads; ++i) {
+#ifndef _WIN32
+		if (started[i]) {
+			pthread_join(ids[i], NULL);
+			continue;
+		}
+#endif
+		decompress_frames(&jobs[i]);
+	}
+	for (i = 0; i < threads; ++i) {
+		if (jobs[i].failed) {
+			exit_with_error("Could not decompress infile", 3);
 		}
 	}
-	return max;
 }
 
-// Add event to repo tree. If the path in question does not yet exist, we add it to the tree.
-// If it does exists we add it to the map. Dependencies are added for non-ADD-type nodes.
-// ADD-types are either new files (=doesn't need this dependency) or copyfrom instances
-// (=needs different dependecy, handled elsewhere).
-void add_event(repotree *rt, node *n) { //, char *str, int rev_len) {
-	int i;
-	for (i = 0; i < rt->chi_len; ++i) {
-		if (matches_path_start(n->path, rt->children[i].path)) {
-			if (strcmp(n->path, rt->children[i].path) != 0) {
-				add_event(&rt->children[i], n);
-			}
-			else {
-				// Make everyone use the same pointer to save memory (important with huge 100GB+ repos)
-				if (n->path != rt->children[i].path) {
-					free(n->path);
-					n->path = rt->children[i].path;
+// Reads up to count decompressed bytes. Returns the number of bytes read.
+static size_t read_framed(framed_file *ff, unsigned char *buffer, size_t count) {
+	size_t done = 0;
+	size_t chunk;
+	int lo, hi, mid;
+	while (done < count && ff->pos < get_framed_size(ff)) {
+		if (ff->first == ff->last || ff->pos < ff->plain[ff->first] || ff->pos >= ff->plain[ff->last]) {
+			// Find the frame the position is in.
+			lo = 0;
+			hi = ff->len - 1;
+			while (lo < hi) {
+				mid = (lo + hi + 1) / 2;
+				if (ff->plain[mid] <= ff->pos) {
+					lo = mid;
 				}
-				if (n->action != ADD) {
-					add_dependency(rt->children[i].map[rt->children[i].map_len - 1], n);
-				}
-				if ((rt->children[i].map = (node**)realloc(rt->children[i].map, (rt->children[i].map_len + 1) * sizeof(node*))) == NULL) {
-					exit_with_error("realloc failed", 2);
+				else {
+					hi = mid - 1;
 				}
-				rt->children[i].map[rt->children[i].map_len] = n;
-				++rt->children[i].map_len;
 			}
-			return;
+			decompress_batch(ff, lo);
+		}
+		chunk = ff->plain[ff->last] - ff->pos;
+		if (chunk > count - done) {
+			chunk = count - done;
 		}
+		memcpy(&buffer[done], &ff->data[ff->pos - ff->plain[ff->first]], chunk);
+		ff->pos += chunk;
+		done += chunk;
 	}
-	// New path - add it to tree.
-	if ((rt->children = (repotree*)realloc(rt->children, (rt->chi_len + 1) * sizeof(repotree))) == NULL) {
-		exit_with_error("realloc failed", 2);
+	return done;
+}
+
+static void close_framed(framed_file *ff) {
+	fclose(ff->file);
+	free(ff->comp);
+	free(ff->plain);
+	free(ff->packed);
+	free(ff->data);
+	free(ff);
+}
+
+// Moves to offset of the current file, decompressed if it's compressed, and not counting the
+// dump header that is skipped.
+static void seek_input_file(input *in, off_t offset) {
+	offset += in->skips[in->current];
+	if (in->framed[in->current]) {
+		in->framed[in->current]->pos = offset;
 	}
-	rt->children[rt->chi_len].path = n->path;
-	rt->children[rt->chi_len].children = NULL;
-	rt->children[rt->chi_len].chi_len = 0;
-	if ((rt->children[rt->chi_len].map = (node**)malloc(sizeof(node*))) == NULL) {
-		exit_with_error("malloc failed", 2);
+	else if (fseeko(in->file, offset, SEEK_SET) != 0) {
+		exit_with_error("Could not seek in infile", 3);
 	}
-	rt->children[rt->chi_len].map[0] = n;
-	rt->children[rt->chi_len].map_len = 1;
-	++rt->chi_len;
 }
 
-// Returns a list of node pointers present in a specific part of the tree at a specific revision.
-// The number of nodes in the list will be "returned" through the "size" pointer.
-node** get_relevant_nodes_at_revision(repotree *rt, int rev, int wanted_only, int *size) {
-	int i, j, ch_size;
-	int self_size = 0;
-	node **nptr, **nptr2;
-	node *n;
-	for (i = 0; i < rt->chi_len; ++i) {
-		n = get_node_at(rt->children[i].map, rev, rt->children[i].map_len, wanted_only);
-		if (n && n->action != DELETE) {
-			++self_size;
-		}
+// Reads up to count bytes from the current file, decompressed if it's compressed.
+static size_t read_input_file(input *in, unsigned char *buffer, size_t count) {
+	if (in->framed[in->current]) {
+		return read_framed(in->framed[in->current], buffer, count);
 	}
-	if (!self_size) {
-		*size = 0;
-		return NULL;
+	return fread(buffer, 1, count, in->file);
+}
+
+// Slices dumped with "svnadmin dump --incremental" each start with the dump header. Only the
+// first one is read, so that the dump is the same as if it had been dumped in one go. Returns
+// the size of the header file i starts with, or 0 if it doesn't start with one.
+static off_t get_slice_header_size(input *in, int i) {
+	char header[SLICE_HEADER_MAX + 1];
+	char *end;
+	size_t len;
+	in->current = i;
+	in->file = in->files[i];
+	seek_input_file(in, 0);
+	len = read_input_file(in, (unsigned char*)header, SLICE_HEADER_MAX);
+	header[len] = '\0';
+	if (!starts_with(header, "SVN-fs-dump-format-version:")) {
+		return 0;
+	}
+	if ((end = strstr(header, "\nRevision-number:")) == NULL) {
+		// A slice without revisions is nothing but the header.
+		return len < SLICE_HEADER_MAX ? (off_t)len : 0;
+	}
+	return end + 1 - header;
+}
+
+// All reading of the dump file goes through this layer. It keeps its own large buffer
+// instead of relying on stdio, so that the per-character reads in both passes stay cheap,
+// and skipping past node content is usually just a matter of moving within the buffer.
+// A path of "-" means stdin. Since that can't be read twice, everything read from it is
+// copied to a spill file, and the first seek backwards switches over to reading the spill.
+// Several paths are read one after the other, as if they had been concatenated into one
+// file. Offsets are always into that one logical file, so nothing above this layer needs to
+// know where one file ends and the next one starts.
+static input* open_input(char **paths, int len) {
+	input *in;
+	struct stat st;
+	int i, kind;
+	if ((in = (input*)calloc(1, sizeof(input))) == NULL) {
+		exit_with_error("calloc failed", 2);
 	}
-	if ((nptr = (node**)malloc(self_size * sizeof(node*))) == NULL) {
+	// Should opening fail in a library function, whatever is open so far gets closed.
+	opening = in;
+	if ((in->files = (FILE**)calloc(len, sizeof(FILE*))) == NULL || (in->framed = (framed_file**)calloc(len, sizeof(framed_file*))) == NULL || (in->offsets = (off_t*)calloc(len + 1, sizeof(off_t))) == NULL || (in->skips = (off_t*)calloc(len, sizeof(off_t))) == NULL) {
 		exit_with_error("malloc failed", 2);
 	}
-	self_size = 0;
-	for (i = 0; i < rt->chi_len; ++i) {
-		n = get_node_at(rt->children[i].map, rev, rt->children[i].map_len, wanted_only);
-		if (n && n->action != DELETE) {
-			nptr[self_size] = n;
-			++self_size;
+	in->file_len = len;
+	for (i = 0; i < len; ++i) {
+		if (strcmp(paths[i], "-") == 0) {
+			if (len > 1) {
+				exit_with_error("stdin can not be read together with other infiles", 1);
+			}
+			in->files[i] = stdin;
+#ifdef _WIN32
+			_setmode(_fileno(stdin), _O_BINARY);
+#endif
+			if ((in->spill = open_spill_file()) == NULL) {
+				exit_with_error("Could not create spill file for stdin", 3);
+			}
+		}
+		else if ((in->files[i] = fopen(paths[i], "rb")) == NULL) {
+			exit_with_file_error(paths[i], " can not be opened as infile", 3);
+		}
+		else if ((kind = get_frame_kind(in->files[i], paths[i])) != 0) {
+			in->framed[i] = open_framed(in->files[i], kind, paths[i]);
+		}
+		if (i > 0) {
+			in->skips[i] = get_slice_header_size(in, i);
 		}
+		// Continuing across files needs their sizes. The size of a single file is only
+		// used for progress, so there it's alright not to know it.
+		if (in->framed[i]) {
+			in->offsets[i + 1] = in->offsets[i] + get_framed_size(in->framed[i]) - in->skips[i];
+		}
+		else if (!in->spill && fstat(fileno(in->files[i]), &st) == 0) {
+			in->offsets[i + 1] = in->offsets[i] + st.st_size - in->skips[i];
+		}
+		else if (len > 1) {
+			exit_with_error("The size of an infile can not be determined", 3);
+		}
+#if !defined(_WIN32) && defined(POSIX_FADV_SEQUENTIAL)
+		posix_fadvise(fileno(in->files[i]), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
 	}
-	for (i = 0; i < rt->chi_len; ++i) {
-		n = get_node_at(rt->children[i].map, rev, rt->children[i].map_len, wanted_only);
-		if (n && n->action != DELETE) {
-			nptr2 = get_relevant_nodes_at_revision(&rt->children[i], rev, wanted_only, &ch_size);
-			if (nptr2) {
-				if ((nptr = (node**)realloc(nptr, (ch_size + self_size) * sizeof(node*))) == NULL) {
-					exit_with_error("realloc failed", 2);
-				}
-				for (j = 0; j < ch_size; ++j) {
-					nptr[self_size] = nptr2[j];
-					++self_size;
-				}
-				free(nptr2);
-			}
+	if ((in->buffer = (unsigned char*)malloc(INPUT_BUFFER_SIZE)) == NULL) {
+		exit_with_error("malloc failed", 2);
+	}
+	in->file = in->files[0];
+	in->current = 0;
+	in->start = 0;
+	in->pos = 0;
+	in->len = 0;
+	in->size = in->offsets[len];
+	opening = NULL;
+	return in;
+}
+
+// Also closes an input that failed to open, as far as it got.
+static void close_input(input *in) {
+	int i;
+	if (in->spill) {
+		fclose(in->spill);
+	}
+	for (i = 0; i < in->file_len; ++i) {
+		if (in->framed[i]) {
+			close_framed(in->framed[i]);
+		}
+		else if (in->files[i] && in->files[i] != stdin) {
+			fclose(in->files[i]);
 		}
 	}
-	*size = self_size;
-	return nptr;
+	free(in->files);
+	free(in->framed);
+	free(in->offsets);
+	free(in->skips);
+	free(in->buffer);
+	free(in);
 }
 
-/*******************************************************************************
- *
- * Mergeinfo-related functions
- *
- ******************************************************************************/
+// Continues reading from the start of file i. The kernel is asked to start reading the file
+// after it, so that there's no wait for the disk when we get there.
+static void switch_input_file(input *in, int i) {
+	in->current = i;
+	in->file = in->files[i];
+	seek_input_file(in, 0);
+#if !defined(_WIN32) && defined(POSIX_FADV_WILLNEED)
+	if (i + 1 < in->file_len) {
+		posix_fadvise(fileno(in->files[i + 1]), 0, INPUT_PREFETCH_SIZE, POSIX_FADV_WILLNEED);
+	}
+#endif
+}
 
-// Takes a string where newlines have been replaced with NULL chars.
-// "Returns" the size of the data through the int pointer.
-mergedata* add_mergedata(char *minfo, int *size) {
-	mergedata *md;
-	int i = 0;
-	int len, j;
-	if ((md = (mergedata*)malloc(sizeof(mergedata))) == NULL) {
-		exit_with_error("malloc failed", 2);
+// Refills the buffer from the current file position. Returns the number of bytes read.
+static size_t fill_input(input *in) {
+	in->start += in->len;
+	in->pos = 0;
+	in->len = read_input_file(in, in->buffer, INPUT_BUFFER_SIZE);
+	// At the end of a file the rest of the buffer is filled from the next one.
+	while (in->len < INPUT_BUFFER_SIZE && !ferror(in->file) && in->current + 1 < in->file_len) {
+		switch_input_file(in, in->current + 1);
+		in->len += read_input_file(in, &in->buffer[in->len], INPUT_BUFFER_SIZE - in->len);
+	}
+	if (in->len == 0 && ferror(in->file)) {
+		exit_with_error("Could not read from infile", 3);
+	}
+	if (in->spill && fwrite(in->buffer, 1, in->len, in->spill) != in->len) {
+		exit_with_error("Could not write to spill file", 3);
+	}
+	return in->len;
+}
+
+static inline int input_getc(input *in) {
+	if (in->pos == in->len && !fill_input(in)) {
+		return EOF;
+	}
+	return in->buffer[in->pos++];
+}
+
+// Returns the offset of the next byte to be read.
+static off_t input_tell(input *in) {
+	return in->start + in->pos;
+}
+
+static void input_seek(input *in, off_t offset) {
+	int i;
+	// Stay within the buffer if we can.
+	if (offset >= in->start && offset <= in->start + (off_t)in->len) {
+		in->pos = offset - in->start;
+		return;
+	}
+	if (in->spill) {
+		// Streams can only be skipped forward by reading (and spilling) the data.
+		if (offset > in->start) {
+			while (offset > in->start + (off_t)in->len && fill_input(in)) {}
+			in->pos = (offset < in->start + (off_t)in->len) ? (size_t)(offset - in->start) : in->len;
+			return;
+		}
+		// Going backwards means the stream is done with. Continue from the spill file.
+		if (fflush(in->spill) != 0) {
+			exit_with_error("Could not write to spill file", 3);
+		}
+		in->file = in->files[0] = in->spill;
+		in->spill = NULL;
+	}
+	// The last file also takes offsets beyond the end, so that they read as the end of the dump.
+	for (i = in->file_len - 1; i > 0 && in->offsets[i] > offset; --i) {}
+	if (i != in->current) {
+		switch_input_file(in, i);
+	}
+	seek_input_file(in, offset - in->offsets[i]);
+	in->start = offset;
+	in->pos = 0;
+	in->len = 0;
+}
+
+static void input_skip(input *in, off_t count) {
+	input_seek(in, input_tell(in) + count);
+}
+
+// Consumes up to count bytes, handing out a pointer to them in the buffer instead of copying
+// them. Returns the number of bytes available through data, or 0 at the end of the file.
+static size_t input_chunk(input *in, unsigned char **data, off_t count) {
+	size_t chunk;
+	if (in->pos == in->len && !fill_input(in)) {
+		return 0;
+	}
+	chunk = in->len - in->pos;
+	if ((off_t)chunk > count) {
+		chunk = (size_t)count;
+	}
+	*data = &in->buffer[in->pos];
+	in->pos += chunk;
+	return chunk;
+}
+
+/*******************************************************************************
+ *
+ * Memory budget
+ *
+ ******************************************************************************/
+
+static int arena_owns(void *p) {
+	int i;
+	for (i = mem.chunk_len - 1; i >= 0; --i) {
+		if ((unsigned char*)p >= mem.chunks[i] && (unsigned char*)p < mem.chunks[i] + mem.chunk_sizes[i]) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+#ifndef _WIN32
+static void add_arena_chunk(size_t size) {
+	unsigned char *chunk;
+	if (size < ARENA_CHUNK_SIZE) {
+		size = ARENA_CHUNK_SIZE;
+	}
+	if (mem.file == NULL && (mem.file = open_spill_file()) == NULL) {
+		exit_with_error("Could not create a temporary file for the memory limit", 3);
+	}
+	if (ftruncate(fileno(mem.file), mem.file_size + size) != 0) {
+		exit_with_error("Could not grow the temporary file for the memory limit", 3);
+	}
+	chunk = (unsigned char*)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fileno(mem.file), mem.file_size);
+	if (chunk == MAP_FAILED) {
+		exit_with_error("mmap failed", 2);
+	}
+	if ((mem.chunks = (unsigned char**)realloc(mem.chunks, (mem.chunk_len + 1) * sizeof(unsigned char*))) == NULL) {
+		exit_with_error("realloc failed", 2);
+	}
+	if ((mem.chunk_sizes = (size_t*)realloc(mem.chunk_sizes, (mem.chunk_len + 1) * sizeof(size_t))) == NULL) {
+		exit_with_error("realloc failed", 2);
+	}
+	mem.chunks[mem.chunk_len] = chunk;
+	mem.chunk_sizes[mem.chunk_len] = size;
+	++mem.chunk_len;
+	mem.file_size += size;
+	mem.used = 0;
+}
+#endif
+
+static void* arena_alloc(size_t size) {
+	unsigned char *p;
+	size = (size + 7) & ~(size_t)7;
+#ifndef _WIN32
+	if (mem.chunk_len == 0 || mem.used + size > mem.chunk_sizes[mem.chunk_len - 1]) {
+		add_arena_chunk(size);
+	}
+#endif
+	p = mem.chunks[mem.chunk_len - 1] + mem.used;
+	mem.used += size;
+	return p;
+}
+
+// Allocates a block of the node pool, from the arena if we're spilling.
+static void* model_alloc(size_t size) {
+	void *p;
+	if (mem.spilling) {
+		return arena_alloc(size);
+	}
+	if ((p = malloc(size)) == NULL) {
+		exit_with_error("malloc failed", 2);
+	}
+	mem.bytes += size;
+	return p;
+}
+
+static void model_free(void *p) {
+	if (mem.chunk_len == 0 || !arena_owns(p)) {
+		free(p);
+	}
+}
+
+// Moves a block that has been allocated from the heap into the arena.
+static void* model_move(void *p, size_t size) {
+	void *q;
+	if (arena_owns(p)) {
+		return p;
+	}
+	q = arena_alloc(size);
+	memcpy(q, p, size);
+	free(p);
+	mem.bytes -= size;
+	return q;
+}
+
+static int is_over_memory_limit() {
+	long long rss = get_rss();
+	return (rss ? rss : mem.bytes) > mem.limit;
+}
+
+// Points the columns of a node block to the memory at p, which is NODE_BLOCK_BYTES long.
+static void set_columns(node_block *b, unsigned char *p) {
+	b->path = (path_id*)p;
+	b->revision = (int*)(p + NODE_BLOCK_SIZE * 4);
+	b->deps = (unsigned int*)(p + NODE_BLOCK_SIZE * 8);
+	b->dep_len = (unsigned short*)(p + NODE_BLOCK_SIZE * 12);
+	b->action = (char*)(p + NODE_BLOCK_SIZE * 14);
+	b->wanted = p + NODE_BLOCK_SIZE * 15;
+}
+
+// Starts spilling, and moves the blocks allocated so far into the arena. Since nodes are
+// referred to by id, the blocks can be moved as long as nobody holds a pointer into them.
+static void start_spilling(FILE *messages) {
+	int i;
+	fprintf(messages, "\nThe memory limit has been exceeded. Moving the analysis data to disk.\n");
+	mem.spilling = 1;
+	for (i = 0; i < pool.block_len; ++i) {
+		set_columns(&pool.blocks[i], (unsigned char*)model_move(pool.blocks[i].path, NODE_BLOCK_BYTES));
+	}
+	for (i = 0; i < pool.edge_block_len; ++i) {
+		pool.edge_blocks[i] = (node_id*)model_move(pool.edge_blocks[i], EDGE_BLOCK_SIZE * sizeof(node_id));
+	}
+#ifdef __GLIBC__
+	malloc_trim(0);
+#endif
+}
+
+static void free_arena() {
+#ifndef _WIN32
+	int i;
+	for (i = 0; i < mem.chunk_len; ++i) {
+		munmap(mem.chunks[i], mem.chunk_sizes[i]);
+	}
+#endif
+	free(mem.chunks);
+	free(mem.chunk_sizes);
+	if (mem.file) {
+		fclose(mem.file);
+	}
+	mem.spilling = 0;
+	mem.bytes = 0;
+	mem.file = NULL;
+	mem.file_size = 0;
+	mem.chunks = NULL;
+	mem.chunk_sizes = NULL;
+	mem.chunk_len = 0;
+	mem.used = 0;
+}
+
+/*******************************************************************************
+ *
+ * Node storage
+ *
+ ******************************************************************************/
+
+// Makes the hash table of the path table twice as large, or creates it.
+static void grow_path_table() {
+	unsigned int i, j;
+	path_table *t = &node_paths;
+	free(t->slots);
+	t->size = t->size ? 2 * t->size : 1024;
+	if ((t->slots = (path_id*)malloc(t->size * sizeof(path_id))) == NULL) {
+		exit_with_error("malloc failed", 2);
+	}
+	memset(t->slots, 0xff, t->size * sizeof(path_id));
+	for (i = 0; i < t->len; ++i) {
+		for (j = hash_path(t->strings[i], strlen(t->strings[i])) & (t->size - 1); t->slots[j] != NO_PATH; j = (j + 1) & (t->size - 1)) {}
+		t->slots[j] = i;
+	}
+}
+
+// Returns the id of the path, adding a copy of it to the path table if it isn't there yet.
+static path_id intern_path(const char *path) {
+	unsigned int i;
+	size_t len = strlen(path);
+	path_table *t = &node_paths;
+	if (2 * ((long long)t->len + 1) > t->size) {
+		grow_path_table();
+	}
+	for (i = hash_path(path, len) & (t->size - 1); t->slots[i] != NO_PATH; i = (i + 1) & (t->size - 1)) {
+		if (strcmp(t->strings[t->slots[i]], path) == 0) {
+			return t->slots[i];
+		}
+	}
+	if (t->len == NO_PATH - 1) {
+		exit_with_error("Too many paths", 2);
+	}
+	if (t->chunk_len == 0 || t->used + len + 1 > t->chunk_size) {
+		if ((t->chunks = (char**)realloc(t->chunks, (t->chunk_len + 1) * sizeof(char*))) == NULL) {
+			exit_with_error("realloc failed", 2);
+		}
+		t->chunk_size = len + 1 > PATH_CHUNK_SIZE ? len + 1 : PATH_CHUNK_SIZE;
+		t->chunks[t->chunk_len++] = str_malloc(t->chunk_size);
+		t->bytes += t->chunk_size;
+		t->used = 0;
+	}
+	if (t->len == t->max) {
+		t->max = t->max ? 2 * t->max : 1024;
+		if ((t->strings = (char**)realloc(t->strings, t->max * sizeof(char*))) == NULL) {
+			exit_with_error("realloc failed", 2);
+		}
+	}
+	t->strings[t->len] = memcpy(t->chunks[t->chunk_len - 1] + t->used, path, len + 1);
+	t->used += len + 1;
+	t->slots[i] = t->len;
+	return t->len++;
+}
+
+static void free_paths() {
+	int i;
+	for (i = 0; i < node_paths.chunk_len && node_paths.chunks; ++i) {
+		free(node_paths.chunks[i]);
+	}
+	free(node_paths.chunks);
+	free(node_paths.strings);
+	free(node_paths.slots);
+	memset(&node_paths, 0, sizeof(node_paths));
+}
+
+static inline node_block* get_block(node_id id) {
+	return &pool.blocks[id >> NODE_BLOCK_BITS];
+}
+
+static inline path_id node_path_id(node_id id) {
+	return get_block(id)->path[id & (NODE_BLOCK_SIZE - 1)];
+}
+
+static inline char* node_path(node_id id) {
+	return node_paths.strings[node_path_id(id)];
+}
+
+static inline int node_revision(node_id id) {
+	return get_block(id)->revision[id & (NODE_BLOCK_SIZE - 1)];
+}
+
+static inline char node_action(node_id id) {
+	return get_block(id)->action[id & (NODE_BLOCK_SIZE - 1)] & ACTION_MASK;
+}
+
+static inline int node_dep_len(node_id id) {
+	return get_block(id)->dep_len[id & (NODE_BLOCK_SIZE - 1)];
+}
+
+// Returns the ids of the nodes the node depends on.
+static inline node_id* get_deps(node_id id) {
+	unsigned int deps = get_block(id)->deps[id & (NODE_BLOCK_SIZE - 1)];
+	return &pool.edge_blocks[deps >> EDGE_BLOCK_BITS][deps & (EDGE_BLOCK_SIZE - 1)];
+}
+
+static inline node_id get_dep(node_id id, int i) {
+	return get_deps(id)[i];
+}
+
+// Returns 1 if the node is a fake, otherwise 0.
+static inline int is_node_fake(node_id id) {
+	return (get_block(id)->action[id & (NODE_BLOCK_SIZE - 1)] & NODE_FAKE) != 0;
+}
+
+// Returns where a real node that is a copy was copied from.
+static copy_source* get_copy_source(node_id id) {
+	int low = 0;
+	int high = pool.copy_len - 1;
+	int mid;
+	while (low < high) {
+		mid = (low + high) / 2;
+		if (pool.copies[mid].node < id) {
+			low = mid + 1;
+		}
+		else {
+			high = mid;
+		}
+	}
+	return &pool.copies[low];
+}
+
+// Returns the node that a fake made by a copy is a copy of. It's the file dependency, which
+// is followed by nothing but the dir dependency. See analyze_revision.
+static inline node_id get_fake_source(node_id id) {
+	return get_dep(id, node_dep_len(id) - 2);
+}
+
+// Returns NULL if the node isn't a copy.
+static char* node_copyfrom(node_id id) {
+	char flags = get_block(id)->action[id & (NODE_BLOCK_SIZE - 1)];
+	if (!(flags & NODE_COPY)) {
+		return NULL;
+	}
+	if (flags & NODE_FAKE) {
+		return node_path(get_fake_source(id));
+	}
+	return node_paths.strings[get_copy_source(id)->path];
+}
+
+// Returns 0 if the node isn't a copy.
+static int node_copyfrom_rev(node_id id) {
+	char flags = get_block(id)->action[id & (NODE_BLOCK_SIZE - 1)];
+	if (!(flags & NODE_COPY)) {
+		return 0;
+	}
+	if (flags & NODE_FAKE) {
+		return node_revision(get_fake_source(id));
+	}
+	return get_copy_source(id)->rev;
+}
+
+static inline int is_wanted(node_id id) {
+	unsigned int i = id & (NODE_BLOCK_SIZE - 1);
+	return (get_block(id)->wanted[i / 8] >> (i % 8)) & 1;
+}
+
+static inline void set_wanted_bit(node_id id, int wanted) {
+	unsigned int i = id & (NODE_BLOCK_SIZE - 1);
+	if (wanted) {
+		get_block(id)->wanted[i / 8] |= 1 << (i % 8);
+	}
+	else {
+		get_block(id)->wanted[i / 8] &= ~(1 << (i % 8));
+	}
+}
+
+#ifndef _WIN32
+// Sets the wanted bit of the node atomically. Returns 1 if it wasn't set before.
+static inline int claim_node(node_id id) {
+	unsigned int i = id & (NODE_BLOCK_SIZE - 1);
+	unsigned char bit = 1 << (i % 8);
+	return !(__atomic_fetch_or(&get_block(id)->wanted[i / 8], bit, __ATOMIC_RELAXED) & bit);
+}
+#endif
+
+static node_id get_fake(revision *r, int i) {
+	return r->first_fake + i;
+}
+
+// Reserves count consecutive ids in the pool, and returns the first one.
+static node_id alloc_nodes(int count) {
+	node_id first = pool.len;
+	if ((long long)pool.len + count >= NO_NODE) {
+		exit_with_error("Too many nodes", 2);
+	}
+	while ((long long)pool.block_len * NODE_BLOCK_SIZE < (long long)pool.len + count) {
+		if ((pool.blocks = (node_block*)realloc(pool.blocks, (pool.block_len + 1) * sizeof(node_block))) == NULL) {
+			exit_with_error("realloc failed", 2);
+		}
+		set_columns(&pool.blocks[pool.block_len], (unsigned char*)model_alloc(NODE_BLOCK_BYTES));
+		++pool.block_len;
+	}
+	pool.len += count;
+	return first;
+}
+
+// Sets the fields of a new node. It doesn't depend on anything, and isn't wanted. The action
+// may have flags.
+static void init_node(node_id id, path_id path, int revision, char action) {
+	node_block *b = get_block(id);
+	unsigned int i = id & (NODE_BLOCK_SIZE - 1);
+	b->path[i] = path;
+	b->revision[i] = revision;
+	b->deps[i] = 0;
+	b->dep_len[i] = 0;
+	b->action[i] = action;
+	set_wanted_bit(id, 0);
+}
+
+// Notes where a real node was copied from. The real nodes are added in the order of their ids.
+static void add_copy_source(node_id id, path_id path, int rev) {
+	if (pool.copy_len == pool.copy_max) {
+		pool.copy_max = pool.copy_max ? 2 * pool.copy_max : 1024;
+		if ((pool.copies = (copy_source*)realloc(pool.copies, pool.copy_max * sizeof(copy_source))) == NULL) {
+			exit_with_error("realloc failed", 2);
+		}
+	}
+	pool.copies[pool.copy_len].node = id;
+	pool.copies[pool.copy_len].path = path;
+	pool.copies[pool.copy_len].rev = rev;
+	++pool.copy_len;
+	get_block(id)->action[id & (NODE_BLOCK_SIZE - 1)] |= NODE_COPY;
+}
+
+// Adds a dependency to the end of the node's run in the edge pool. All dependencies of a node
+// are added one after another, so the run is normally the last one in the pool. If it isn't,
+// or if it won't fit in the current block, the run is moved to the end of the pool first.
+static void add_edge(node_id n, node_id id) {
+	node_block *b = get_block(n);
+	unsigned int k = n & (NODE_BLOCK_SIZE - 1);
+	node_id *old;
+	int i;
+	if (b->dep_len[k] == 0 || (long long)b->deps[k] + b->dep_len[k] != pool.edge_len || (pool.edge_len & (EDGE_BLOCK_SIZE - 1)) == 0) {
+		if ((pool.edge_len & (EDGE_BLOCK_SIZE - 1)) + b->dep_len[k] + 1 > EDGE_BLOCK_SIZE) {
+			pool.edge_len = (pool.edge_len | (EDGE_BLOCK_SIZE - 1)) + 1;
+		}
+		if (pool.edge_len + b->dep_len[k] + 1 > 0xffffffffLL) {
+			exit_with_error("Too many dependencies", 2);
+		}
+		if (pool.edge_len >> EDGE_BLOCK_BITS == pool.edge_block_len) {
+			if ((pool.edge_blocks = (node_id**)realloc(pool.edge_blocks, (pool.edge_block_len + 1) * sizeof(node_id*))) == NULL) {
+				exit_with_error("realloc failed", 2);
+			}
+			pool.edge_blocks[pool.edge_block_len] = (node_id*)model_alloc(EDGE_BLOCK_SIZE * sizeof(node_id));
+			++pool.edge_block_len;
+		}
+		if (b->dep_len[k] > 0) {
+			old = get_deps(n);
+			b->deps[k] = (unsigned int)pool.edge_len;
+			for (i = 0; i < b->dep_len[k]; ++i) {
+				get_deps(n)[i] = old[i];
+			}
+		}
+		else {
+			b->deps[k] = (unsigned int)pool.edge_len;
+		}
+		pool.edge_len += b->dep_len[k];
+	}
+	get_deps(n)[b->dep_len[k]] = id;
+	++b->dep_len[k];
+	++pool.edge_len;
+}
+
+// Moves the nodes of a finished revision from the reading buffer into the node pool.
+static void store_revision_nodes(revision *revisions, int rev, parsed_node *nodes, FILE *messages) {
+	int i;
+	node_id id;
+	if (mem.limit && !mem.spilling && rev % MEMORY_CHECK_INTERVAL == 0 && is_over_memory_limit()) {
+		start_spilling(messages);
+	}
+	revisions[rev].first = alloc_nodes(revisions[rev].size);
+	for (i = 0; i < revisions[rev].size; ++i) {
+		id = revisions[rev].first + i;
+		init_node(id, intern_path(nodes[i].path), rev, nodes[i].action);
+		if (nodes[i].copyfrom) {
+			add_copy_source(id, intern_path(nodes[i].copyfrom), nodes[i].copyfrom_rev);
+		}
+		free(nodes[i].path);
+		free(nodes[i].copyfrom);
+	}
+}
+
+static void free_pool() {
+	int i;
+	for (i = 0; i < pool.block_len && pool.blocks; ++i) {
+		model_free(pool.blocks[i].path);
+	}
+	for (i = 0; i < pool.edge_block_len && pool.edge_blocks; ++i) {
+		model_free(pool.edge_blocks[i]);
+	}
+	free(pool.blocks);
+	free(pool.copies);
+	free(pool.edge_blocks);
+	memset(&pool, 0, sizeof(pool));
+}
+
+/*******************************************************************************
+ *
+ * Include/exclude-related functions
+ *
+ ******************************************************************************/
+
+// Is path [in/ex]cluded? paths_slash contain a copy of the paths with slashes
+// appended to them. Yes, it could be done here, but this function is typically called
+// from within nested for loops, and not building the path + slash over and over again
+// will be much cheaper computationally.
+static int is_cluded(char *path, char **paths, char **paths_slash, int len) {
+	int i;
+	for (i = 0; i < len; ++i) {
+		if (strcmp(path, paths[i]) == 0 || starts_with(path, paths_slash[i])) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static void print_why(node_id *nptr, char **inc, char **i_slash, char **exc, char **e_slash, char *why, int n_len, int i_len, int e_len) {
+	int i, j;
+	node_id dep;
+	if (n_len < 0) {
+		printf("Path %s does not seem to be included.\n", why);
+		return;
+	}
+	for (i = n_len; i >= 0; --i) {
+		printf("Revision %d: Path: %s  ", node_revision(nptr[i]), node_path(nptr[i]));
+		for (j = 0; j < node_dep_len(nptr[i]); ++j) {
+			dep = get_dep(nptr[i], j);
+			if (node_revision(nptr[i]) == node_revision(dep) && node_copyfrom(dep)) {
+				printf(" (created by \"%s\" copyfrom \"%s\")", node_path(dep), node_copyfrom(dep));
+				break;
+			}
+		}
+		if (inc) {
+			if (is_cluded(node_path(nptr[i]), inc, i_slash, i_len)) {
+				printf(" PULLED BY INCLUDE");
+			}
+		}
+		else if (!is_cluded(node_path(nptr[i]), exc, e_slash, e_len)) {
+			printf(" NOT EXCLUDED");
+		}
+		if (i > 0) {
+			printf(" depends on:");
+		}
+		printf("\n");
+	}
+}
+
+// Sets the node and all its dependencies to "wanted"
+static void set_wanted(node_id n) {
+	int i;
+	// Been here, done that...
+	if (is_wanted(n)) {
+		return;
+	}
+	set_wanted_bit(n, 1);
+	for (i = 0; i < node_dep_len(n); ++i) {
+		set_wanted(get_dep(n, i));
+	}
+}
+
+// Marking the dependencies of many seeds is spread over a pool of threads. Each thread
+// expands nodes from a stack of its own, and now and then moves a chunk of it to a shared
+// stack, from which the threads that have run out of work steal. A node is claimed by
+// atomically setting its wanted bit, so it is expanded only once, by whichever thread gets
+// there first. The set of nodes reached is the same as with set_wanted, whatever the order.
+#define MARK_CHUNK 1024
+
+typedef struct {
+	node_id *nodes;
+	int len;
+	int max;
+} node_stack;
+
+static void push_node(node_stack *s, node_id n) {
+	if (s->len == s->max) {
+		s->max = s->max ? 2 * s->max : MARK_CHUNK;
+		if ((s->nodes = (node_id*)realloc(s->nodes, s->max * sizeof(node_id))) == NULL) {
+			exit_with_error("realloc failed", 2);
+		}
+	}
+	s->nodes[s->len++] = n;
+}
+
+// Moves len nodes from the top of one stack to another.
+static void move_nodes(node_stack *from, node_stack *to, int len) {
+	while (len-- > 0) {
+		push_node(to, from->nodes[--from->len]);
+	}
+}
+
+// Sets a seed to "wanted". Without a pool its dependencies are marked right away, otherwise
+// it is collected for mark_seeds.
+static void add_seed(node_stack *seeds, node_id n) {
+	if (seeds == NULL) {
+		set_wanted(n);
+	}
+	else if (!is_wanted(n)) {
+		set_wanted_bit(n, 1);
+		push_node(seeds, n);
+	}
+}
+
+#ifndef _WIN32
+struct marking;
+
+typedef struct {
+	node_stack own;
+	node_stack shared; // Guarded by lock
+	pthread_mutex_t lock;
+	pthread_mutex_t *held; // The lock this thread holds, if any, to let go of on an error
+	pthread_t thread;
+	struct marking *mk;
+} marker;
+
+typedef struct marking {
+	marker *markers;
+	int len;
+	int busy; // Threads that have work or are looking for it, accessed atomically
+	thread_error err; // Once a thread has failed, the others stop too
+} marking;
+
+static void lock_marker(marker *me, marker *m) {
+	pthread_mutex_lock(&m->lock);
+	me->held = &m->lock;
+}
+
+static void unlock_marker(marker *me) {
+	pthread_mutex_unlock(me->held);
+	me->held = NULL;
+}
+
+// Gets more work for a thread that has run out: first what it has shared itself, then half
+// of the shared stack of some other thread. Returns 0 when there's no work left anywhere.
+// A thread only shares while it's busy, and counts as busy while stealing, so once no
+// thread is busy, every shared stack is empty.
+static int find_work(marker *me) {
+	marking *mk = me->mk;
+	int i, v;
+	lock_marker(me, me);
+	move_nodes(&me->shared, &me->own, me->shared.len);
+	unlock_marker(me);
+	if (me->own.len > 0) {
+		return 1;
+	}
+	__atomic_sub_fetch(&mk->busy, 1, __ATOMIC_SEQ_CST);
+	// A thread that failed never stops being busy, so the others have to look for that too.
+	while (__atomic_load_n(&mk->busy, __ATOMIC_SEQ_CST) > 0 && !has_thread_error(&mk->err)) {
+		__atomic_add_fetch(&mk->busy, 1, __ATOMIC_SEQ_CST);
+		for (i = 1; i < mk->len; ++i) {
+			v = (me - mk->markers + i) % mk->len;
+			lock_marker(me, &mk->markers[v]);
+			move_nodes(&mk->markers[v].shared, &me->own, (mk->markers[v].shared.len + 1) / 2);
+			unlock_marker(me);
+			if (me->own.len > 0) {
+				return 1;
+			}
+		}
+		__atomic_sub_fetch(&mk->busy, 1, __ATOMIC_SEQ_CST);
+		sched_yield();
+	}
+	return 0;
+}
+
+static void* mark_worker(void *arg) {
+	marker *me = (marker*)arg;
+	node_id n, d;
+	int i, code;
+	jmp_buf jump;
+	if ((code = setjmp(jump)) != 0) {
+		if (me->held) {
+			unlock_marker(me);
+		}
+		keep_thread_error(&me->mk->err, code);
+		return NULL;
+	}
+	error_jump = &jump;
+	do {
+		while (me->own.len > 0) {
+			n = me->own.nodes[--me->own.len];
+			for (i = 0; i < node_dep_len(n); ++i) {
+				d = get_dep(n, i);
+				if (claim_node(d)) {
+					push_node(&me->own, d);
+				}
+			}
+			// Share a chunk when there's plenty of work, and the last one has been taken.
+			if (me->own.len >= 2 * MARK_CHUNK && __atomic_load_n(&me->shared.len, __ATOMIC_RELAXED) == 0) {
+				lock_marker(me, me);
+				move_nodes(&me->own, &me->shared, MARK_CHUNK);
+				unlock_marker(me);
+			}
+		}
+	} while (find_work(me));
+	return NULL;
+}
+#endif
+
+// Marks the dependencies of the seeds, which are already wanted, using threads threads.
+static void mark_seeds(node_stack *seeds, int threads) {
+#ifndef _WIN32
+	marking mk;
+	int i, started;
+	if ((mk.markers = (marker*)calloc(threads, sizeof(marker))) == NULL) {
+		exit_with_error("calloc failed", 2);
+	}
+	mk.len = threads;
+	mk.busy = threads;
+	init_thread_error(&mk.err);
+	// The seeds are dealt out in turn, so that every thread gets some of each revision.
+	for (i = 0; i < seeds->len; ++i) {
+		push_node(&mk.markers[i % threads].own, seeds->nodes[i]);
+	}
+	// Dealt out, the seeds aren't needed anymore, also if marking fails.
+	free(seeds->nodes);
+	seeds->nodes = NULL;
+	seeds->len = 0;
+	seeds->max = 0;
+	for (i = 0; i < threads; ++i) {
+		mk.markers[i].mk = &mk;
+		if (pthread_mutex_init(&mk.markers[i].lock, NULL) != 0) {
+			exit_with_error("pthread_mutex_init failed", 2);
+		}
+	}
+	// The seeds of a thread that can't be started would be left unmarked, so then the
+	// threads that have started are stopped as if they had failed.
+	for (started = 0; started < threads; ++started) {
+		if (pthread_create(&mk.markers[started].thread, NULL, mark_worker, &mk.markers[started]) != 0) {
+			snprintf(error_message, sizeof(error_message), "pthread_create failed");
+			keep_thread_error(&mk.err, 2);
+			break;
+		}
+	}
+	for (i = 0; i < threads; ++i) {
+		if (i < started) {
+			pthread_join(mk.markers[i].thread, NULL);
+		}
+		pthread_mutex_destroy(&mk.markers[i].lock);
+		free(mk.markers[i].own.nodes);
+		free(mk.markers[i].shared.nodes);
+	}
+	free(mk.markers);
+	rethrow_thread_error(&mk.err);
+#endif
+}
+
+// Returns the node that is relevant to the revision in question, or NO_NODE if no such node exists.
+static node_id get_node_at_revision(node_id *map, int rev, int map_len) {
+	int i;
+	for (i = map_len - 1; i >=0; --i) {
+		if (node_revision(map[i]) <= rev) {
+			return map[i];
+		}
+	}
+	return NO_NODE;
+}
+
+// Returns the ADD node that is relevant to the revision in question, or NO_NODE if no such node exists.
+static node_id get_add_node_at_revision(node_id *map, int rev, int map_len) {
+	int i;
+	for (i = map_len - 1; i >=0; --i) {
+		if (node_revision(map[i]) <= rev) {
+			if (node_action(map[i]) == ADD) {
+				return map[i];
+			}
+			if (node_action(map[i]) == DELETE) {
+				return NO_NODE;
+			}
+		}
+	}
+	return NO_NODE;
+}
+
+// Returns the node that is actually present at a certain revision when wanted status is considered.
+static node_id get_wanted_node_at_revision(node_id *map, int rev, int map_len) {
+	int i;
+	for (i = map_len - 1; i >=0; --i) {
+		if (node_revision(map[i]) <= rev && is_wanted(map[i])) {
+			if (node_action(map[i]) == DELETE) {
+				return NO_NODE;
+			}
+			return map[i];
+		}
+	}
+	return NO_NODE;
+}
+
+static node_id get_node_at(node_id *map, int rev, int map_len, int wanted_only) {
+	if (wanted_only) {
+		return get_wanted_node_at_revision(map, rev, map_len);
+	}
+	return get_node_at_revision(map, rev, map_len);
+}
+
+/*******************************************************************************
+ *
+ * Repotree/dependency-related functions
+ *
+ ******************************************************************************/
+
+// Returns subtree where the root node matches the provided path.
+static repotree* get_subtree(repotree *rt, char *path, int fail_if_not_found) {
+	int i = 0;
+	++stats.get_subtree_calls;
+	while (i < rt->chi_len) {
+		if (matches_path_start(path, rt->children[i].path)) {
+			if (strcmp(path, rt->children[i].path) == 0) {
+				return &rt->children[i];
+			}
+			rt = &rt->children[i];
+			i = -1;
+		}
+		++i;
+	}
+	// If it's the root dir, return entire tree.
+	if (strlen(path) == 0) {
+		return rt;
+	}
+	if (fail_if_not_found) {
+		fprintf(stderr, "Could not find requested subtree: %s\n", path);
+		exit_with_error("Internal logic error.", 3);
+	}
+	return NULL;
+}
+
+// This function tries to detect any colliding add or delete nodes when using redefine root.
+// These situations can arise when something is copied from outside the included scope to a position
+// where the redefine root operation will cause it to fall back to the original position, e.g.
+// 1) Create foo/bar/baz.txt
+// 2) Create trunk/project/foo/quux.txt
+// 3) Copy bar (from foo/bar) to trunk/project/foo
+// svndumpsanitizer ... -n trunk/project -r trunk/project => won't import due to double add of dir "foo"
+static int has_redefine_collisions(repotree *root, repotree *current, char *redefined_root) {
+	int i, wanted;
+	char *temp;
+	node_id n;
+	repotree *subtree = NULL;
+	if (current->path) {
+		temp = reduce_path(redefined_root, current->path);
+		if (strlen(temp) > 0 && strcmp(current->path, temp) != 0) {
+			subtree = get_subtree(root, temp, 0);
+		}
+		if (subtree) {
+			wanted = 0; // We don't care about "collisions" that are unwanted, and won't be in the final repo.
+			for (i = subtree->map_len - 1; i >= 0; --i) {
+				n = subtree->map[i];
+				if (is_wanted(n)) {
+					wanted = 1;
+				}
+				// If the potential collision was deleted prior to the existence of the redefined path, it's not really a collision.
+				if (node_revision(n) < node_revision(current->map[0]) && node_action(n) == DELETE && is_wanted(n)) {
+					break;
+				}
+				// Houston, we have a problem...
+				if (wanted && (node_action(n) == DELETE || node_action(n) == ADD)) {
+					return 1;
+				}
+			}
+		}
+	}
+	for (i = 0; i < current->chi_len; ++i) {
+		if (has_redefine_collisions(root, &current->children[i], redefined_root)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// Returns 1 if file (or dir) is still present after applying sanitazion rules, otherwise 0.
+// no_search -> correct pointer is already given, skip searching for it.
+static int is_file_present(repotree *rt, node_id n, int no_search) {
+	char *path = node_path(n);
+	repotree *target = get_subtree(rt, path, 1);
+	int i = target->map_len - 1;
+	int j;
+	size_t len;
+	node_id m, cause, dep;
+	// Find the right pointer...
+	while (i >= 0 && target->map[i] != n) {
+		--i;
+	}
+	if (!no_search) {
+		--i; // And back up to the previous one...
+	}
+	while (i >= 0 && node_action(target->map[i]) != DELETE) {
+		m = target->map[i];
+		if (is_wanted(m)) {
+			return 1;
+		}
+		// If it's a fake add node we need to dig deeper...
+		if (node_action(m) == ADD && is_node_fake(m)) {
+			// Is the dependency responsible for the fake wanted?
+			if (node_dep_len(m) > 0 && is_wanted(cause = get_dep(m, 0)) && node_copyfrom(cause)) {
+				len = strlen(node_path(cause));
+				if (strncmp(path, node_path(cause), len) == 0 && path[len] == '/') {
+					// Get the origin of the fake node. E.g. If the file trunk/project2/foo.txt has come to be
+					// by copying trunk/project1 to trunk/project2, the origin would be trunk/project1/foo.txt.
+					// Find the correct dependency
+					for (j = 1; j < node_dep_len(m); ++j) {
+						dep = get_dep(m, j);
+						if (is_dir_after_copyfrom(node_path(dep), node_copyfrom(cause), path, node_path(cause))) {
+							// If it's wanted, we're done
+							if (is_wanted(dep)) {
+								return 1;
+							}
+							// If it's another fake add node, we need another go.
+							else if (node_action(dep) == ADD && is_node_fake(dep)) {
+								return is_file_present(rt, dep, 1);
+							}
+						}
+					}
+				}
+			}
+		}
+		--i;
+	}
+	return 0;
+}
+
+static void restore_delete_node_if_needed(repotree *rt, node_id n) {
+	if (is_file_present(rt, n, 0)) {
+		set_wanted_bit(n, 1);
+	}
+}
+
+static void add_dependency(node_id master, node_id slave, int kind) {
+	++stats.deps[kind];
+	add_edge(slave, master);
+}
+
+// Adds dependency to the relevant parent directory node. I.e. foo/bar/baz.txt depends
+// on foo/bar, and foo/bar depends on foo. foo doesn't depend on anything.
+static void add_dir_dep_to_node(repotree *rt, node_id n, int rev) {
+	int i = strlen(node_path(n));
+	char *path = str_malloc(i + 1);
+	repotree *target;
+	node_id temp_n;
+	strcpy(path, node_path(n));
+	while (i && path[i] != '/') {
+		--i;
+	}
+	// The node exists in root, and doesn't have this dependency.
+	if (!i) {
+		free(path);
+		return;
+	}
+	path[i] = '\0';
+	target = get_subtree(rt, path, 1);
+	free(path);
+	temp_n = get_add_node_at_revision(target->map, rev, target->map_len);
+	if (temp_n != NO_NODE && node_action(temp_n) != DELETE) {
+		add_dependency(temp_n, n, DEP_DIR);
+	}
+	else {
+		fprintf(stderr, "Tried to add dependency to non-existing parent/revision. %d %s\n", rev, node_path(n));
+		exit_with_error("Internal logic error", 3);
+	}
+}
+
+// Adds dependency to previous version of file (which can actually be a dir).
+// Only "ADD" nodes with copyfrom attribute should need this. All others should be
+// handled immediately when the event is added.
+static void add_file_dep_to_node(repotree *rt, node_id n) {
+	repotree *target;
+	node_id temp_n;
+	if (node_action(n) != ADD || !node_copyfrom(n)) {
+		return;
+	}
+	target = get_subtree(rt, node_copyfrom(n), 1);
+	// If we have the special case of the root directory being copied, we don't need any
+	// additional dependencies since everything implicitly depends on the root dir anyway.
+	if (target == rt) {
+		return;
+	}
+	temp_n = get_node_at_revision(target->map, node_copyfrom_rev(n), target->map_len);
+	if (temp_n != NO_NODE && node_action(temp_n) != DELETE) {
+		add_dependency(temp_n, n, DEP_FILE);
+	}
+	else {
+		fprintf(stderr, "Tried to add dependency to non-existing parent/revision. %d %d %d %s %s\n", node_revision(n), node_copyfrom_rev(n), node_action(n), node_path(n), node_copyfrom(n));
+		exit_with_error("Internal logic error", 3);
+	}
+}
+
+// Mergeinfo names the same paths over and over, and many of them were never in the dump, or
+// are in branches deleted long ago. So the lookups of mergeinfo paths go through a hash index
+// of the paths looked up before, telling where each one was found, or that it wasn't. Paths
+// are never removed from the repotree, and new ones are only appended to the children of a
+// subtree, so a path that was found stays on the same route. A path that was missing stays
+// missing until it, or something under it, is added.
+typedef struct {
+	char *path; // NULL for an empty slot
+	int *route; // The index of the child taken at each level from the root
+	repotree *tree; // Where the route led at generation
+	unsigned int hash;
+	int generation; // For a missing path, tree_generation when it was found missing
+	int depth;
+	char state;
+} indexed_path;
+
+typedef struct {
+	indexed_path *slots;
+	unsigned int size; // A power of 2, or 0
+	unsigned int len;
+	unsigned int missing; // Paths known to be missing
+} path_index;
+
+static path_index merge_paths;
+
+static void free_path_index(path_index *x) {
+	unsigned int i;
+	for (i = 0; i < x->size; ++i) {
+		free(x->slots[i].path);
+		free(x->slots[i].route);
+	}
+	free(x->slots);
+	x->slots = NULL;
+	x->size = 0;
+	x->len = 0;
+	x->missing = 0;
+}
+
+// Returns the slot of the path, or the empty slot where it would go. The index must not be empty.
+static indexed_path* get_index_slot(path_index *x, const char *path, unsigned int hash) {
+	unsigned int i;
+	for (i = hash & (x->size - 1); x->slots[i].path; i = (i + 1) & (x->size - 1)) {
+		if (x->slots[i].hash == hash && strcmp(x->slots[i].path, path) == 0) {
+			break;
+		}
+	}
+	return &x->slots[i];
+}
+
+// Returns the slot of the path, adding the path if it isn't in the index.
+static indexed_path* add_to_path_index(path_index *x, char *path, unsigned int hash) {
+	indexed_path *old = x->slots;
+	indexed_path *p;
+	unsigned int i, old_size = x->size;
+	// Keep at most half of the slots in use.
+	if (2 * (x->len + 1) > x->size) {
+		x->size = x->size ? 2 * x->size : 1024;
+		if ((x->slots = (indexed_path*)calloc(x->size, sizeof(indexed_path))) == NULL) {
+			exit_with_error("calloc failed", 2);
+		}
+		for (i = 0; i < old_size; ++i) {
+			if (old[i].path) {
+				*get_index_slot(x, old[i].path, old[i].hash) = old[i];
+			}
+		}
+		free(old);
+	}
+	p = get_index_slot(x, path, hash);
+	if (p->path == NULL) {
+		p->path = str_malloc(strlen(path) + 1);
+		strcpy(p->path, path);
+		p->hash = hash;
+		p->state = PATH_UNKNOWN;
+		++x->len;
+	}
+	return p;
+}
+
+// Notes that get_subtree can't find the path.
+static void add_missing_path(char *path) {
+	indexed_path *p = add_to_path_index(&merge_paths, path, hash_path(path, strlen(path)));
+	if (p->state == PATH_UNKNOWN) {
+		p->state = PATH_MISSING;
+		p->generation = tree_generation;
+		++merge_paths.missing;
+	}
+}
+
+// Returns 1 if the path has been missing since the generation of the tree.
+static int is_missing_since(char *path, int generation) {
+	indexed_path *p;
+	if (merge_paths.missing == 0) {
+		return 0;
+	}
+	p = get_index_slot(&merge_paths, path, hash_path(path, strlen(path)));
+	return p->path && p->state == PATH_MISSING && p->generation <= generation;
+}
+
+// Called when a path is added to the repotree. It, and whatever it's under, may not be
+// missing any more.
+static void forget_missing_paths(char *path) {
+	unsigned int hash = FNV_OFFSET;
+	size_t i;
+	indexed_path *p;
+	for (i = 0; merge_paths.missing > 0; ++i) {
+		if (path[i] == '/' || path[i] == '\0') {
+			p = get_index_slot(&merge_paths, path, hash);
+			if (p->path && p->state == PATH_MISSING && strncmp(p->path, path, i) == 0 && p->path[i] == '\0') {
+				p->state = PATH_UNKNOWN;
+				--merge_paths.missing;
+			}
+		}
+		if (path[i] == '\0') {
+			return;
+		}
+		hash = (hash ^ (unsigned char)path[i]) * FNV_PRIME;
+	}
+}
+
+// Follows the path down from rt like get_subtree does, adding the indices of the children
+// taken to the route. Returns NULL if the path isn't there.
+static repotree* follow_path(repotree *rt, char *path, int **route, int *depth) {
+	int i;
+	while (1) {
+		for (i = 0; i < rt->chi_len && !matches_path_start(path, rt->children[i].path); ++i) {}
+		if (i == rt->chi_len) {
+			// If it's the root dir, it's the entire tree.
+			return path[0] == '\0' ? rt : NULL;
+		}
+		if ((*route = (int*)realloc(*route, (*depth + 1) * sizeof(int))) == NULL) {
+			exit_with_error("realloc failed", 2);
+		}
+		(*route)[(*depth)++] = i;
+		rt = &rt->children[i];
+		if (strcmp(path, rt->path) == 0) {
+			return rt;
+		}
+	}
+}
+
+// Looks up a mergeinfo path like get_subtree(rt, path, 0) does, through the index.
+static repotree* find_merge_path(repotree *rt, char *path) {
+	int d;
+	unsigned int hash = hash_path(path, strlen(path));
+	indexed_path *p = NULL;
+	if (merge_paths.len > 0) {
+		p = get_index_slot(&merge_paths, path, hash);
+	}
+	if (p && p->path && p->state == PATH_MISSING) {
+		++stats.merge_path_missing;
+		return NULL;
+	}
+	if (p && p->path && p->state == PATH_FOUND) {
+		++stats.merge_path_hits;
+		if (p->generation != tree_generation) {
+			p->tree = rt;
+			for (d = 0; d < p->depth; ++d) {
+				p->tree = &p->tree->children[p->route[d]];
+			}
+			p->generation = tree_generation;
+		}
+		return p->tree;
+	}
+	++stats.merge_path_walks;
+	p = add_to_path_index(&merge_paths, path, hash);
+	p->depth = 0;
+	p->tree = follow_path(rt, path, &p->route, &p->depth);
+	p->generation = tree_generation;
+	p->state = p->tree ? PATH_FOUND : PATH_MISSING;
+	if (!p->tree) {
+		++merge_paths.missing;
+	}
+	return p->tree;
+}
+
+// If a file is merged into another we need to add a dependency...
+// The source of a mergeinfo row.
+typedef struct {
+	repotree *tree; // NULL if there's none
+	int *route; // The index of the child taken at each level from the root to the tree
+	int depth;
+	char exact; // Whether everything under the source is in its subtree
+} merge_source;
+
+// The sources of the mergeinfo that applies to the nodes of a revision. Each row's source is
+// looked up once, and the sources of the nodes under the merge target are then looked up
+// from there. Paths are only ever appended to the children of a subtree, so when the tree
+// changes, the sources can be found again by the child indices along their routes.
+typedef struct {
+	mergeinfo *mi; // The mergeinfo the sources are for
+	merge_source *sources;
+	int len;
+	int generation; // tree_generation when the sources were last found
+	char *path; // For building the paths of the sources
+	size_t path_max;
+} merge_sources;
+
+static void init_merge_sources(merge_sources *ms) {
+	ms->mi = NULL;
+	ms->sources = NULL;
+	ms->len = 0;
+	ms->generation = -1;
+	ms->path = NULL;
+	ms->path_max = 0;
+}
+
+static void free_merge_sources(merge_sources *ms) {
+	int k;
+	for (k = 0; k < ms->len; ++k) {
+		free(ms->sources[k].route);
+	}
+	free(ms->sources);
+	free(ms->path);
+}
+
+// Looks up the subtree of a path like get_subtree does, and notes the route to it. A path added
+// before its parents ends up elsewhere in the tree, so the source is only exact if there are no
+// such paths under it.
+static void find_merge_source(repotree *rt, char *path, merge_source *s) {
+	int i, next;
+	size_t len = strlen(path);
+	s->exact = 1;
+	s->depth = 0;
+	while (1) {
+		next = -1;
+		for (i = 0; i < rt->chi_len; ++i) {
+			if (next < 0 && matches_path_start(path, rt->children[i].path)) {
+				next = i;
+			}
+			if (strncmp(rt->children[i].path, path, len) == 0 && rt->children[i].path[len] == '/') {
+				s->exact = 0;
+			}
+		}
+		if (next < 0) {
+			// If it's the root dir, the source is the entire tree.
+			s->tree = len == 0 ? rt : NULL;
+			if (s->tree == NULL) {
+				add_missing_path(path);
+			}
+			return;
+		}
+		if ((s->route = (int*)realloc(s->route, (s->depth + 1) * sizeof(int))) == NULL) {
+			exit_with_error("realloc failed", 2);
+		}
+		s->route[s->depth++] = next;
+		rt = &rt->children[next];
+		if (strcmp(path, rt->path) == 0) {
+			s->tree = rt;
+			return;
+		}
+	}
+}
+
+// Finds the sources of the rows of the mergeinfo, or finds them again after the tree has changed.
+static void update_merge_sources(repotree *rt, merge_sources *ms, mergeinfo *mi) {
+	int k, d;
+	merge_source *s;
+	if (ms->mi != mi) {
+		for (k = 0; k < ms->len; ++k) {
+			free(ms->sources[k].route);
+		}
+		if ((ms->sources = (merge_source*)realloc(ms->sources, mi->data->size * sizeof(merge_source))) == NULL) {
+			exit_with_error("realloc failed", 2);
+		}
+		ms->len = mi->data->size;
+		for (k = 0; k < ms->len; ++k) {
+			ms->sources[k].route = NULL;
+			find_merge_source(rt, mi->data->path[k], &ms->sources[k]);
+		}
+		ms->mi = mi;
+	}
+	else {
+		for (k = 0; k < ms->len; ++k) {
+			s = &ms->sources[k];
+			// A new path may be the source not found before, or be under it.
+			if (s->tree == NULL) {
+				if (is_missing_since(mi->data->path[k], ms->generation)) {
+					++stats.merge_path_missing;
+				}
+				else {
+					find_merge_source(rt, mi->data->path[k], s);
+				}
+				continue;
+			}
+			s->tree = rt;
+			for (d = 0; d < s->depth; ++d) {
+				s->tree = &s->tree->children[s->route[d]];
+			}
+		}
+	}
+	ms->generation = tree_generation;
+}
+
+// Adds the dependencies of a node on the sources of the merge, if it's under the merge target.
+static void add_merge_deps_to_node(repotree *rt, merge_sources *ms, mergeinfo *mi, char *mergeto, node_id n) {
+	int k;
+	size_t len = strlen(mergeto);
+	size_t from_len, needed;
+	char *path = node_path(n);
+	char *suffix = NULL;
+	repotree *subtree;
+	node_id temp_n;
+	mergedata *data = mi->data;
+	// Check that file is actually relevant to merge before proceeding.
+	if (strncmp(path, mergeto, len) != 0 || (path[len] != '\0' && path[len] != '/')) {
+		return;
+	}
+	if (path[len] == '/') {
+		suffix = &path[len + 1];
+	}
+	if (ms->mi != mi || ms->generation != tree_generation) {
+		update_merge_sources(rt, ms, mi);
+	}
+	for (k = 0; k < data->size; ++k) {
+		// Get subtrees without failing on error, because svn mergeinfo is an unholy mess.
+		if (suffix == NULL) {
+			subtree = ms->sources[k].tree;
+		}
+		else {
+			from_len = strlen(data->path[k]);
+			needed = from_len + strlen(suffix) + 2;
+			if (needed > ms->path_max) {
+				ms->path_max = 2 * needed;
+				if ((ms->path = (char*)realloc(ms->path, ms->path_max)) == NULL) {
+					exit_with_error("realloc failed", 2);
+				}
+			}
+			memcpy(ms->path, data->path[k], from_len);
+			ms->path[from_len] = '/';
+			strcpy(&ms->path[from_len + 1], suffix);
+			// Looking from the source is cheap enough. Only the lookups from the root go through the index.
+			if (!ms->sources[k].exact) {
+				subtree = find_merge_path(rt, ms->path);
+			}
+			else if (ms->sources[k].tree) {
+				subtree = get_subtree(ms->sources[k].tree, ms->path, 0);
+			}
+			else {
+				subtree = NULL;
+			}
+		}
+		if (!subtree) {
+			continue;
+		}
+		temp_n = get_node_at_revision(subtree->map, data->to[k], subtree->map_len);
+		if (temp_n != NO_NODE && node_action(temp_n) != DELETE) {
+			add_dependency(temp_n, n, DEP_MERGE);
+		}
+	}
+}
+
+static int get_max_path_size(repotree *rt) {
+	int i, current;
+	int max = 0;
+	if (rt->chi_len == 0) {
+		return strlen(rt->path);
+	}
+	for (i = 0; i < rt->chi_len; ++i) {
+		current = get_max_path_size(&rt->children[i]);
+		if (current > max) {
+			max = current;
+		}
+	}
+	return max;
+}
+
+// Add event to repo tree. If the path in question does not yet exist, we add it to the tree.
+// If it does exists we add it to the map. Dependencies are added for non-ADD-type nodes.
+// ADD-types are either new files (=doesn't need this dependency) or copyfrom instances
+// (=needs different dependecy, handled elsewhere).
+static void add_event(repotree *rt, node_id id) {
+	int i;
+	char *path = node_path(id);
+	for (i = 0; i < rt->chi_len; ++i) {
+		if (matches_path_start(path, rt->children[i].path)) {
+			// The path table holds every path once, so equal paths are the same pointer.
+			if (path != rt->children[i].path) {
+				add_event(&rt->children[i], id);
+			}
+			else {
+				if (node_action(id) != ADD) {
+					add_dependency(rt->children[i].map[rt->children[i].map_len - 1], id, DEP_HISTORY);
+				}
+				if ((rt->children[i].map = (node_id*)realloc(rt->children[i].map, (rt->children[i].map_len + 1) * sizeof(node_id))) == NULL) {
+					exit_with_error("realloc failed", 2);
+				}
+				rt->children[i].map[rt->children[i].map_len] = id;
+				++rt->children[i].map_len;
+			}
+			return;
+		}
+	}
+	// New path - add it to tree.
+	if ((rt->children = (repotree*)realloc(rt->children, (rt->chi_len + 1) * sizeof(repotree))) == NULL) {
+		exit_with_error("realloc failed", 2);
+	}
+	++tree_generation;
+	if (merge_paths.missing > 0) {
+		forget_missing_paths(path);
+	}
+	rt->children[rt->chi_len].path = path;
+	rt->children[rt->chi_len].children = NULL;
+	rt->children[rt->chi_len].chi_len = 0;
+	if ((rt->children[rt->chi_len].map = (node_id*)malloc(sizeof(node_id))) == NULL) {
+		exit_with_error("malloc failed", 2);
+	}
+	rt->children[rt->chi_len].map[0] = id;
+	rt->children[rt->chi_len].map_len = 1;
+	++rt->chi_len;
+}
+
+// Returns a list of node pointers present in a specific part of the tree at a specific revision.
+// The number of nodes in the list will be "returned" through the "size" pointer.
+static node_id* get_relevant_nodes_at_revision(repotree *rt, int rev, int wanted_only, int *size) {
+	int i, j, ch_size;
+	int self_size = 0;
+	node_id *nptr, *nptr2;
+	node_id n;
+	++stats.relevant_nodes_calls;
+	for (i = 0; i < rt->chi_len; ++i) {
+		n = get_node_at(rt->children[i].map, rev, rt->children[i].map_len, wanted_only);
+		if (n != NO_NODE && node_action(n) != DELETE) {
+			++self_size;
+		}
+	}
+	if (!self_size) {
+		*size = 0;
+		return NULL;
+	}
+	if ((nptr = (node_id*)malloc(self_size * sizeof(node_id))) == NULL) {
+		exit_with_error("malloc failed", 2);
+	}
+	self_size = 0;
+	for (i = 0; i < rt->chi_len; ++i) {
+		n = get_node_at(rt->children[i].map, rev, rt->children[i].map_len, wanted_only);
+		if (n != NO_NODE && node_action(n) != DELETE) {
+			nptr[self_size] = n;
+			++self_size;
+		}
+	}
+	for (i = 0; i < rt->chi_len; ++i) {
+		n = get_node_at(rt->children[i].map, rev, rt->children[i].map_len, wanted_only);
+		if (n != NO_NODE && node_action(n) != DELETE) {
+			nptr2 = get_relevant_nodes_at_revision(&rt->children[i], rev, wanted_only, &ch_size);
+			if (nptr2) {
+				if ((nptr = (node_id*)realloc(nptr, (ch_size + self_size) * sizeof(node_id))) == NULL) {
+					exit_with_error("realloc failed", 2);
+				}
+				for (j = 0; j < ch_size; ++j) {
+					nptr[self_size] = nptr2[j];
+					++self_size;
+				}
+				free(nptr2);
+			}
+		}
+	}
+	*size = self_size;
+	if (self_size > stats.relevant_nodes_max) {
+		stats.relevant_nodes_max = self_size;
+	}
+	return nptr;
+}
+
+/*******************************************************************************
+ *
+ * Mergeinfo-related functions
+ *
+ ******************************************************************************/
+
+// Takes a string where newlines have been replaced with NULL chars.
+// "Returns" the size of the data through the int pointer.
+static mergedata* add_mergedata(char *minfo, int *size) {
+	mergedata *md;
+	int i = 0;
+	int len, j;
+	if ((md = (mergedata*)malloc(sizeof(mergedata))) == NULL) {
+		exit_with_error("malloc failed", 2);
 	}
 	md->size = 0;
 	md->path = NULL;
@@ -809,467 +2962,3417 @@ mergedata* add_mergedata(char *minfo, int *size) {
 		if ((md->path = (char**)realloc(md->path, (md->size + 1) * sizeof(char*))) == NULL) {
 			exit_with_error("realloc failed", 2);
 		}
-		if ((md->from = (int*)realloc(md->from, (md->size + 1) * sizeof(int))) == NULL) {
-			exit_with_error("realloc failed", 2);
+		if ((md->from = (int*)realloc(md->from, (md->size + 1) * sizeof(int))) == NULL) {
+			exit_with_error("realloc failed", 2);
+		}
+		if ((md->to = (int*)realloc(md->to, (md->size + 1) * sizeof(int))) == NULL) {
+			exit_with_error("realloc failed", 2);
+		}
+		j = i + len - 1;
+		// Parse through possible crap at the end that isn't digits replacing it with NULL.
+		while (minfo[j] < 48 || minfo[j] > 57) {
+			minfo[j] = '\0';
+			--j;
+		}
+		// Parse through the last number.
+		while (minfo[j] >= 48 && minfo[j] <= 57) {
+			--j;
+		}
+		md->to[md->size] = atoi(&minfo[j + 1]);
+		// Parse until the first number, replacing all non-digits with NULL.
+		while (minfo[j] != ':') {
+			if (minfo[j] < 48 || minfo[j] > 57) {
+				minfo[j] = '\0';
+			}
+			--j;
+		}
+		md->from[md->size] = atoi(&minfo[j + 1]);
+		minfo[j] = '\0';
+		md->path[md->size] = str_malloc(strlen(&minfo[i]));
+		++i; // For some reason mergeinfo paths start with a slash, even though no other svn paths do.
+		strcpy(md->path[md->size], &minfo[i]);
+		i += len; // Step past the string and the NULL that terminates it.
+		++md->size;
+		++stats.mergeinfo_rows;
+	}
+	*size = i;
+	return md;
+}
+
+static mergeinfo* create_mergeinfo(mergeinfo *mi, char *minfo, int rev, int nod, int *mi_len) {
+	int orig;
+	int i = 0;
+	// Parse past newlines turned NULL, and "K 13" line...
+	while (minfo[i] == '\0' || minfo[i] == 'K' || minfo[i] == ' ' || minfo[i] == '1' || minfo[i] == '3') {
+		++i;
+	}
+	// Mismatch here means it's not a mergeinfo. Abort.
+	if (strcmp(&minfo[i], "svn:mergeinfo") != 0) {
+		return mi;
+	}
+	i += 14; // 13 chars + NULL
+	// Empty value == Abort. Why does svn even add this kind of manure to the dump file?
+	if (strcmp(&minfo[i], "V 0") == 0) {
+		return mi;
+	}
+	// Otherwise go past the "V (whatever)" line...
+	while (minfo[i] != '\0') {
+		++i;
+	}
+	++i;
+	if ((mi = (mergeinfo*)realloc(mi, (*mi_len + 1) * sizeof(mergeinfo))) == NULL) {
+		exit_with_error("realloc failed", 2);
+	}
+	mi[*mi_len].data = add_mergedata(&minfo[i], &orig);
+	mi[*mi_len].revision = rev;
+	mi[*mi_len].node = nod;
+	mi[*mi_len].orig_size = i + orig + 9; // "PROPS-END"
+	++*mi_len;
+	return mi;
+}
+
+// Returns the number of bytes the final row will have, including newline.
+static int get_mergerow_size(mergedata *data, int *numbers, char *redefined_root, int row) {
+	int to, from;
+	int size = 0;
+	to = get_new_revision_number(numbers, data->to[row]);
+	from = get_new_revision_number(numbers, data->from[row]);
+	if (to == from) {
+		size += num_len(to) + 1; // ":XXX"
+	}
+	else {
+		size += num_len(to) + num_len(from) + 2; // ":XXX-YYY"
+	}
+	if (redefined_root) {
+		size += strlen(reduce_path(redefined_root, data->path[row])) + 2; // "/...\n"
+	}
+	else {
+		size += strlen(data->path[row]) + 2; // "/...\n"
+	}
+	return size;
+}
+
+static void write_mergeinfo(FILE *outfile, mergedata *data, int *numbers, char *redefined_root, int orig_size, off_t con_len, off_t pcon_len) {
+	int i, v_size, diff, to, from;
+	int size = 0;
+	char *temp;
+	for (i = 0; i < data->size; ++i) {
+		size += get_mergerow_size(data, numbers, redefined_root, i);
+	}
+	v_size = size - 1; // The last (first?) newline doesn't count towards value length.
+	size += num_len(v_size) + 3; // "V XXX\n"
+	size += 30; // "\nK 13\nsvn:mergeinfo\n"  ... "\nPROPS-END"
+	diff = orig_size - size;
+	fprintf(outfile, "Prop-content-length: %d\nContent-length: %d\n\nK 13\nsvn:mergeinfo\nV %d\n",
+					(int)pcon_len - diff, (int)con_len - diff, v_size);
+	for (i = 0; i < data->size; ++i) {
+		to = get_new_revision_number(numbers, data->to[i]);
+		from = get_new_revision_number(numbers, data->from[i]);
+		if (redefined_root) {
+			temp = reduce_path(redefined_root, data->path[i]);
+		}
+		else {
+			temp = data->path[i];
+		}
+		if (to == from) {
+			fprintf(outfile, "/%s:%d\n", temp, to);
+		}
+		else {
+			fprintf(outfile, "/%s:%d-%d\n", temp, from, to);
+		}
+	}
+}
+
+/*******************************************************************************
+ *
+ * Analysis functions
+ *
+ ******************************************************************************/
+
+// Puts the wanted status of every node back to how it was after reading the metadata,
+// i.e. unwanted, so that the analysis can be run again with another filter.
+static void reset_wanted(revision *revisions, int rev_len) {
+	int i;
+	for (i = 0; i < pool.block_len; ++i) {
+		memset(pool.blocks[i].wanted, 0, NODE_BLOCK_SIZE / 8);
+	}
+	for (i = 0; i < rev_len; ++i) {
+		revisions[i].number = i;
+	}
+}
+
+static void mark_wanted(revision *revisions, int rev_len, filter *f, progress *prog) {
+	int i, j;
+	int threads = get_threads();
+	node_stack seeds = {NULL, 0, 0};
+	node_stack *pending = threads > 1 ? &seeds : NULL;
+	// Include strategy
+	if (f->include) {
+		start_phase(prog, "Marking", rev_len - 1);
+		for (i = rev_len - 1; i > 0; --i) {
+			update_progress(prog, rev_len - i, -1);
+			for (j = 0; j < revisions[i].size; ++j) {
+				if (is_cluded(node_path(revisions[i].first + j), f->include, f->inc_slash, f->inc_len)) {
+					add_seed(pending, revisions[i].first + j);
+				}
+			}
+			for (j = 0; j < revisions[i].fake_size; ++j) {
+				if (is_cluded(node_path(get_fake(&revisions[i], j)), f->include, f->inc_slash, f->inc_len)) {
+					add_seed(pending, get_fake(&revisions[i], j));
+				}
+			}
+		}
+	}
+	// Exclude strategy. Everything but the excludes is a seed.
+	else {
+		start_phase(prog, "Marking", 2 * (rev_len - 1));
+		for (i = rev_len - 1; i > 0; --i) {
+			update_progress(prog, rev_len - i, -1);
+			for (j = 0; j < revisions[i].size; ++j) {
+				if (!is_cluded(node_path(revisions[i].first + j), f->exclude, f->exc_slash, f->exc_len)) {
+					add_seed(pending, revisions[i].first + j);
+				}
+			}
+		}
+		for (i = rev_len - 1; i > 0; --i) {
+			update_progress(prog, 2 * rev_len - 1 - i, -1);
+			for (j = 0; j < revisions[i].fake_size; ++j) {
+				if (!is_cluded(node_path(get_fake(&revisions[i], j)), f->exclude, f->exc_slash, f->exc_len)) {
+					add_seed(pending, get_fake(&revisions[i], j));
+				}
+			}
+		}
+	}
+	if (seeds.len > 0) {
+		mark_seeds(&seeds, threads);
+	}
+	free(seeds.nodes);
+	end_phase(prog);
+}
+
+// Restore wanted delete nodes
+static void restore_deletes(repotree *rt, revision *revisions, int rev_len, progress *prog) {
+	int i, j;
+	node_id n;
+	start_phase(prog, "Restoring deletes", rev_len);
+	for (i = 0; i < rev_len; ++i) {
+		update_progress(prog, i + 1, -1);
+		for (j = 0; j < revisions[i].size; ++j) {
+			n = revisions[i].first + j;
+			if (node_action(n) == DELETE && !is_wanted(n)) {
+				restore_delete_node_if_needed(rt, n);
+			}
+		}
+	}
+	end_phase(prog);
+}
+
+// Renumber the revisions, so that the empty ones can be dropped
+static void drop_empty_revisions(revision *revisions, int rev_len) {
+	int i, j, empty;
+	int new_number = 1;
+	revisions[0].number = 0; // Revision 0 is special, and should never be dropped.
+	for (i = 1; i < rev_len; ++i) {
+		empty = 1;
+		for (j = 0; j < revisions[i].size; ++j) {
+			if (is_wanted(revisions[i].first + j)) {
+				empty = 0;
+				break;
+			}
+		}
+		if (empty) {
+			revisions[i].number = -1;
+		}
+		else {
+			revisions[i].number = new_number;
+			++new_number;
+		}
+	}
+}
+
+// Remove any directory entries that should no longer exist with the redefined root.
+// Should the redefining turn out to be impossible, the filter's redefined root is removed.
+static void redefine_root(repotree *rt, revision *revisions, int rev_len, filter *f, progress *prog) {
+	int i, j, k;
+	int rollback_len = 0;
+	char *temp_str;
+	node_id n;
+	node_id *redef_rollback = NULL;
+	start_phase(prog, "Redefining root", 2 * rev_len);
+	// First check whether the redefining even has a chance to succeed.
+	for (i = 0; i < rev_len; ++i) {
+		update_progress(prog, i + 1, -1);
+		for (j = 0; j < revisions[i].size; ++j) {
+			n = revisions[i].first + j;
+			if (node_copyfrom(n) && is_wanted(n)) {
+				// If we're trying to copy the (new) root directory itself from somewhere, it won't work.
+				if (strcmp(node_path(n), f->redefined_root) == 0) {
+					end_phase(prog);
+					fprintf(stderr, "WARNING: Detected move operation of the redefined root directory.\n         Redefine operation will not be performed.\n");
+					f->redefined_root = NULL;
+					return;
+				}
+				// If we have a redefined root of "trunk/foo", and then try to do a copyfrom
+				// operation from "trunk", we're pretty much doomed...
+				temp_str = reduce_path(f->redefined_root, node_copyfrom(n));
+				if (strcmp(temp_str, "") == 0 && strcmp(f->redefined_root, node_copyfrom(n)) != 0) {
+					end_phase(prog);
+					fprintf(stderr, "WARNING: Critical files detected upstream of redefined root.\n         Redefine operation will not be performed.\n");
+					f->redefined_root = NULL;
+					return;
+				}
+			}
+		}
+	}
+	for (i = rev_len - 1; i >= 0; --i) {
+		update_progress(prog, 2 * rev_len - i, -1);
+		for (j = revisions[i].size - 1; j >= 0; --j) {
+			n = revisions[i].first + j;
+			if (is_wanted(n)) {
+				temp_str = add_slash_to(f->redefined_root);
+				for (k = strlen(temp_str) - 1; k > 0; --k) {
+					if (temp_str[k] == '/') {
+						temp_str[k] = '\0';
+						if (strcmp(temp_str, node_path(n)) == 0) {
+							if (is_wanted(n)) {
+								if ((redef_rollback = (node_id*)realloc(redef_rollback, (rollback_len + 1) * sizeof(node_id))) == NULL) {
+									exit_with_error("realloc failed", 2);
+								}
+								redef_rollback[rollback_len] = n;
+								++rollback_len;
+							}
+							set_wanted_bit(n, 0);
+						}
+					}
+				}
+				free(temp_str);
+			}
+		}
+	}
+	end_phase(prog);
+	// Check that there are no collisions, roll back if there are.
+	if (has_redefine_collisions(rt, rt, f->redefined_root)) {
+		fprintf(stderr, "WARNING: File collisions detected with redefined root.\n         Redefine operation will not be performed.\n");
+		f->redefined_root = NULL;
+		for (i = 0; i < rollback_len; ++i) {
+			set_wanted_bit(redef_rollback[i], 1);
+		}
+	}
+	free(redef_rollback);
+}
+
+// A set of paths, for finding out whether any parent directory of a path is in it.
+typedef struct {
+	char **paths;
+	int size; // A power of 2, or 0
+	int len;
+} path_set;
+
+// Returns 1 if the first len chars of path are in the set.
+static int has_path(path_set *s, const char *path, size_t len) {
+	unsigned int i;
+	if (s->len == 0) {
+		return 0;
+	}
+	for (i = hash_path(path, len) & (s->size - 1); s->paths[i]; i = (i + 1) & (s->size - 1)) {
+		if (strncmp(s->paths[i], path, len) == 0 && s->paths[i][len] == '\0') {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static void add_to_path_set(path_set *s, char *path) {
+	char **old = s->paths;
+	int i, old_size = s->size;
+	unsigned int j;
+	// Keep at most half of the slots in use.
+	if (2 * (s->len + 1) > s->size) {
+		s->size = s->size ? 2 * s->size : 64;
+		if ((s->paths = (char**)calloc(s->size, sizeof(char*))) == NULL) {
+			exit_with_error("calloc failed", 2);
+		}
+		s->len = 0;
+		for (i = 0; i < old_size; ++i) {
+			if (old[i]) {
+				add_to_path_set(s, old[i]);
+			}
+		}
+		free(old);
+	}
+	for (j = hash_path(path, strlen(path)) & (s->size - 1); s->paths[j]; j = (j + 1) & (s->size - 1)) {}
+	s->paths[j] = path;
+	++s->len;
+}
+
+// Returns 1 if a parent directory of the path is in the set.
+static int has_parent_in(path_set *s, char *path) {
+	int i;
+	for (i = 0; path[i] != '\0' && s->len > 0; ++i) {
+		if (path[i] == '/' && has_path(s, path, i)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// Returns 1 if the path is a parent directory of an included path.
+static int is_parent_of_included(char *path, filter *f) {
+	int i;
+	size_t len = strlen(path);
+	for (i = 0; i < f->inc_len; ++i) {
+		if (strncmp(f->include[i], path, len) == 0 && f->include[i][len] == '/') {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// Finds the deletes under one level of the repotree. The wanted paths at the level are gone
+// through before the levels below them, in the same order get_relevant_nodes_at_revision would
+// list them, so the deletes come out in the same order. Nothing below a path that is deleted
+// needs to be looked at. A path can also have a parent directory elsewhere in the tree, if it
+// was added before its parent, so the deletes found so far are checked as well.
+static void find_deletes(repotree *rt, int rev, filter *f, path_set *deleted, char ***to_delete, int *del_len) {
+	int i;
+	node_id n;
+	char *path;
+	for (i = 0; i < rt->chi_len; ++i) {
+		n = get_node_at(rt->children[i].map, rev, rt->children[i].map_len, 1);
+		if (n == NO_NODE || node_action(n) == DELETE) {
+			continue;
+		}
+		path = node_path(n);
+		if (f->include ? is_cluded(path, f->include, f->inc_slash, f->inc_len) || is_parent_of_included(path, f) : !is_cluded(path, f->exclude, f->exc_slash, f->exc_len)) {
+			continue;
+		}
+		if (!has_parent_in(deleted, path)) {
+			if ((*to_delete = (char**)realloc(*to_delete, (*del_len + 1) * sizeof(char*))) == NULL) {
+				exit_with_error("realloc failed", 2);
+			}
+			(*to_delete)[*del_len] = path;
+			++*del_len;
+			add_to_path_set(deleted, path);
+		}
+	}
+	for (i = 0; i < rt->chi_len; ++i) {
+		n = get_node_at(rt->children[i].map, rev, rt->children[i].map_len, 1);
+		if (n != NO_NODE && node_action(n) != DELETE && !has_path(deleted, node_path(n), strlen(node_path(n)))) {
+			find_deletes(&rt->children[i], rev, f, deleted, to_delete, del_len);
+		}
+	}
+}
+
+// Returns the paths a deleting revision at the end should remove, i.e. the stuff that had to
+// be kept due to dependencies, but resides where the user didn't want it. The number of paths
+// will be "returned" through the "del_len" pointer.
+static char** get_deletes(repotree *rt, int rev_len, filter *f, int *del_len) {
+	char **to_delete = NULL;
+	path_set deleted = {NULL, 0, 0};
+	*del_len = 0;
+	find_deletes(rt, rev_len, f, &deleted, &to_delete, del_len);
+	free(deleted.paths);
+	return to_delete;
+}
+
+// Stores the result of the analysis in the output, which frees the nodes for another analysis.
+static void save_analysis(output *out, revision *revisions, int rev_len) {
+	int i, j;
+	int n = 0;
+	for (i = 0; i < rev_len; ++i) {
+		n += revisions[i].size;
+	}
+	if ((out->wanted = (unsigned char*)calloc(n / 8 + 1, 1)) == NULL) {
+		exit_with_error("calloc failed", 2);
+	}
+	if ((out->numbers = (int*)malloc((rev_len + 1) * sizeof(int))) == NULL) {
+		exit_with_error("malloc failed", 2);
+	}
+	n = 0;
+	for (i = 0; i < rev_len; ++i) {
+		for (j = 0; j < revisions[i].size; ++j) {
+			if (is_wanted(revisions[i].first + j)) {
+				out->wanted[n / 8] |= 1 << (n % 8);
+			}
+			++n;
+		}
+		out->numbers[i] = revisions[i].number;
+	}
+}
+
+// The directories above the included paths, that aren't included themselves.
+typedef struct {
+	char **paths;
+	node_id *adds; // The last plain add of each
+	int *add_len; // How many plain adds each has
+	char *needed; // Whether something included below it is added
+	int len;
+} boundary;
+
+// Returns the index of the path among the directories, or -1.
+static int get_boundary_dir(boundary *b, char *path) {
+	int i;
+	for (i = 0; i < b->len; ++i) {
+		if (strcmp(b->paths[i], path) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+static void init_boundary(boundary *b, filter *f) {
+	int i;
+	size_t j;
+	char *path;
+	b->paths = NULL;
+	b->len = 0;
+	for (i = 0; i < f->inc_len; ++i) {
+		for (j = 0; f->include[i][j] != '\0'; ++j) {
+			if (f->include[i][j] != '/') {
+				continue;
+			}
+			path = str_malloc(j + 1);
+			memcpy(path, f->include[i], j);
+			path[j] = '\0';
+			if (is_cluded(path, f->include, f->inc_slash, f->inc_len) || get_boundary_dir(b, path) >= 0) {
+				free(path);
+				continue;
+			}
+			if ((b->paths = (char**)realloc(b->paths, (b->len + 1) * sizeof(char*))) == NULL) {
+				exit_with_error("realloc failed", 2);
+			}
+			b->paths[b->len] = path;
+			++b->len;
+		}
+	}
+	if ((b->adds = (node_id*)calloc(b->len + 1, sizeof(node_id))) == NULL || (b->add_len = (int*)calloc(b->len + 1, sizeof(int))) == NULL || (b->needed = (char*)calloc(b->len + 1, 1)) == NULL) {
+		exit_with_error("calloc failed", 2);
+	}
+}
+
+// Notes that the included path is added, so the directories above it have to be kept.
+static void add_below_boundary(boundary *b, char *path) {
+	int i;
+	size_t len;
+	for (i = 0; i < b->len; ++i) {
+		len = strlen(b->paths[i]);
+		if (strncmp(path, b->paths[i], len) == 0 && path[len] == '/') {
+			b->needed[i] = 1;
+		}
+	}
+}
+
+static void free_boundary(boundary *b) {
+	int i;
+	for (i = 0; i < b->len; ++i) {
+		free(b->paths[i]);
+	}
+	free(b->paths);
+	free(b->adds);
+	free(b->add_len);
+	free(b->needed);
+}
+
+// Returns 1 if the filter only includes paths, without a new root. Only such a filter can
+// stay inside the boundary of what it includes.
+static int is_prefix_filter(filter *f) {
+	return f->include != NULL && f->redefined_root == NULL;
+}
+
+// Goes through the nodes of revision i for an include filter without a new root, and the
+// mergeinfo of the revision, which starts at *act_mi. Collects what's added in the directories
+// above the included paths. Returns 1 if anything crosses the boundary of what is included: a
+// copy into the included paths from outside them, mergeinfo in them that refers outside them,
+// or anything in the directories above them but plain adds, and changes without mergeinfo. A
+// directory that has to be kept, but is added more than once, crosses it too.
+static int crosses_at_revision(revision *revisions, int i, mergeinfo *mi, int mi_len, int *act_mi, filter *f, boundary *b) {
+	int j, k;
+	node_id n;
+	char *path, *copyfrom;
+	char action;
+	if (i == 0) {
+		return revisions[0].size > 0;
+	}
+	for (j = 0; j < revisions[i].size; ++j) {
+		n = revisions[i].first + j;
+		path = node_path(n);
+		copyfrom = node_copyfrom(n);
+		action = node_action(n);
+		if (is_cluded(path, f->include, f->inc_slash, f->inc_len)) {
+			if (copyfrom && !is_cluded(copyfrom, f->include, f->inc_slash, f->inc_len)) {
+				return 1;
+			}
+			if (action == ADD) {
+				add_below_boundary(b, path);
+			}
+		}
+		else if (path[0] == '\0') {
+			if (action != CHANGE) {
+				return 1;
+			}
+		}
+		else if ((k = get_boundary_dir(b, path)) >= 0) {
+			if (copyfrom || (action != ADD && action != CHANGE)) {
+				return 1;
+			}
+			if (action == ADD) {
+				b->adds[k] = n;
+				++b->add_len[k];
+			}
+		}
+	}
+	for (k = 0; k < b->len; ++k) {
+		if (b->needed[k] && b->add_len[k] > 1) {
+			return 1;
+		}
+	}
+	for (; *act_mi < mi_len && mi[*act_mi].revision == i; ++*act_mi) {
+		path = node_path(revisions[i].first + mi[*act_mi].node);
+		if (!is_cluded(path, f->include, f->inc_slash, f->inc_len)) {
+			if (path[0] == '\0' || get_boundary_dir(b, path) >= 0) {
+				return 1;
+			}
+			continue;
+		}
+		for (j = 0; j < mi[*act_mi].data->size; ++j) {
+			if (!is_cluded(mi[*act_mi].data->path[j], f->include, f->inc_slash, f->inc_len)) {
+				return 1;
+			}
+		}
+	}
+	return 0;
+}
+
+// Returns 1 if a directory that has to be kept was never added, once all the revisions have
+// been through crosses_at_revision without crossing.
+static int crosses_at_end(boundary *b) {
+	int i;
+	for (i = 0; i < b->len; ++i) {
+		if (b->needed[i] && b->add_len[i] == 0) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// Returns 1 if the filter crosses the boundary of what it includes anywhere in the dump, see
+// crosses_at_revision, and collects the adds of the directories above the included paths on
+// the way. If it doesn't, the dependencies would want nothing but the included nodes and those
+// adds, which mark_prefix marks without them.
+static int crosses_boundary(revision *revisions, int rev_len, mergeinfo *mi, int mi_len, filter *f, boundary *b) {
+	int i;
+	int act_mi = 0;
+	if (!is_prefix_filter(f)) {
+		return 1;
+	}
+	for (i = 0; i < rev_len; ++i) {
+		if (crosses_at_revision(revisions, i, mi, mi_len, &act_mi, f, b)) {
+			return 1;
+		}
+	}
+	return crosses_at_end(b);
+}
+
+// Finds out which outputs cross the boundary of what they include while the dump is being
+// read, a revision at a time. Once one does, the dependencies have to be built, but the ones
+// that don't can still do without them.
+typedef struct {
+	output *outs;
+	int out_len;
+	boundary *b;
+	int *act_mi;
+	int crossing; // The number of outputs that cross
+	int analyzed; // The number of revisions analyzed, by read_and_analyze
+} boundary_check;
+
+static void init_boundary_check(boundary_check *c, output *outs, int out_len) {
+	int o;
+	c->outs = outs;
+	c->out_len = out_len;
+	c->crossing = 0;
+	c->analyzed = 0;
+	if ((c->b = (boundary*)malloc((out_len + 1) * sizeof(boundary))) == NULL || (c->act_mi = (int*)calloc(out_len + 1, sizeof(int))) == NULL) {
+		exit_with_error("malloc failed", 2);
+	}
+	for (o = 0; o < out_len; ++o) {
+		init_boundary(&c->b[o], &outs[o].filt);
+		outs[o].crosses = !is_prefix_filter(&outs[o].filt);
+		c->crossing += outs[o].crosses;
+	}
+}
+
+// Looks at revision i for the outputs that haven't crossed yet. Returns the number of
+// outputs that cross.
+static int check_boundaries(boundary_check *c, model *m, int i) {
+	int o;
+	for (o = 0; o < c->out_len && c->crossing < c->out_len; ++o) {
+		if (!c->outs[o].crosses && crosses_at_revision(m->revisions, i, m->mi, m->mi_len, &c->act_mi[o], &c->outs[o].filt, &c->b[o])) {
+			c->outs[o].crosses = 1;
+			++c->crossing;
+		}
+	}
+	return c->crossing;
+}
+
+// Finishes the check after the last revision. Returns the number of outputs that cross.
+static int finish_boundary_check(boundary_check *c) {
+	int o;
+	for (o = 0; o < c->out_len; ++o) {
+		if (!c->outs[o].crosses && crosses_at_end(&c->b[o])) {
+			c->outs[o].crosses = 1;
+			++c->crossing;
+		}
+		free_boundary(&c->b[o]);
+	}
+	free(c->b);
+	free(c->act_mi);
+	return c->crossing;
+}
+
+// Marks what a filter that doesn't cross the boundary of what it includes wants.
+static void mark_prefix(revision *revisions, int rev_len, filter *f, boundary *b, progress *prog) {
+	int i, j;
+	node_id n;
+	start_phase(prog, "Marking", rev_len - 1);
+	reset_wanted(revisions, rev_len);
+	for (i = 1; i < rev_len; ++i) {
+		update_progress(prog, i, -1);
+		for (j = 0; j < revisions[i].size; ++j) {
+			n = revisions[i].first + j;
+			set_wanted_bit(n, is_cluded(node_path(n), f->include, f->inc_slash, f->inc_len));
+		}
+	}
+	for (i = 0; i < b->len; ++i) {
+		if (b->needed[i]) {
+			set_wanted_bit(b->adds[i], 1);
+		}
+	}
+	end_phase(prog);
+}
+
+/*******************************************************************************
+ *
+ * Model
+ *
+ ******************************************************************************/
+
+static void init_model(model *m, input *infile) {
+	m->infile = infile;
+	m->rev_len = 0;
+	m->rev_max = 10;
+	if ((m->revisions = (revision*)malloc(m->rev_max * sizeof(revision))) == NULL) {
+		exit_with_error("malloc failed", 2);
+	}
+	m->rt.children = NULL;
+	m->rt.path = NULL;
+	m->rt.map = NULL;
+	m->rt.chi_len = 0;
+	m->rt.map_len = 0;
+	m->mi = NULL;
+	m->mi_len = 0;
+	m->content_sizes = NULL;
+	m->shallow = 0;
+}
+
+// Starts reading the metadata of the dump. Only the headers of the nodes are kept, and the
+// properties of directories, which may contain mergeinfo. With record_sizes, the
+// Content-length of every node is kept as well.
+static void init_reader(reader *r, input *infile, int record_sizes) {
+	r->infile = infile;
+	r->line_max = 80;
+	if ((r->line = (char*)calloc(r->line_max, 1)) == NULL) {
+		exit_with_error("calloc failed", 2);
+	}
+	r->rev = -1;
+	r->started = 0;
+	r->start = 0;
+	r->plain = 1;
+	r->is_dir = 0;
+	r->nodes = NULL;
+	r->size = 0;
+	r->max = 0;
+	r->mi = NULL;
+	r->mi_len = 0;
+	r->record_sizes = record_sizes;
+	r->content_sizes = NULL;
+	r->node_total = 0;
+	r->size_max = 0;
+}
+
+// Hands the revision read so far over to p.
+static void take_revision(reader *r, parsed_revision *p) {
+	p->nodes = r->nodes;
+	p->size = r->size;
+	p->mi = r->mi;
+	p->mi_len = r->mi_len;
+	p->start = r->start;
+	p->position = input_tell(r->infile);
+	p->plain = r->plain;
+	r->nodes = NULL;
+	r->size = 0;
+	r->max = 0;
+	r->mi = NULL;
+	r->mi_len = 0;
+}
+
+// Reads the next revision of the dump. Returns 0 once there are no more.
+static int read_revision(reader *r, parsed_revision *p) {
+	int ch, i, plain;
+	int cur_len = 0;
+	int reading_node = 0;
+	off_t offset, start;
+	char *minfo;
+	char *current_line = r->line;
+	input *infile = r->infile;
+	parsed_node *current_node = NULL;
+	while ((ch = input_getc(infile)) != EOF) {
+		// Once we reach a newline character we need to analyze the data.
+		if (ch == NEWLINE) {
+			// Data inside nodes needs special treatment.
+			if (reading_node) {
+				current_node = &r->nodes[r->size - 1];
+				// An empty line while reading a node, means the node stops here.
+				if (strlen(current_line) == 0) {
+					reading_node = 0;
+				}
+				// A line starting with "Content-lenth: " means that the content
+				// of the node is the only thing left of it.
+				else if (starts_with(current_line, "Content-length: ")) {
+					offset = (off_t)atol(&current_line[16]) + CONTENT_PADDING;
+					if (r->record_sizes) {
+						r->content_sizes[r->node_total - 1] = offset - CONTENT_PADDING;
+					}
+					if (r->is_dir && offset > 10 + CONTENT_PADDING) {
+						minfo = str_malloc(offset + 1);
+						i = 0;
+						while ((ch = input_getc(infile)) != EOF && i < offset) {
+							// NULL instead of newline means needed string operations are easier later.
+							if (ch == NEWLINE) {
+								minfo[i] = '\0';
+							}
+							else {
+								minfo[i] = ch;
+							}
+							++i;
+						}
+						minfo[i] = '\0';
+						r->mi = create_mergeinfo(r->mi, minfo, r->rev, r->size - 1, &r->mi_len);
+						free(minfo);
+					}
+					else {
+						input_skip(infile, offset);
+					}
+					reading_node = 0;
+				}
+				else if (starts_with(current_line, "Node-action: ")) {
+					if (strcmp(&current_line[13], "add") == 0) {
+						current_node->action = ADD;
+					}
+					else if (strcmp(&current_line[13], "delete") == 0) {
+						current_node->action = DELETE;
+					}
+					else if (strcmp(&current_line[13], "change") == 0) {
+						current_node->action = CHANGE;
+					}
+					else {
+						current_node->action = REPLACE;
+					}
+				}
+				else if (starts_with(current_line, "Node-kind: ")) {
+					r->is_dir = !strcmp(&current_line[11], "dir"); // Keep this info for now in case we need to analyze mergeinfo
+				}
+				else if (starts_with(current_line, "Node-copyfrom-path: ")) {
+					current_node->copyfrom = str_malloc(strlen(&current_line[19]));
+					strcpy(current_node->copyfrom, &current_line[20]);
+				}
+				else if (starts_with(current_line, "Node-copyfrom-rev: ")) {
+					current_node->copyfrom_rev = atoi(&current_line[19]);
+					if (current_node->copyfrom_rev < 0 || current_node->copyfrom_rev >= r->rev || !is_plain_number(&current_line[19], current_node->copyfrom_rev)) {
+						r->plain = 0;
+					}
+				}
+			} // End of "if (reading_node)"
+			else if (starts_with(current_line, "Node-path: ")) {
+				// The nodes are collected here, and moved to the node pool once the revision is done.
+				if (r->size == r->max) {
+					r->max += INCREMENT;
+					if ((r->nodes = (parsed_node*)realloc(r->nodes, r->max * sizeof(parsed_node))) == NULL) {
+						exit_with_error("realloc failed", 2);
+					}
+				}
+				current_node = &r->nodes[r->size++];
+				current_node->path = str_malloc(strlen(&current_line[10]));
+				strcpy(current_node->path, &current_line[11]);
+				current_node->copyfrom = NULL;
+				current_node->copyfrom_rev = 0;
+				current_node->action = 0;
+				reading_node = 1;
+				if (r->record_sizes) {
+					if (r->node_total == r->size_max) {
+						r->size_max = r->size_max ? 2 * r->size_max : 1024;
+						if ((r->content_sizes = (off_t*)realloc(r->content_sizes, r->size_max * sizeof(off_t))) == NULL) {
+							exit_with_error("realloc failed", 2);
+						}
+					}
+					r->content_sizes[r->node_total] = 0;
+				}
+				++r->node_total;
+			}
+			else if (starts_with(current_line,"Revision-number: ")) {
+				start = input_tell(infile) - cur_len - 1;
+				++r->rev;
+				plain = is_plain_number(&current_line[17], r->rev);
+				current_line[0] = '\0';
+				if (r->started) {
+					take_revision(r, p);
+					r->start = start;
+					r->plain = plain;
+					return 1;
+				}
+				r->started = 1;
+				r->start = start;
+				r->plain = plain;
+			}
+			current_line[0] = '\0';
+			cur_len = 0;
+		} // End of "if (ch != NEWLINE)"
+		else {
+			if (cur_len == r->line_max - 1) {
+				r->line_max += INCREMENT;
+				if ((r->line = current_line = (char*)realloc(current_line, r->line_max)) == NULL) {
+					exit_with_error("realloc failed", 2);
+				}
+			}
+			current_line[cur_len] = ch;
+			++cur_len;
+			current_line[cur_len] = '\0';
+		}
+	 } // End of "while ((ch = input_getc(infile)) != EOF)"
+	if (r->started) {
+		r->started = 0;
+		take_revision(r, p);
+		return 1;
+	}
+	return 0;
+}
+
+// Frees the reader, and gives the Content-lengths to the model.
+static void finish_reader(reader *r, model *m) {
+	free(r->line);
+	free(r->nodes);
+	m->content_sizes = r->content_sizes;
+}
+
+static void free_mergedata(mergedata *data) {
+	int i;
+	for (i = 0; i < data->size; ++i) {
+		free(data->path[i]);
+	}
+	free(data->path);
+	free(data->from);
+	free(data->to);
+	free(data);
+}
+
+// Frees a revision that has been read, but won't be added to the model.
+static void free_parsed_revision(parsed_revision *p) {
+	int i;
+	for (i = 0; i < p->size; ++i) {
+		free(p->nodes[i].path);
+		free(p->nodes[i].copyfrom);
+	}
+	free(p->nodes);
+	for (i = 0; i < p->mi_len; ++i) {
+		free_mergedata(p->mi[i].data);
+	}
+	free(p->mi);
+}
+
+// Appends a revision that has been read to the model, and moves its nodes to the node pool.
+static void add_revision(model *m, parsed_revision *p, FILE *messages) {
+	int rev = m->rev_len;
+	int i;
+	if (rev == m->rev_max) {
+		m->rev_max += INCREMENT;
+		if ((m->revisions = (revision*)realloc(m->revisions, (m->rev_max * sizeof(revision)))) == NULL) {
+			exit_with_error("realloc failed", 2);
+		}
+	}
+	m->revisions[rev].first = 0;
+	m->revisions[rev].first_fake = 0;
+	m->revisions[rev].size = p->size;
+	m->revisions[rev].fake_size = 0;
+	m->revisions[rev].number = rev;
+	m->revisions[rev].offset = p->start;
+	m->revisions[rev].plain = p->plain;
+	store_revision_nodes(m->revisions, rev, p->nodes, messages);
+	free(p->nodes);
+	if (p->mi_len > 0) {
+		if ((m->mi = (mergeinfo*)realloc(m->mi, (m->mi_len + p->mi_len) * sizeof(mergeinfo))) == NULL) {
+			exit_with_error("realloc failed", 2);
+		}
+		for (i = 0; i < p->mi_len; ++i) {
+			m->mi[m->mi_len++] = p->mi[i];
+		}
+		free(p->mi);
+	}
+	m->rev_len = rev + 1;
+}
+
+// Reads the metadata of the whole dump into the model.
+static void read_dump(model *m, int record_sizes, progress *prog, FILE *messages) {
+	reader r;
+	parsed_revision p;
+	init_reader(&r, m->infile, record_sizes);
+	start_phase(prog, "Reading", 0);
+	while (read_revision(&r, &p)) {
+		add_revision(m, &p, messages);
+		update_progress(prog, m->rev_len, p.position);
+	}
+	update_progress(prog, m->rev_len - 1, input_tell(m->infile));
+	end_phase(prog);
+	finish_reader(&r, m);
+}
+
+// Creates the dependencies of the nodes in revision i, and the fake nodes for everything that
+// its copies and deletes affect implicitly. Only the revisions up to i need to be in the model.
+// act_mi is the next mergeinfo to deal with.
+static void analyze_revision(model *m, int i, int *act_mi, FILE *messages) {
+	int j, k, temp_int;
+	int merge = -1;
+	node_id n, fake;
+	node_id *id_ptr;
+	char *copyfrom;
+	char *fake_path = NULL;
+	size_t fake_max = 0;
+	repotree *subtree;
+	repotree *rt = &m->rt;
+	revision *revisions = m->revisions;
+	mergeinfo *mi = m->mi;
+	merge_sources ms;
+	if (mem.limit && !mem.spilling && i % MEMORY_CHECK_INTERVAL == 0 && is_over_memory_limit()) {
+		start_spilling(messages);
+	}
+	init_merge_sources(&ms);
+	for (j = 0; j < revisions[i].size; ++j) {
+		n = revisions[i].first + j;
+		copyfrom = node_copyfrom(n);
+		add_event(rt, n);
+		// Some add nodes need this...
+		if (node_action(n) == ADD) {
+			add_dir_dep_to_node(rt, n, i);
+			add_file_dep_to_node(rt, n);
+		}
+		if (*act_mi < m->mi_len && mi[*act_mi].revision == i && mi[*act_mi].node == j) {
+			merge = *act_mi;
+			++*act_mi;
+		}
+		if (merge >= 0) {
+			add_merge_deps_to_node(rt, &ms, &mi[merge], node_path(revisions[i].first + mi[merge].node), n);
+		}
+		// Copyfrom and delete events can affect entire subtrees. This is dealt with here.
+		if (copyfrom || node_action(n) == DELETE) {
+			if (copyfrom) {
+				subtree = get_subtree(rt, copyfrom, 1);
+				id_ptr = get_relevant_nodes_at_revision(subtree, node_copyfrom_rev(n), 0, &temp_int);
+			}
+			else {
+				subtree = get_subtree(rt, node_path(n), 1);
+				id_ptr = get_relevant_nodes_at_revision(subtree, i, 0, &temp_int);
+			}
+			if (temp_int == 0) {
+				continue;
+			}
+			if (copyfrom) {
+				stats.fakes_copy += temp_int;
+			}
+			else {
+				stats.fakes_delete += temp_int;
+			}
+			for (k = 0; k < temp_int; ++k) {
+				// Fakes are allocated one at a time, so the fakes of a revision get consecutive ids.
+				fake = alloc_nodes(1);
+				if (revisions[i].fake_size == 0) {
+					revisions[i].first_fake = fake;
+				}
+				// A fake made by a copy is a copy of the node it gets its file dependency on. Its
+				// path is only stored if it isn't in the path table already, e.g. from an earlier
+				// copy to the same place.
+				if (copyfrom) {
+					get_dir_after_copyfrom(node_path(n), node_path(id_ptr[k]), copyfrom, &fake_path, &fake_max);
+					init_node(fake, intern_path(fake_path), i, node_action(n) | NODE_FAKE | NODE_COPY);
+				}
+				else {
+					init_node(fake, node_path_id(id_ptr[k]), i, node_action(n) | NODE_FAKE);
+				}
+				add_event(rt, fake);
+				add_dependency(n, fake, DEP_SUBTREE); // Dependency on the node that affects the subtree
+				if (copyfrom) {
+					add_dependency(id_ptr[k], fake, DEP_FILE); // File dependency
+					add_dir_dep_to_node(rt, fake, i); // Dir dependency
+				}
+				++revisions[i].fake_size;
+			}
+			free(id_ptr);
+		}
+	}
+	free(fake_path);
+	free_merge_sources(&ms);
+}
+
+// Creates the dependencies between the nodes of the whole model. This is what makes the
+// model, and takes most of the time.
+static void build_dependencies(model *m, progress *prog, FILE *messages) {
+	int i;
+	int act_mi = 0;
+	start_phase(prog, "Analyzing", m->rev_len);
+	for (i = 0; i < m->rev_len; ++i) {
+		update_progress(prog, i + 1, -1);
+		analyze_revision(m, i, &act_mi, messages);
+	}
+	end_phase(prog);
+}
+
+#ifndef _WIN32
+// Reading a revision only depends on the dump, and analyzing it only on the revisions before
+// it, so the two can overlap: a thread reads revisions into a queue, while the analysis takes
+// them from the queue as they come. The model, the node pool and the progress are only
+// touched by the analysis.
+typedef struct {
+	reader *r;
+	parsed_revision items[PIPELINE_DEPTH];
+	int head;
+	int len;
+	int done;
+	int stopping; // The analysis failed, so nothing more is needed
+	thread_error err; // Reading failed, which ends the queue early
+	pthread_mutex_t lock;
+	pthread_cond_t not_empty;
+	pthread_cond_t not_full;
+} revision_queue;
+
+static void* read_revisions(void *arg) {
+	revision_queue *q = (revision_queue*)arg;
+	parsed_revision p;
+	int more, code;
+	jmp_buf jump;
+	if ((code = setjmp(jump)) != 0) {
+		keep_thread_error(&q->err, code);
+		pthread_mutex_lock(&q->lock);
+		q->done = 1;
+		pthread_cond_signal(&q->not_empty);
+		pthread_mutex_unlock(&q->lock);
+		return NULL;
+	}
+	error_jump = &jump;
+	do {
+		more = read_revision(q->r, &p);
+		pthread_mutex_lock(&q->lock);
+		while (q->len == PIPELINE_DEPTH && !q->stopping) {
+			pthread_cond_wait(&q->not_full, &q->lock);
+		}
+		if (q->stopping) {
+			pthread_mutex_unlock(&q->lock);
+			if (more) {
+				free_parsed_revision(&p);
+			}
+			return NULL;
+		}
+		if (more) {
+			q->items[(q->head + q->len) % PIPELINE_DEPTH] = p;
+			++q->len;
+		}
+		else {
+			q->done = 1;
+		}
+		pthread_cond_signal(&q->not_empty);
+		pthread_mutex_unlock(&q->lock);
+	} while (more);
+	return NULL;
+}
+
+// Stops the reading thread after the analysis has failed, and frees what it had read.
+static void stop_reading(revision_queue *q, pthread_t thread) {
+	pthread_mutex_lock(&q->lock);
+	q->stopping = 1;
+	pthread_cond_signal(&q->not_full);
+	pthread_mutex_unlock(&q->lock);
+	pthread_join(thread, NULL);
+	for (; q->len > 0; --q->len) {
+		free_parsed_revision(&q->items[q->head]);
+		q->head = (q->head + 1) % PIPELINE_DEPTH;
+	}
+}
+
+// Analyzes the revisions read since the last call.
+static void catch_up(model *m, boundary_check *c, int *act_mi, FILE *messages) {
+	for (; c->analyzed < m->rev_len; ++c->analyzed) {
+		analyze_revision(m, c->analyzed, act_mi, messages);
+	}
+}
+
+// Does the same as read_dump followed by build_dependencies, with the reading in a thread.
+// With a boundary check, the revisions are only analyzed once some output crosses its
+// boundary, and then the ones read before that catch up. If none does, the model is left
+// without the dependencies.
+static void read_and_analyze(model *m, int record_sizes, boundary_check *check, progress *prog, FILE *messages) {
+	reader r;
+	revision_queue q;
+	parsed_revision p;
+	pthread_t thread;
+	int act_mi = 0;
+	int code;
+	jmp_buf jump;
+	jmp_buf *caller = error_jump;
+	init_reader(&r, m->infile, record_sizes);
+	q.r = &r;
+	q.head = 0;
+	q.len = 0;
+	q.done = 0;
+	q.stopping = 0;
+	init_thread_error(&q.err);
+	if (pthread_mutex_init(&q.lock, NULL) != 0 || pthread_cond_init(&q.not_empty, NULL) != 0 || pthread_cond_init(&q.not_full, NULL) != 0) {
+		exit_with_error("pthread_mutex_init failed", 2);
+	}
+	if (pthread_create(&thread, NULL, read_revisions, &q) != 0) {
+		exit_with_error("pthread_create failed", 2);
+	}
+	// The reading thread must not be left waiting for room in the queue after an error here.
+	if ((code = setjmp(jump)) != 0) {
+		error_jump = caller;
+		stop_reading(&q, thread);
+		finish_reader(&r, m);
+		if (check) {
+			finish_boundary_check(check);
+		}
+		rethrow_error(code);
+	}
+	error_jump = &jump;
+	start_phase(prog, "Reading and analyzing", 0);
+	while (1) {
+		pthread_mutex_lock(&q.lock);
+		while (q.len == 0 && !q.done) {
+			pthread_cond_wait(&q.not_empty, &q.lock);
+		}
+		if (q.len == 0) {
+			pthread_mutex_unlock(&q.lock);
+			break;
+		}
+		p = q.items[q.head];
+		q.head = (q.head + 1) % PIPELINE_DEPTH;
+		--q.len;
+		pthread_cond_signal(&q.not_full);
+		pthread_mutex_unlock(&q.lock);
+		add_revision(m, &p, messages);
+		if (check == NULL) {
+			analyze_revision(m, m->rev_len - 1, &act_mi, messages);
+		}
+		else if (check_boundaries(check, m, m->rev_len - 1) > 0) {
+			catch_up(m, check, &act_mi, messages);
+		}
+		update_progress(prog, m->rev_len, p.position);
+	}
+	if (check) {
+		m->shallow = finish_boundary_check(check) == 0;
+		if (!m->shallow) {
+			catch_up(m, check, &act_mi, messages);
+		}
+	}
+	error_jump = caller;
+	pthread_join(thread, NULL);
+	pthread_mutex_destroy(&q.lock);
+	pthread_cond_destroy(&q.not_empty);
+	pthread_cond_destroy(&q.not_full);
+	if (has_thread_error(&q.err)) {
+		finish_reader(&r, m);
+		rethrow_thread_error(&q.err);
+	}
+	update_progress(prog, m->rev_len - 1, input_tell(m->infile));
+	end_phase(prog);
+	finish_reader(&r, m);
+}
+#endif
+
+// Reads the dump and builds the model, overlapping the two with a thread if more than one
+// thread may be used.
+static void load_dump(model *m, int record_sizes, progress *prog, FILE *messages) {
+#ifndef _WIN32
+	if (get_threads() > 1) {
+		read_and_analyze(m, record_sizes, NULL, prog, messages);
+		return;
+	}
+#endif
+	read_dump(m, record_sizes, prog, messages);
+	build_dependencies(m, prog, messages);
+}
+
+// Reads the dump like load_dump, but only builds the dependencies if some output needs them,
+// and notes in each output whether it does. An output whose filter doesn't cross the boundary
+// of what it includes can do without, see select_prefix. With threads the check is made while
+// reading, and the analysis starts as soon as some output crosses.
+static void load_dump_for(model *m, output *outs, int out_len, progress *prog, FILE *messages) {
+	int i;
+	int prefixes = 0;
+	boundary_check c;
+	for (i = 0; i < out_len; ++i) {
+		prefixes += is_prefix_filter(&outs[i].filt);
+	}
+	if (prefixes == 0) {
+		load_dump(m, 0, prog, messages);
+		return;
+	}
+#ifndef _WIN32
+	if (get_threads() > 1) {
+		init_boundary_check(&c, outs, out_len);
+		read_and_analyze(m, 0, &c, prog, messages);
+		return;
+	}
+#endif
+	read_dump(m, 0, prog, messages);
+	init_boundary_check(&c, outs, out_len);
+	start_phase(prog, "Checking boundaries", m->rev_len);
+	for (i = 0; i < m->rev_len && c.crossing < out_len; ++i) {
+		check_boundaries(&c, m, i);
+		update_progress(prog, i + 1, -1);
+	}
+	end_phase(prog);
+	if (finish_boundary_check(&c) > 0) {
+		build_dependencies(m, prog, messages);
+	}
+	else {
+		m->shallow = 1;
+	}
+}
+
+// Does what mark_output and finish_output do, for an output that doesn't cross the boundary
+// of what it includes, with or without the dependencies in the model. Nothing outside the
+// included paths is kept but the directories above them, so there is nothing to delete either.
+static void select_prefix(model *m, output *out, progress *prog) {
+	boundary b;
+	init_boundary(&b, &out->filt);
+	crosses_boundary(m->revisions, m->rev_len, m->mi, m->mi_len, &out->filt, &b);
+	mark_prefix(m->revisions, m->rev_len, &out->filt, &b, prog);
+	free_boundary(&b);
+	if (out->drop_empty) {
+		drop_empty_revisions(m->revisions, m->rev_len);
+	}
+	save_analysis(out, m->revisions, m->rev_len);
+}
+
+// Marks what the filter of the output wants, starting from a clean slate, so that a model
+// can be filtered any number of times.
+static void mark_output(model *m, output *out, progress *prog) {
+	reset_wanted(m->revisions, m->rev_len);
+	mark_wanted(m->revisions, m->rev_len, &out->filt, prog);
+}
+
+// The steps after marking that decide what is kept, in the order writing an output needs
+// them: the revisions are renumbered before redefining the root can empty any more of them.
+static void finish_wanted(repotree *rt, revision *revisions, int rev_len, filter *f, int drop_empty, progress *prog) {
+	restore_deletes(rt, revisions, rev_len, prog);
+	if (drop_empty) {
+		drop_empty_revisions(revisions, rev_len);
+	}
+	if (f->redefined_root) {
+		redefine_root(rt, revisions, rev_len, f, prog);
+	}
+}
+
+// Completes the analysis begun by mark_output, and saves the result in the output.
+static void finish_output(model *m, output *out, progress *prog) {
+	finish_wanted(&m->rt, m->revisions, m->rev_len, &out->filt, out->drop_empty, prog);
+	if (out->add_delete) {
+		out->to_delete = get_deletes(&m->rt, m->rev_len, &out->filt, &out->del_len);
+	}
+	save_analysis(out, m->revisions, m->rev_len);
+}
+
+static void free_model(model *m) {
+	int i;
+	free_pool();
+	free_paths();
+	// A model that failed to load may have lost its mergeinfo when growing it failed.
+	for (i = 0; i < m->mi_len && m->mi; ++i) {
+		free_mergedata(m->mi[i].data);
+	}
+	free(m->mi);
+	free_tree(&m->rt);
+	free(m->rt.children);
+	free_path_index(&merge_paths);
+	free_arena();
+	free(m->revisions);
+	free(m->content_sizes);
+	if (m->infile) {
+		close_input(m->infile);
+	}
+}
+
+// Lets the user ask why paths are wanted, after mark_output. Returns 0 if the user wants to
+// quit, 1 to go on with the writing.
+static int query_wanted(model *m, filter *filt) {
+	int i, j, k, temp_int, maxp_len;
+	char *why_file;
+	node_id n, fake;
+	node_id *node_ptr;
+	revision *revisions = m->revisions;
+	int rev_len = m->rev_len;
+	maxp_len = get_max_path_size(&m->rt) + 10;
+	why_file = str_malloc(maxp_len);
+	do {
+		printf("\nPlease enter the full (case sensitive) path name you wish to inquire about\n\"/quit\" will exit program, and \"/write\" proceed with writing the outfile:\n");
+		fgets (why_file, maxp_len, stdin);
+		i = 0;
+		while (why_file[i] != NEWLINE && why_file[i] != '\0') {
+			++i;
+		}
+		why_file[i] = '\0';
+		if (strcmp(why_file, "/quit") == 0) {
+			free(why_file);
+			return 0;
+		}
+		if (strcmp(why_file, "/write") == 0) {
+			free(why_file);
+			break;
+		}
+		node_ptr = NULL;
+		temp_int = -1;
+		for (i = 0; i < rev_len; ++i) {
+			for (j = 0; j < revisions[i].size; ++j) {
+				n = revisions[i].first + j;
+				if (is_wanted(n)) {
+					if (!node_ptr) {
+						if (strcmp(node_path(n), why_file) == 0) {
+							if ((node_ptr = (node_id*)malloc(sizeof(node_id))) == NULL) {
+								exit_with_error("malloc failed", 2);
+							}
+							++temp_int;
+							node_ptr[temp_int] = n;
+						}
+					}
+					else {
+						for (k = 0; k < node_dep_len(n); ++k) {
+							if (get_dep(n, k) == node_ptr[temp_int]) {
+								++temp_int;
+								if ((node_ptr = (node_id*)realloc(node_ptr, (temp_int + 1) * sizeof(node_id))) == NULL) {
+									exit_with_error("realloc failed", 2);
+								}
+								node_ptr[temp_int] = n;
+								break;
+							}
+						}
+					}
+				}
+			}
+			for (j = 0; j < revisions[i].fake_size; ++j) {
+				fake = get_fake(&revisions[i], j);
+				if (is_wanted(fake)) {
+					for (k = 0; k < node_dep_len(fake); ++k) {
+						if (node_ptr && get_dep(fake, k) == node_ptr[temp_int]) {
+							++temp_int;
+							if ((node_ptr = (node_id*)realloc(node_ptr, (temp_int + 1) * sizeof(node_id))) == NULL) {
+								exit_with_error("realloc failed", 2);
+							}
+							node_ptr[temp_int] = fake;
+							break;
+						}
+					}
+				}
+			}
+		}
+		print_why(node_ptr, filt->include, filt->inc_slash, filt->exclude, filt->exc_slash, why_file, temp_int, filt->inc_len, filt->exc_len);
+		free(node_ptr);
+	}	while (1);
+	return 1;
+}
+
+/*******************************************************************************
+ *
+ * Statistics
+ *
+ ******************************************************************************/
+
+// Walks the repotree, counting its entries and the bytes used by it and its paths.
+static void get_tree_stats(repotree *rt, long long *entries, long long *bytes, int *max_fan_out, int *max_map_len) {
+	int i;
+	*bytes += rt->chi_len * sizeof(repotree) + rt->map_len * sizeof(node_id);
+	*entries += rt->chi_len;
+	if (rt->chi_len > *max_fan_out) {
+		*max_fan_out = rt->chi_len;
+	}
+	if (rt->map_len > *max_map_len) {
+		*max_map_len = rt->map_len;
+	}
+	for (i = 0; i < rt->chi_len; ++i) {
+		get_tree_stats(&rt->children[i], entries, bytes, max_fan_out, max_map_len);
+	}
+}
+
+// Writes the --stats report as JSON. The byte counts are what has been requested from
+// malloc, excluding allocator overhead. Nodes and dependencies are counted by the blocks
+// allocated for them. Since none of the structures shrink before cleanup, they are also
+// the peak sizes.
+static void write_stats(FILE *f, repotree *rt, revision *revisions, int rev_len, int rev_max, mergeinfo *mi, int mi_len, output *outs, int out_len) {
+	int i, j;
+	int max_fan_out = 0;
+	int max_map_len = 0;
+	long long nodes = 0;
+	long long entries = 0;
+	long long tree_bytes = 0;
+	long long path_bytes = node_paths.bytes + (long long)node_paths.max * sizeof(char*) + (long long)node_paths.size * sizeof(path_id);
+	long long mi_bytes = 0;
+	long long out_bytes = 0;
+	long long index_bytes = (long long)merge_paths.size * sizeof(indexed_path);
+	unsigned int k;
+	get_tree_stats(rt, &entries, &tree_bytes, &max_fan_out, &max_map_len);
+	for (i = 0; i < rev_len; ++i) {
+		nodes += revisions[i].size;
+	}
+	mi_bytes = mi_len * sizeof(mergeinfo);
+	for (i = 0; i < mi_len; ++i) {
+		mi_bytes += sizeof(mergedata) + mi[i].data->size * (sizeof(char*) + 2 * sizeof(int));
+		for (j = 0; j < mi[i].data->size; ++j) {
+			mi_bytes += strlen(mi[i].data->path[j]) + 1;
+		}
+	}
+	for (k = 0; k < merge_paths.size; ++k) {
+		if (merge_paths.slots[k].path) {
+			index_bytes += strlen(merge_paths.slots[k].path) + 1 + merge_paths.slots[k].depth * sizeof(int);
+		}
+	}
+	for (i = 0; i < out_len; ++i) {
+		if (outs[i].wanted) {
+			out_bytes += nodes / 8 + 1 + (rev_len + 1) * sizeof(int);
+		}
+	}
+	fprintf(f, "{\n");
+	fprintf(f, "  \"revisions\": %d,\n", rev_len);
+	fprintf(f, "  \"nodes\": %lld,\n", nodes);
+	fprintf(f, "  \"fakes\": {\"copyfrom\": %lld, \"delete\": %lld},\n", stats.fakes_copy, stats.fakes_delete);
+	fprintf(f, "  \"dependencies\": {\"history\": %lld, \"dir\": %lld, \"file\": %lld, \"merge\": %lld, \"subtree\": %lld},\n",
+			stats.deps[DEP_HISTORY], stats.deps[DEP_DIR], stats.deps[DEP_FILE], stats.deps[DEP_MERGE], stats.deps[DEP_SUBTREE]);
+	fprintf(f, "  \"repotree\": {\"entries\": %lld, \"max_fan_out\": %d, \"max_map_len\": %d},\n", entries, max_fan_out, max_map_len);
+	fprintf(f, "  \"calls\": {\"get_subtree\": %lld, \"reduce_path\": %lld, \"get_relevant_nodes_at_revision\": %lld},\n",
+			stats.get_subtree_calls, stats.reduce_path_calls, stats.relevant_nodes_calls);
+	fprintf(f, "  \"mergeinfo\": {\"properties\": %d, \"rows\": %lld},\n", mi_len, stats.mergeinfo_rows);
+	fprintf(f, "  \"merge_paths\": {\"indexed\": %u, \"hits\": %lld, \"known_missing\": %lld, \"misses\": %lld},\n",
+			merge_paths.len, stats.merge_path_hits, stats.merge_path_missing, stats.merge_path_walks);
+	fprintf(f, "  \"bytes\": {\n");
+	fprintf(f, "    \"revisions\": %lld,\n", (long long)rev_max * sizeof(revision));
+	fprintf(f, "    \"nodes\": %lld,\n", (long long)pool.block_len * NODE_BLOCK_BYTES);
+	fprintf(f, "    \"dependencies\": %lld,\n", (long long)pool.edge_block_len * EDGE_BLOCK_SIZE * sizeof(node_id));
+	fprintf(f, "    \"repotree\": %lld,\n", tree_bytes);
+	fprintf(f, "    \"paths\": %lld,\n", path_bytes);
+	fprintf(f, "    \"mergeinfo\": %lld,\n", mi_bytes);
+	fprintf(f, "    \"merge_paths\": %lld,\n", index_bytes);
+	fprintf(f, "    \"outputs\": %lld,\n", out_bytes);
+	fprintf(f, "    \"largest_node_list\": %lld\n", stats.relevant_nodes_max * (long long)sizeof(node_id));
+	fprintf(f, "  },\n");
+	fprintf(f, "  \"peak_rss\": %lld\n", get_peak_rss());
+	fprintf(f, "}\n");
+}
+
+/*******************************************************************************
+ *
+ * Planning
+ *
+ ******************************************************************************/
+
+// What an include set would keep, as reported by --plan.
+typedef struct {
+	long long nodes;
+	long long bytes; // Content bytes of the kept nodes
+	long long dependency_bytes; // Content bytes of the kept nodes outside the include set
+	int revisions; // Revisions that aren't empty, i.e. the ones --drop-empty would keep
+	int deletes; // Paths --add-delete would delete
+	int redefined;
+} plan_result;
+
+// Runs the same analysis as for writing the output, and counts what would be kept.
+static void evaluate_plan(repotree *rt, revision *revisions, int rev_len, filter *f, off_t *content_sizes, plan_result *r) {
+	int i, j;
+	long long n = 0;
+	char **to_delete;
+	progress quiet;
+	node_id nd;
+	filter copy = *f; // redefine_root clears the root if it fails
+	f = &copy;
+	init_progress(&quiet, NULL, NULL, 0);
+	reset_wanted(revisions, rev_len);
+	mark_wanted(revisions, rev_len, f, &quiet);
+	finish_wanted(rt, revisions, rev_len, f, 1, &quiet);
+	r->redefined = f->redefined_root != NULL;
+	to_delete = get_deletes(rt, rev_len, f, &r->deletes);
+	free(to_delete);
+	r->nodes = 0;
+	r->bytes = 0;
+	r->dependency_bytes = 0;
+	r->revisions = 0;
+	for (i = 0; i < rev_len; ++i) {
+		if (revisions[i].number >= 0) {
+			++r->revisions;
+		}
+		for (j = 0; j < revisions[i].size; ++j, ++n) {
+			nd = revisions[i].first + j;
+			if (is_wanted(nd)) {
+				++r->nodes;
+				r->bytes += content_sizes[n];
+				if (!is_cluded(node_path(nd), f->include, f->inc_slash, f->inc_len)) {
+					r->dependency_bytes += content_sizes[n];
+				}
+			}
+		}
+	}
+}
+
+// Evaluates every candidate. The candidates are independent, so on POSIX systems each one
+// is evaluated in a child process of its own, as many at a time as there are processors.
+// The children share the analyzed repository copy-on-write, and only the pages with wanted
+// flags get copied. That doesn't work once the analysis data lives in the shared mapping
+// of --memory-limit, and a child can't return its errors to a library caller, so then the
+// candidates are evaluated one after another.
+static void evaluate_plans(repotree *rt, revision *revisions, int rev_len, output *outs, int out_len, off_t *content_sizes, plan_result *results) {
+	int o;
+#ifndef _WIN32
+	int i, status;
+	int running = 0;
+	int jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	int fd[2];
+	pid_t pid;
+	pid_t *pids;
+	int *fds;
+	if (!mem.spilling && !error_jump && jobs > 1 && out_len > 1) {
+		pids = (pid_t*)malloc(out_len * sizeof(pid_t));
+		fds = (int*)malloc(out_len * sizeof(int));
+		if (pids == NULL || fds == NULL) {
+			exit_with_error("malloc failed", 2);
+		}
+		fflush(NULL);
+		for (o = 0; o <= out_len; ++o) {
+			// Wait for a child to finish when all processors are busy, and at the end for the rest.
+			while (running > 0 && (running == jobs || o == out_len)) {
+				if ((pid = wait(&status)) < 0) {
+					exit_with_error("wait failed", 2);
+				}
+				for (i = 0; i < o && pids[i] != pid; ++i) {}
+				if (i == o || !WIFEXITED(status) || WEXITSTATUS(status) != 0 || read(fds[i], &results[i], sizeof(plan_result)) != sizeof(plan_result)) {
+					exit_with_error("Evaluating a candidate failed", 2);
+				}
+				close(fds[i]);
+				--running;
+			}
+			if (o == out_len) {
+				break;
+			}
+			if (pipe(fd) != 0) {
+				exit_with_error("pipe failed", 2);
+			}
+			if ((pid = fork()) < 0) {
+				exit_with_error("fork failed", 2);
+			}
+			if (pid == 0) {
+				close(fd[0]);
+				// The other candidates keep the other processors busy.
+				max_threads = 1;
+				evaluate_plan(rt, revisions, rev_len, &outs[o].filt, content_sizes, &results[o]);
+				// The result is smaller than PIPE_BUF, so this doesn't block.
+				_exit(write(fd[1], &results[o], sizeof(plan_result)) == sizeof(plan_result) ? 0 : 1);
+			}
+			close(fd[1]);
+			pids[o] = pid;
+			fds[o] = fd[0];
+			++running;
+		}
+		free(pids);
+		free(fds);
+		return;
+	}
+#endif
+	for (o = 0; o < out_len; ++o) {
+		evaluate_plan(rt, revisions, rev_len, &outs[o].filt, content_sizes, &results[o]);
+	}
+}
+
+static void write_plan(FILE *f, output *outs, int out_len, plan_result *results) {
+	int o;
+	int width = 9;
+	for (o = 0; o < out_len; ++o) {
+		if ((int)strlen(outs[o].path) > width) {
+			width = strlen(outs[o].path);
+		}
+	}
+	fprintf(f, "\n%-*s %10s %12s %16s %16s %8s %s\n", width, "Candidate", "Revisions", "Nodes", "Bytes", "Dep. bytes", "Deletes", "Root");
+	for (o = 0; o < out_len; ++o) {
+		fprintf(f, "%-*s %10d %12lld %16lld %16lld %8d %s\n", width, outs[o].path, results[o].revisions, results[o].nodes,
+				results[o].bytes, results[o].dependency_bytes, results[o].deletes,
+				outs[o].filt.redefined_root == NULL ? "-" : (results[o].redefined ? "redefined" : "not redefined"));
+	}
+}
+
+/*******************************************************************************
+ *
+ * Profiling
+ *
+ ******************************************************************************/
+
+// What --profile-repo reports about a path and everything under it.
+typedef struct {
+	char *path; // NULL for an empty slot
+	unsigned int hash;
+	int first; // The first and last revision with nodes under the path
+	int last;
+	long long nodes;
+	long long bytes; // Content bytes of the nodes
+	long long copies_in; // Nodes copied here from another top level directory
+	long long copies_out; // Nodes in another top level directory copied from here
+	long long mergeinfo; // Mergeinfo properties set here
+	long long merged_from; // Mergeinfo rows with a source here
+} profile_entry;
+
+// The paths down to PROFILE_DEPTH levels below the root, hashed.
+typedef struct {
+	profile_entry *entries;
+	unsigned int size; // A power of 2, or 0
+	unsigned int len;
+} repo_profile;
+
+// Returns the slot of the first len chars of path, or the empty slot where it would go.
+static profile_entry* get_profile_slot(repo_profile *rp, char *path, size_t len, unsigned int hash) {
+	unsigned int i;
+	profile_entry *e;
+	for (i = hash & (rp->size - 1); rp->entries[i].path; i = (i + 1) & (rp->size - 1)) {
+		e = &rp->entries[i];
+		if (e->hash == hash && strncmp(e->path, path, len) == 0 && e->path[len] == '\0') {
+			break;
+		}
+	}
+	return &rp->entries[i];
+}
+
+// Returns the entry of the first len chars of path, adding it if it isn't there. There must
+// be room for it.
+static profile_entry* get_profile_entry(repo_profile *rp, char *path, size_t len) {
+	unsigned int hash = hash_path(path, len);
+	profile_entry *e = get_profile_slot(rp, path, len, hash);
+	if (e->path == NULL) {
+		memset(e, 0, sizeof(profile_entry));
+		e->path = str_malloc(len + 1);
+		memcpy(e->path, path, len);
+		e->path[len] = '\0';
+		e->hash = hash;
+		e->first = -1;
+		e->last = -1;
+		++rp->len;
+	}
+	return e;
+}
+
+// Finds the entries of the root, and of the path and the directories it's in down to
+// PROFILE_DEPTH levels. Returns the number of entries.
+static int get_profile_entries(repo_profile *rp, char *path, profile_entry **entries) {
+	int i;
+	int count = 0;
+	unsigned int old_size = rp->size;
+	profile_entry *old = rp->entries;
+	// Keep at most half of the slots in use, even after adding all of these.
+	if (2 * (rp->len + PROFILE_DEPTH + 1) > rp->size) {
+		rp->size = rp->size ? 2 * rp->size : 1024;
+		if ((rp->entries = (profile_entry*)calloc(rp->size, sizeof(profile_entry))) == NULL) {
+			exit_with_error("calloc failed", 2);
+		}
+		for (i = 0; i < (int)old_size; ++i) {
+			if (old[i].path) {
+				*get_profile_slot(rp, old[i].path, strlen(old[i].path), old[i].hash) = old[i];
+			}
+		}
+		free(old);
+	}
+	entries[count++] = get_profile_entry(rp, path, 0);
+	for (i = 0; path[0] != '\0' && count <= PROFILE_DEPTH; ++i) {
+		if (path[i] == '/' || path[i] == '\0') {
+			entries[count++] = get_profile_entry(rp, path, i);
+		}
+		if (path[i] == '\0') {
+			break;
+		}
+	}
+	return count;
+}
+
+// Returns 1 if the paths are in the same top level directory.
+static int in_same_top_level(char *a, char *b) {
+	int i;
+	for (i = 0; a[i] == b[i] && a[i] != '/' && a[i] != '\0'; ++i) {}
+	return (a[i] == '/' || a[i] == '\0') && (b[i] == '/' || b[i] == '\0');
+}
+
+static int compare_profile_entries(const void *a, const void *b) {
+	return strcmp(((profile_entry*)a)->path, ((profile_entry*)b)->path);
+}
+
+// Writes the report of --profile-repo. It only needs what the first pass reads, i.e. the
+// nodes, their Content-lengths and the mergeinfo, so nothing is analyzed.
+static void profile_repo(FILE *f, revision *revisions, int rev_len, mergeinfo *mi, int mi_len, off_t *content_sizes) {
+	int i, j, k, count;
+	int width = 4;
+	long long n = 0;
+	char span[32];
+	char *path, *copyfrom;
+	profile_entry *e;
+	profile_entry *entries[PROFILE_DEPTH + 1];
+	repo_profile rp;
+	rp.entries = NULL;
+	rp.size = 0;
+	rp.len = 0;
+	for (i = 0; i < rev_len; ++i) {
+		for (j = 0; j < revisions[i].size; ++j, ++n) {
+			path = node_path(revisions[i].first + j);
+			copyfrom = node_copyfrom(revisions[i].first + j);
+			count = get_profile_entries(&rp, path, entries);
+			for (k = 0; k < count; ++k) {
+				e = entries[k];
+				if (e->first < 0) {
+					e->first = i;
+				}
+				e->last = i;
+				++e->nodes;
+				e->bytes += content_sizes[n];
+			}
+			if (copyfrom && !in_same_top_level(path, copyfrom)) {
+				for (k = 0; k < count; ++k) {
+					++entries[k]->copies_in;
+				}
+				count = get_profile_entries(&rp, copyfrom, entries);
+				for (k = 0; k < count; ++k) {
+					++entries[k]->copies_out;
+				}
+			}
+		}
+	}
+	for (i = 0; i < mi_len; ++i) {
+		count = get_profile_entries(&rp, node_path(revisions[mi[i].revision].first + mi[i].node), entries);
+		for (k = 0; k < count; ++k) {
+			++entries[k]->mergeinfo;
+		}
+		for (j = 0; j < mi[i].data->size; ++j) {
+			count = get_profile_entries(&rp, mi[i].data->path[j], entries);
+			for (k = 0; k < count; ++k) {
+				++entries[k]->merged_from;
+			}
+		}
+	}
+	// Sort the entries by path, which puts every directory right before what's in it.
+	for (i = 0, j = 0; i < (int)rp.size; ++i) {
+		if (rp.entries[i].path) {
+			rp.entries[j++] = rp.entries[i];
+			if ((int)strlen(rp.entries[i].path) > width) {
+				width = strlen(rp.entries[i].path);
+			}
+		}
+	}
+	qsort(rp.entries, rp.len, sizeof(profile_entry), compare_profile_entries);
+	fprintf(f, "%-*s %12s %16s %15s %10s %10s %10s %11s\n", width, "Path", "Nodes", "Bytes", "Revisions", "Copies in", "Copies out", "Mergeinfo", "Merged from");
+	for (i = 0; i < (int)rp.len; ++i) {
+		e = &rp.entries[i];
+		if (e->first < 0) {
+			strcpy(span, "-");
+		}
+		else {
+			sprintf(span, "%d-%d", e->first, e->last);
+		}
+		fprintf(f, "%-*s %12lld %16lld %15s %10lld %10lld %10lld %11lld\n", width, e->path[0] == '\0' ? "/" : e->path, e->nodes, e->bytes, span,
+				e->copies_in, e->copies_out, e->mergeinfo, e->merged_from);
+		free(e->path);
+	}
+	free(rp.entries);
+}
+
+/*******************************************************************************
+ *
+ * Extent plan
+ *
+ ******************************************************************************/
+
+// Usually most revisions are written exactly as they are in the infile. Before writing, the
+// dump is divided into extents: runs of revisions that every output copies as they are, and
+// runs that have to go through the writer line by line, because some output leaves out nodes
+// of them or rewrites their headers. The copied extents are written with large sequential
+// copies, without looking at what's in them.
+typedef struct {
+	off_t start; // Offset of the first Revision-number line, or 0 for the dump header
+	off_t end; // -1 for the end of the infile
+	off_t nodes;
+	int first; // First revision, -1 for the dump header
+	int last;
+	int copy;
+} extent;
+
+typedef struct {
+	extent *extents;
+	int len;
+	int max;
+	off_t max_copy; // Copied extents are coalesced up to this many bytes
+} extent_plan;
+
+static void init_extent_plan(extent_plan *plan) {
+	plan->extents = NULL;
+	plan->len = 0;
+	plan->max = 0;
+	plan->max_copy = MAX_EXTENT;
+}
+
+static void free_extent_plan(extent_plan *plan) {
+	free(plan->extents);
+}
+
+// Appends the part of the infile from start to end, coalescing it with the previous extent if
+// both are copied or both rewritten. Copied extents are only coalesced up to max_copy bytes,
+// so that the progress and the checkpoints keep up with them.
+static void add_extent(extent_plan *plan, off_t start, off_t end, int rev, off_t nodes, int copy) {
+	extent *e = plan->len > 0 ? &plan->extents[plan->len - 1] : NULL;
+	if (e && e->copy == copy && e->end == start && (!copy || end - e->start <= plan->max_copy)) {
+		e->end = end;
+		e->last = rev;
+		e->nodes += nodes;
+		return;
+	}
+	if (plan->len == plan->max) {
+		plan->max = plan->max ? 2 * plan->max : 64;
+		if ((plan->extents = (extent*)realloc(plan->extents, plan->max * sizeof(extent))) == NULL) {
+			exit_with_error("realloc failed", 2);
+		}
+	}
+	e = &plan->extents[plan->len++];
+	e->start = start;
+	e->end = end;
+	e->nodes = nodes;
+	e->first = rev;
+	e->last = rev;
+	e->copy = copy;
+}
+
+// Returns 1 if the output writes the revision exactly as it is in the infile. renumbered is
+// the first revision whose number --drop-empty changes, and n the index of its first node.
+static int copies_revision(output *out, revision *r, int renumbered, int rev, off_t n) {
+	off_t end = n + r->size;
+	if (out->filt.redefined_root || (out->drop_empty && (rev >= renumbered || !r->plain))) {
+		return 0;
+	}
+	for (; n < end; ++n) {
+		if (!((out->wanted[n / 8] >> (n % 8)) & 1)) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+// Divides the infile into extents for writing the outputs. With a verifier every node has to be
+// looked at, so then only the dump header is copied. The last revision always goes through the
+// writer, since the infile may end in the middle of it.
+static void build_extent_plan(extent_plan *plan, revision *revisions, int rev_len, output *outs, int out_len, mergeinfo *mi, int mi_len, int verify) {
+	int i, o, copy;
+	int act_mi = 0;
+	int *renumbered;
+	off_t n = 0;
+	init_extent_plan(plan);
+	if (rev_len == 0) {
+		add_extent(plan, 0, -1, -1, 0, 0);
+		return;
+	}
+	if ((renumbered = (int*)malloc(out_len * sizeof(int))) == NULL) {
+		exit_with_error("malloc failed", 2);
+	}
+	for (o = 0; o < out_len; ++o) {
+		// A new file of a chunked output may have to be started before any revision.
+		if (outs[o].manifest) {
+			plan->max_copy = 0;
+		}
+		for (renumbered[o] = 0; renumbered[o] < rev_len && outs[o].numbers[renumbered[o]] == renumbered[o]; ++renumbered[o]) {}
+	}
+	if (revisions[0].offset > 0) {
+		add_extent(plan, 0, revisions[0].offset, -1, 0, 1);
+	}
+	for (i = 0; i < rev_len; ++i) {
+		while (act_mi < mi_len && mi[act_mi].revision < i) {
+			++act_mi;
+		}
+		// The mergeinfo of every node that is written gets rewritten.
+		copy = !verify && i < rev_len - 1 && (act_mi == mi_len || mi[act_mi].revision != i);
+		for (o = 0; o < out_len && copy; ++o) {
+			copy = copies_revision(&outs[o], &revisions[i], renumbered[o], i, n);
+		}
+		add_extent(plan, revisions[i].offset, i < rev_len - 1 ? revisions[i + 1].offset : -1, i, revisions[i].size, copy);
+		n += revisions[i].size;
+	}
+	free(renumbered);
+}
+
+// Writes the plan for --export-plan, one extent per line.
+static void export_extent_plan(FILE *f, extent_plan *plan) {
+	int i;
+	int copies = 0;
+	long long copied = 0;
+	extent *e;
+	fprintf(f, "# action start end first_revision last_revision nodes\n");
+	for (i = 0; i < plan->len; ++i) {
+		e = &plan->extents[i];
+		if (e->end < 0) {
+			fprintf(f, "%s %lld end %d %d %lld\n", e->copy ? "copy" : "rewrite", (long long)e->start, e->first, e->last, (long long)e->nodes);
+		}
+		else {
+			fprintf(f, "%s %lld %lld %d %d %lld\n", e->copy ? "copy" : "rewrite", (long long)e->start, (long long)e->end, e->first, e->last, (long long)e->nodes);
+		}
+		if (e->copy) {
+			++copies;
+			copied += e->end - e->start;
+		}
+	}
+	fprintf(f, "# %d extents, %d copied with %lld bytes\n", plan->len, copies, copied);
+}
+
+/*******************************************************************************
+ *
+ * Checkpoints
+ *
+ ******************************************************************************/
+
+// Without a checkpoint file, this just makes the writing start from the beginning.
+static void init_checkpoint(checkpoint *cp) {
+	cp->file = NULL;
+	cp->path = NULL;
+	cp->last = 0;
+	cp->input = 0;
+	cp->node_index = -1;
+	cp->offsets = NULL;
+	cp->rev = -1;
+	cp->act_mi = 0;
+}
+
+// Makes sure everything written to f so far would survive a crash.
+static void sync_file(FILE *f) {
+	fflush(f);
+#ifdef _WIN32
+	_commit(_fileno(f));
+#else
+	fsync(fileno(f));
+#endif
+}
+
+static void truncate_file(FILE *f, off_t size) {
+	fflush(f);
+#ifdef _WIN32
+	if (_chsize_s(_fileno(f), size) != 0) {
+#else
+	if (ftruncate(fileno(f), size) != 0) {
+#endif
+		exit_with_error("Could not truncate an outfile to the checkpoint", 3);
+	}
+	fseeko(f, 0, SEEK_END);
+}
+
+static void write_checkpoint_data(checkpoint *cp, void *data, size_t size) {
+	if (size > 0 && fwrite(data, size, 1, cp->file) != 1) {
+		exit_with_error("Writing the checkpoint failed", 3);
+	}
+}
+
+// Returns 0 if the checkpoint ends before size bytes could be read.
+static int read_checkpoint_data(checkpoint *cp, void *data, size_t size) {
+	return size == 0 || fread(data, size, 1, cp->file) == 1;
+}
+
+static void read_checkpoint_or_fail(checkpoint *cp, void *data, size_t size) {
+	if (!read_checkpoint_data(cp, data, size)) {
+		exit_with_error("The checkpoint is incomplete. Run again with --checkpoint instead of --resume", 1);
+	}
+}
+
+static void write_checkpoint_string(checkpoint *cp, char *str) {
+	int len = -1;
+	if (str) {
+		len = strlen(str);
+	}
+	write_checkpoint_data(cp, &len, sizeof(int));
+	write_checkpoint_data(cp, str, len > 0 ? len : 0);
+}
+
+// Returns NULL if NULL was written.
+static char* read_checkpoint_string(checkpoint *cp) {
+	int len;
+	char *str;
+	read_checkpoint_or_fail(cp, &len, sizeof(int));
+	if (len < 0) {
+		return NULL;
+	}
+	str = str_malloc(len + 1);
+	read_checkpoint_or_fail(cp, str, len);
+	str[len] = '\0';
+	return str;
+}
+
+// Describes the infile and the options that affect the output, so that --resume can
+// tell whether the checkpoint was made by the same command.
+static char* get_checkpoint_options(off_t in_size, output *outs, int out_len) {
+	int i, o;
+	size_t len = 100;
+	char *str;
+	filter *f;
+	for (o = 0; o < out_len; ++o) {
+		f = &outs[o].filt;
+		for (i = 0; i < f->inc_len; ++i) {
+			len += strlen(f->include[i]) + 3;
+		}
+		for (i = 0; i < f->exc_len; ++i) {
+			len += strlen(f->exclude[i]) + 3;
 		}
-		if ((md->to = (int*)realloc(md->to, (md->size + 1) * sizeof(int))) == NULL) {
-			exit_with_error("realloc failed", 2);
+		if (f->redefined_root) {
+			len += strlen(f->redefined_root) + 3;
 		}
-		j = i + len - 1;
-		// Parse through possible crap at the end that isn't digits replacing it with NULL.
-		while (minfo[j] < 48 || minfo[j] > 57) {
-			minfo[j] = '\0';
-			--j;
+		len += 10;
+	}
+	str = str_malloc(len);
+	sprintf(str, "%lld %d\n", (long long)in_size, out_len);
+	for (o = 0; o < out_len; ++o) {
+		f = &outs[o].filt;
+		for (i = 0; i < f->inc_len; ++i) {
+			strcat(str, "n ");
+			strcat(str, f->include[i]);
+			strcat(str, "\n");
 		}
-		// Parse through the last number.
-		while (minfo[j] >= 48 && minfo[j] <= 57) {
-			--j;
+		for (i = 0; i < f->exc_len; ++i) {
+			strcat(str, "e ");
+			strcat(str, f->exclude[i]);
+			strcat(str, "\n");
 		}
-		md->to[md->size] = atoi(&minfo[j + 1]);
-		// Parse until the first number, replacing all non-digits with NULL.
-		while (minfo[j] != ':') {
-			if (minfo[j] < 48 || minfo[j] > 57) {
-				minfo[j] = '\0';
-			}
-			--j;
+		if (f->redefined_root) {
+			strcat(str, "r ");
+			strcat(str, f->redefined_root);
+			strcat(str, "\n");
 		}
-		md->from[md->size] = atoi(&minfo[j + 1]);
-		minfo[j] = '\0';
-		md->path[md->size] = str_malloc(strlen(&minfo[i]));
-		++i; // For some reason mergeinfo paths start with a slash, even though no other svn paths do.
-		strcpy(md->path[md->size], &minfo[i]);
-		i += len; // Step past the string and the NULL that terminates it.
-		++md->size;
+		sprintf(&str[strlen(str)], "- %d %d\n", outs[o].drop_empty, outs[o].add_delete);
 	}
-	*size = i;
-	return md;
+	return str;
 }
 
-mergeinfo* create_mergeinfo(mergeinfo *mi, char *minfo, int rev, int nod, int *mi_len) {
-	int orig;
-	int i = 0;
-	// Parse past newlines turned NULL, and "K 13" line...
-	while (minfo[i] == '\0' || minfo[i] == 'K' || minfo[i] == ' ' || minfo[i] == '1' || minfo[i] == '3') {
-		++i;
+static void start_checkpoint(checkpoint *cp, char *options) {
+	write_checkpoint_data(cp, CHECKPOINT_MAGIC, strlen(CHECKPOINT_MAGIC));
+	write_checkpoint_string(cp, options);
+	fflush(cp->file);
+}
+
+// Saves what the write pass needs from the analysis: which nodes each output wants, the
+// new revision numbers, whether the root was redefined, the deletes, the mergeinfo and the
+// extent plan.
+static void save_checkpoint(checkpoint *cp, revision *revisions, int rev_len, output *outs, int out_len, mergeinfo *mi, int mi_len, extent_plan *plan) {
+	int i, j, o;
+	int n = 0;
+	int redefined;
+	for (i = 0; i < rev_len; ++i) {
+		n += revisions[i].size;
 	}
-	// Mismatch here means it's not a mergeinfo. Abort.
-	if (strcmp(&minfo[i], "svn:mergeinfo") != 0) {
-		return mi;
+	write_checkpoint_data(cp, &rev_len, sizeof(int));
+	write_checkpoint_data(cp, &n, sizeof(int));
+	for (o = 0; o < out_len; ++o) {
+		write_checkpoint_data(cp, outs[o].wanted, n / 8 + 1);
+		write_checkpoint_data(cp, outs[o].numbers, rev_len * sizeof(int));
+		redefined = outs[o].filt.redefined_root != NULL;
+		write_checkpoint_data(cp, &redefined, sizeof(int));
+		write_checkpoint_data(cp, &outs[o].del_len, sizeof(int));
+		for (i = 0; i < outs[o].del_len; ++i) {
+			write_checkpoint_string(cp, outs[o].to_delete[i]);
+		}
 	}
-	i += 14; // 13 chars + NULL
-	// Empty value == Abort. Why does svn even add this kind of manure to the dump file?
-	if (strcmp(&minfo[i], "V 0") == 0) {
-		return mi;
+	write_checkpoint_data(cp, &mi_len, sizeof(int));
+	for (i = 0; i < mi_len; ++i) {
+		write_checkpoint_data(cp, &mi[i].revision, sizeof(int));
+		write_checkpoint_data(cp, &mi[i].node, sizeof(int));
+		write_checkpoint_data(cp, &mi[i].orig_size, sizeof(int));
+		write_checkpoint_data(cp, &mi[i].data->size, sizeof(unsigned short));
+		for (j = 0; j < mi[i].data->size; ++j) {
+			write_checkpoint_string(cp, mi[i].data->path[j]);
+			write_checkpoint_data(cp, &mi[i].data->from[j], sizeof(int));
+			write_checkpoint_data(cp, &mi[i].data->to[j], sizeof(int));
+		}
 	}
-	// Otherwise go past the "V (whatever)" line...
-	while (minfo[i] != '\0') {
-		++i;
+	write_checkpoint_data(cp, &plan->len, sizeof(int));
+	write_checkpoint_data(cp, plan->extents, plan->len * sizeof(extent));
+	sync_file(cp->file);
+	cp->last = get_time();
+}
+
+// Records that writing can be resumed from the Revision-number line at offset input. The
+// outfiles are synced first, so a position is never saved ahead of the data.
+static void save_position(checkpoint *cp, output *outs, int out_len, int rev, int act_mi, off_t node_index, off_t input) {
+	int o;
+	double now;
+	if (cp->file == NULL || (now = get_time()) - cp->last < CHECKPOINT_INTERVAL) {
+		return;
 	}
-	++i;
-	if ((mi = (mergeinfo*)realloc(mi, (*mi_len + 1) * sizeof(mergeinfo))) == NULL) {
-		exit_with_error("realloc failed", 2);
+	cp->last = now;
+	for (o = 0; o < out_len; ++o) {
+		sync_file(outs[o].file);
+		cp->offsets[o] = ftello(outs[o].file);
 	}
-	mi[*mi_len].data = add_mergedata(&minfo[i], &orig);
-	mi[*mi_len].revision = rev;
-	mi[*mi_len].node = nod;
-	mi[*mi_len].orig_size = i + orig + 9; // "PROPS-END"
-	++*mi_len;
-	return mi;
+	write_checkpoint_data(cp, &rev, sizeof(int));
+	write_checkpoint_data(cp, &act_mi, sizeof(int));
+	write_checkpoint_data(cp, &node_index, sizeof(off_t));
+	write_checkpoint_data(cp, &input, sizeof(off_t));
+	write_checkpoint_data(cp, cp->offsets, out_len * sizeof(off_t));
+	sync_file(cp->file);
 }
 
-// Returns the number of bytes the final row will have, including newline.
-int get_mergerow_size(mergedata *data, revision *revisions, char *redefined_root, int row) {
-	int to, from;
-	int size = 0;
-	char *temp;
-	to = get_new_revision_number(revisions, data->to[row]);
-	from = get_new_revision_number(revisions, data->from[row]);
-	if (to == from) {
-		size += num_len(to) + 1; // ":XXX"
+// Loads the analysis saved by save_checkpoint into the outputs and the plan, and the last
+// complete position into cp. The outfiles are cut back to that position. Returns the mergeinfo.
+static mergeinfo* load_checkpoint(checkpoint *cp, char *options, output *outs, int out_len, int *rev_len, int *mi_len, extent_plan *plan) {
+	int i, j, o, n, redefined, rev, act_mi;
+	off_t node_index, input, start;
+	off_t *offsets;
+	char magic[sizeof(CHECKPOINT_MAGIC)];
+	char *temp_str;
+	mergeinfo *mi = NULL;
+	magic[strlen(CHECKPOINT_MAGIC)] = '\0';
+	if (!read_checkpoint_data(cp, magic, strlen(CHECKPOINT_MAGIC)) || strcmp(magic, CHECKPOINT_MAGIC) != 0) {
+		exit_with_file_error(cp->path, " is not a checkpoint", 1);
 	}
-	else {
-		size += num_len(to) + num_len(from) + 2; // ":XXX-YYY"
+	temp_str = read_checkpoint_string(cp);
+	if (temp_str == NULL || strcmp(temp_str, options) != 0) {
+		exit_with_error("The checkpoint was made with a different infile or different options", 1);
 	}
-	if (redefined_root) {
-		temp = reduce_path(redefined_root, data->path[row]);
-		size += strlen(temp) + 2; // "/...\n"
-		free(temp);
+	free(temp_str);
+	read_checkpoint_or_fail(cp, rev_len, sizeof(int));
+	read_checkpoint_or_fail(cp, &n, sizeof(int));
+	for (o = 0; o < out_len; ++o) {
+		if ((outs[o].wanted = (unsigned char*)malloc(n / 8 + 1)) == NULL) {
+			exit_with_error("malloc failed", 2);
+		}
+		if ((outs[o].numbers = (int*)malloc((*rev_len + 1) * sizeof(int))) == NULL) {
+			exit_with_error("malloc failed", 2);
+		}
+		read_checkpoint_or_fail(cp, outs[o].wanted, n / 8 + 1);
+		read_checkpoint_or_fail(cp, outs[o].numbers, *rev_len * sizeof(int));
+		read_checkpoint_or_fail(cp, &redefined, sizeof(int));
+		if (!redefined) {
+			outs[o].filt.redefined_root = NULL;
+		}
+		read_checkpoint_or_fail(cp, &outs[o].del_len, sizeof(int));
+		if ((outs[o].to_delete = (char**)malloc(outs[o].del_len * sizeof(char*) + 1)) == NULL) {
+			exit_with_error("malloc failed", 2);
+		}
+		for (i = 0; i < outs[o].del_len; ++i) {
+			outs[o].to_delete[i] = read_checkpoint_string(cp);
+		}
 	}
-	else {
-		size += strlen(data->path[row]) + 2; // "/...\n"
+	read_checkpoint_or_fail(cp, mi_len, sizeof(int));
+	if ((mi = (mergeinfo*)malloc(*mi_len * sizeof(mergeinfo) + 1)) == NULL) {
+		exit_with_error("malloc failed", 2);
 	}
-	return size;
+	for (i = 0; i < *mi_len; ++i) {
+		read_checkpoint_or_fail(cp, &mi[i].revision, sizeof(int));
+		read_checkpoint_or_fail(cp, &mi[i].node, sizeof(int));
+		read_checkpoint_or_fail(cp, &mi[i].orig_size, sizeof(int));
+		if ((mi[i].data = (mergedata*)malloc(sizeof(mergedata))) == NULL) {
+			exit_with_error("malloc failed", 2);
+		}
+		read_checkpoint_or_fail(cp, &mi[i].data->size, sizeof(unsigned short));
+		mi[i].data->path = (char**)malloc(mi[i].data->size * sizeof(char*) + 1);
+		mi[i].data->from = (int*)malloc(mi[i].data->size * sizeof(int) + 1);
+		mi[i].data->to = (int*)malloc(mi[i].data->size * sizeof(int) + 1);
+		if (mi[i].data->path == NULL || mi[i].data->from == NULL || mi[i].data->to == NULL) {
+			exit_with_error("malloc failed", 2);
+		}
+		for (j = 0; j < mi[i].data->size; ++j) {
+			mi[i].data->path[j] = read_checkpoint_string(cp);
+			read_checkpoint_or_fail(cp, &mi[i].data->from[j], sizeof(int));
+			read_checkpoint_or_fail(cp, &mi[i].data->to[j], sizeof(int));
+		}
+	}
+	read_checkpoint_or_fail(cp, &plan->len, sizeof(int));
+	plan->max = plan->len;
+	if ((plan->extents = (extent*)malloc(plan->len * sizeof(extent) + 1)) == NULL) {
+		exit_with_error("malloc failed", 2);
+	}
+	read_checkpoint_or_fail(cp, plan->extents, plan->len * sizeof(extent));
+	// Find the last complete position. A position that was being written when the
+	// run was interrupted is overwritten by the next one.
+	if ((offsets = (off_t*)calloc(out_len, sizeof(off_t))) == NULL) {
+		exit_with_error("calloc failed", 2);
+	}
+	start = ftello(cp->file);
+	while (read_checkpoint_data(cp, &rev, sizeof(int)) &&
+	       read_checkpoint_data(cp, &act_mi, sizeof(int)) &&
+	       read_checkpoint_data(cp, &node_index, sizeof(off_t)) &&
+	       read_checkpoint_data(cp, &input, sizeof(off_t)) &&
+	       read_checkpoint_data(cp, offsets, out_len * sizeof(off_t))) {
+		cp->rev = rev;
+		cp->act_mi = act_mi;
+		cp->node_index = node_index;
+		cp->input = input;
+		memcpy(cp->offsets, offsets, out_len * sizeof(off_t));
+		start = ftello(cp->file);
+	}
+	free(offsets);
+	fseeko(cp->file, start, SEEK_SET);
+	for (o = 0; o < out_len; ++o) {
+		truncate_file(outs[o].file, cp->offsets[o]);
+	}
+	cp->last = get_time();
+	return mi;
 }
 
-void write_mergeinfo(FILE *outfile, mergedata *data, revision *revisions, char *redefined_root, int orig_size, off_t con_len, off_t pcon_len) {
-	int i, v_size, diff, to, from;
-	int size = 0;
-	char *temp;
-	for (i = 0; i < data->size; ++i) {
-		size += get_mergerow_size(data, revisions, redefined_root, i);
+// Called when everything has been written. The outfiles are complete, so the checkpoint
+// is no longer needed.
+static void finish_checkpoint(checkpoint *cp, output *outs, int out_len) {
+	int o;
+	for (o = 0; o < out_len; ++o) {
+		sync_file(outs[o].file);
 	}
-	v_size = size - 1; // The last (first?) newline doesn't count towards value length.
-	size += num_len(v_size) + 3; // "V XXX\n"
-	size += 30; // "\nK 13\nsvn:mergeinfo\n"  ... "\nPROPS-END"
-	diff = orig_size - size;
-	fprintf(outfile, "Prop-content-length: %d\nContent-length: %d\n\nK 13\nsvn:mergeinfo\nV %d\n",
-					(int)pcon_len - diff, (int)con_len - diff, v_size);
-	for (i = 0; i < data->size; ++i) {
-		to = get_new_revision_number(revisions, data->to[i]);
-		from = get_new_revision_number(revisions, data->from[i]);
-		if (redefined_root) {
-			temp = reduce_path(redefined_root, data->path[i]);
+	fclose(cp->file);
+	cp->file = NULL;
+	remove(cp->path);
+}
+
+/*******************************************************************************
+ *
+ * Checksum verification
+ *
+ ******************************************************************************/
+
+// MD5 (RFC 1321) and SHA-1 (RFC 3174), for checking the Text-content-md5 and
+// Text-content-sha1 headers of the nodes being copied.
+typedef struct {
+	unsigned int state[5];
+	unsigned long long length; // Bytes hashed so far
+	unsigned char block[64];
+	int sha1;
+} digest;
+
+static const unsigned int md5_sines[64] = {
+	0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+	0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+	0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+	0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+	0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+	0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+	0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+	0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+};
+
+static const int md5_shifts[16] = {7, 12, 17, 22, 5, 9, 14, 20, 4, 11, 16, 23, 6, 10, 15, 21};
+
+static inline unsigned int rotate_left(unsigned int x, int n) {
+	return (x << n) | (x >> (32 - n));
+}
+
+static void md5_block(unsigned int *state, const unsigned char *block) {
+	unsigned int m[16];
+	unsigned int a = state[0], b = state[1], c = state[2], d = state[3], f, temp;
+	int i, g;
+	for (i = 0; i < 16; ++i) {
+		m[i] = block[4 * i] | (block[4 * i + 1] << 8) | (block[4 * i + 2] << 16) | ((unsigned int)block[4 * i + 3] << 24);
+	}
+	for (i = 0; i < 64; ++i) {
+		if (i < 16) {
+			f = (b & c) | (~b & d);
+			g = i;
+		}
+		else if (i < 32) {
+			f = (d & b) | (~d & c);
+			g = (5 * i + 1) % 16;
+		}
+		else if (i < 48) {
+			f = b ^ c ^ d;
+			g = (3 * i + 5) % 16;
 		}
 		else {
-			temp = data->path[i];
+			f = c ^ (b | ~d);
+			g = (7 * i) % 16;
 		}
-		if (to == from) {
-			fprintf(outfile, "/%s:%d\n", temp, to);
+		temp = d;
+		d = c;
+		c = b;
+		b += rotate_left(a + f + md5_sines[i] + m[g], md5_shifts[(i / 16) * 4 + i % 4]);
+		a = temp;
+	}
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+}
+
+// One round of SHA-1. Instead of moving the variables along after each round, the rounds are
+// done five at a time with the variables' roles rotated, which leaves all of it in registers.
+#define SHA1_ROUND(a, b, c, d, e, f, k, i) \
+	e += rotate_left(a, 5) + (f) + (k) + w[i]; \
+	b = rotate_left(b, 30);
+#define SHA1_ROUNDS(F, k) \
+	SHA1_ROUND(a, b, c, d, e, F(b, c, d), k, i); \
+	SHA1_ROUND(e, a, b, c, d, F(a, b, c), k, i + 1); \
+	SHA1_ROUND(d, e, a, b, c, F(e, a, b), k, i + 2); \
+	SHA1_ROUND(c, d, e, a, b, F(d, e, a), k, i + 3); \
+	SHA1_ROUND(b, c, d, e, a, F(c, d, e), k, i + 4);
+#define SHA1_CHOOSE(x, y, z) ((x & y) | (~x & z))
+#define SHA1_PARITY(x, y, z) (x ^ y ^ z)
+#define SHA1_MAJORITY(x, y, z) ((x & y) | (x & z) | (y & z))
+
+static void sha1_block(unsigned int *state, const unsigned char *block) {
+	unsigned int w[80];
+	unsigned int a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+	int i;
+	for (i = 0; i < 16; ++i) {
+		w[i] = ((unsigned int)block[4 * i] << 24) | (block[4 * i + 1] << 16) | (block[4 * i + 2] << 8) | block[4 * i + 3];
+	}
+	for (i = 16; i < 80; ++i) {
+		w[i] = rotate_left(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+	}
+	for (i = 0; i < 20; i += 5) {
+		SHA1_ROUNDS(SHA1_CHOOSE, 0x5a827999);
+	}
+	for (; i < 40; i += 5) {
+		SHA1_ROUNDS(SHA1_PARITY, 0x6ed9eba1);
+	}
+	for (; i < 60; i += 5) {
+		SHA1_ROUNDS(SHA1_MAJORITY, 0x8f1bbcdc);
+	}
+	for (; i < 80; i += 5) {
+		SHA1_ROUNDS(SHA1_PARITY, 0xca62c1d6);
+	}
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+	state[4] += e;
+}
+
+static void init_digest(digest *d, int sha1) {
+	d->state[0] = 0x67452301;
+	d->state[1] = 0xefcdab89;
+	d->state[2] = 0x98badcfe;
+	d->state[3] = 0x10325476;
+	d->state[4] = 0xc3d2e1f0;
+	d->length = 0;
+	d->sha1 = sha1;
+}
+
+static void update_digest(digest *d, const unsigned char *data, size_t len) {
+	size_t used = d->length % 64;
+	size_t part;
+	d->length += len;
+	while (len > 0) {
+		part = 64 - used < len ? 64 - used : len;
+		if (part == 64) {
+			// Whole blocks are hashed straight from the data.
+			(d->sha1 ? sha1_block : md5_block)(d->state, data);
 		}
 		else {
-			fprintf(outfile, "/%s:%d-%d\n", temp, from, to);
+			memcpy(&d->block[used], data, part);
+			if (used + part == 64) {
+				(d->sha1 ? sha1_block : md5_block)(d->state, d->block);
+			}
+		}
+		used = (used + part) % 64;
+		data += part;
+		len -= part;
+	}
+}
+
+// Writes the digest as a lowercase hex string to hex, which must have room for 41 chars.
+static void finish_digest(digest *d, char *hex) {
+	unsigned char tail[72];
+	unsigned long long bits = d->length * 8;
+	int i, len = 64 + 56 - d->length % 64;
+	if (len > 64) {
+		len -= 64;
+	}
+	memset(tail, 0, sizeof(tail));
+	tail[0] = 0x80;
+	for (i = 0; i < 8; ++i) {
+		// MD5 stores the length little endian, SHA-1 big endian.
+		tail[len + i] = (unsigned char)(bits >> (d->sha1 ? 56 - 8 * i : 8 * i));
+	}
+	update_digest(d, tail, len + 8);
+	for (i = 0; i < (d->sha1 ? 20 : 16); ++i) {
+		sprintf(&hex[2 * i], "%.2x", (d->state[i / 4] >> (d->sha1 ? 24 - 8 * (i % 4) : 8 * (i % 4))) & 0xff);
+	}
+}
+
+// The text of a node being verified. The checksums expected are empty if the dump doesn't have them.
+typedef struct {
+	digest md5;
+	digest sha1;
+	char expected_md5[33];
+	char expected_sha1[41];
+	char *path;
+	int revision;
+	long long index; // Position of the node in the dump, for reporting in order
+	int failed_md5;
+	int failed_sha1;
+} node_text;
+
+// With a pool, the text being copied is handed over in chunks. All chunks of a node go to
+// the same worker, which hashes them in order, so different nodes are hashed in parallel.
+typedef struct text_chunk {
+	struct text_chunk *next;
+	node_text *text;
+	unsigned char *data;
+	size_t len;
+	int last;
+} text_chunk;
+
+#ifndef _WIN32
+typedef struct {
+	text_chunk *head;
+	text_chunk *tail;
+	text_chunk *hashing; // The chunk taken from the queue, until it's freed
+	pthread_cond_t work;
+	pthread_t thread;
+	struct verifier *v;
+} verify_worker;
+#endif
+
+typedef struct verifier {
+	node_text *current;
+	long long verified;
+	node_text **failed;
+	int failed_len;
+#ifndef _WIN32
+	verify_worker *workers;
+	int workers_len; // 0 = hash while copying
+	int next_worker;
+	size_t queued; // Bytes handed to the workers but not yet hashed
+	int stopping;
+	thread_error err;
+	pthread_mutex_t lock; // Guards everything the workers share
+	pthread_cond_t room;
+#endif
+} verifier;
+
+// Compares the digests of a node with the checksums in the dump. The failures are kept for
+// reporting, the rest freed.
+static void check_text(verifier *v, node_text *t) {
+	char hex[41];
+	if (t->expected_md5[0]) {
+		finish_digest(&t->md5, hex);
+		t->failed_md5 = strcmp(hex, t->expected_md5) != 0;
+	}
+	if (t->expected_sha1[0]) {
+		finish_digest(&t->sha1, hex);
+		t->failed_sha1 = strcmp(hex, t->expected_sha1) != 0;
+	}
+	++v->verified;
+	if (t->failed_md5 || t->failed_sha1) {
+		if ((v->failed = (node_text**)realloc(v->failed, (v->failed_len + 1) * sizeof(node_text*))) == NULL) {
+			exit_with_error("realloc failed", 2);
+		}
+		v->failed[v->failed_len++] = t;
+	}
+	else {
+		free(t->path);
+		free(t);
+	}
+}
+
+static void hash_text(node_text *t, const unsigned char *data, size_t len) {
+	if (t->expected_md5[0]) {
+		update_digest(&t->md5, data, len);
+	}
+	if (t->expected_sha1[0]) {
+		update_digest(&t->sha1, data, len);
+	}
+}
+
+#ifndef _WIN32
+static void* verify_texts(void *arg) {
+	verify_worker *w = (verify_worker*)arg;
+	verifier *v = w->v;
+	text_chunk *c;
+	int code;
+	jmp_buf jump;
+	// Only keeping a failure can fail, and that's done holding the lock, with the text of the
+	// chunk being hashed not yet kept.
+	if ((code = setjmp(jump)) != 0) {
+		keep_thread_error(&v->err, code);
+		free(w->hashing->text->path);
+		free(w->hashing->text);
+		free(w->hashing->data);
+		free(w->hashing);
+		pthread_cond_signal(&v->room);
+		pthread_mutex_unlock(&v->lock);
+		return NULL;
+	}
+	error_jump = &jump;
+	pthread_mutex_lock(&v->lock);
+	while (1) {
+		while (w->head == NULL && !v->stopping) {
+			pthread_cond_wait(&w->work, &v->lock);
+		}
+		if ((c = w->head) == NULL) {
+			break;
+		}
+		if ((w->head = c->next) == NULL) {
+			w->tail = NULL;
+		}
+		w->hashing = c;
+		pthread_mutex_unlock(&v->lock);
+		hash_text(c->text, c->data, c->len);
+		pthread_mutex_lock(&v->lock);
+		if (c->last) {
+			check_text(v, c->text);
+		}
+		v->queued -= c->len;
+		pthread_cond_signal(&v->room);
+		free(c->data);
+		free(c);
+	}
+	pthread_mutex_unlock(&v->lock);
+	return NULL;
+}
+
+// Hands a chunk to the worker of the current node, waiting while too much is queued.
+static void queue_text(verifier *v, const unsigned char *data, size_t len, int last) {
+	verify_worker *w = &v->workers[v->next_worker];
+	text_chunk *c;
+	if ((c = (text_chunk*)malloc(sizeof(text_chunk))) == NULL) {
+		exit_with_error("malloc failed", 2);
+	}
+	c->next = NULL;
+	c->text = v->current;
+	c->len = len;
+	c->last = last;
+	c->data = NULL;
+	if (len > 0) {
+		c->data = (unsigned char*)str_malloc(len);
+		memcpy(c->data, data, len);
+	}
+	pthread_mutex_lock(&v->lock);
+	while (v->queued > 0 && v->queued + len > VERIFY_QUEUE_SIZE && !has_thread_error(&v->err)) {
+		pthread_cond_wait(&v->room, &v->lock);
+	}
+	// The workers are stopped by whoever frees the verifier after the error.
+	if (has_thread_error(&v->err)) {
+		pthread_mutex_unlock(&v->lock);
+		free(c->data);
+		free(c);
+		rethrow_thread_error(&v->err);
+	}
+	v->queued += len;
+	if (w->tail) {
+		w->tail->next = c;
+	}
+	else {
+		w->head = c;
+	}
+	w->tail = c;
+	pthread_cond_signal(&w->work);
+	pthread_mutex_unlock(&v->lock);
+}
+#endif
+
+// Starts verifying, hashing on threads threads besides the one copying.
+static void init_verifier(verifier *v, int threads) {
+#ifndef _WIN32
+	int i;
+#endif
+	v->current = NULL;
+	v->verified = 0;
+	v->failed = NULL;
+	v->failed_len = 0;
+#ifndef _WIN32
+	v->workers = NULL;
+	v->workers_len = threads > 1 ? threads : 0;
+	v->next_worker = 0;
+	v->queued = 0;
+	v->stopping = 0;
+	init_thread_error(&v->err);
+	if (v->workers_len == 0) {
+		return;
+	}
+	if ((v->workers = (verify_worker*)calloc(v->workers_len, sizeof(verify_worker))) == NULL) {
+		exit_with_error("calloc failed", 2);
+	}
+	if (pthread_mutex_init(&v->lock, NULL) != 0 || pthread_cond_init(&v->room, NULL) != 0) {
+		exit_with_error("pthread_mutex_init failed", 2);
+	}
+	for (i = 0; i < v->workers_len; ++i) {
+		v->workers[i].v = v;
+		if (pthread_cond_init(&v->workers[i].work, NULL) != 0) {
+			exit_with_error("pthread_cond_init failed", 2);
+		}
+		// With fewer workers than asked for, the texts are dealt out among those there are.
+		if (pthread_create(&v->workers[i].thread, NULL, verify_texts, &v->workers[i]) != 0) {
+			pthread_cond_destroy(&v->workers[i].work);
+			v->workers_len = i;
+			break;
+		}
+	}
+	if (v->workers_len == 0) {
+		pthread_mutex_destroy(&v->lock);
+		pthread_cond_destroy(&v->room);
+		free(v->workers);
+		v->workers = NULL;
+	}
+#endif
+}
+
+// Starts the text of a node, if the dump has checksums for it.
+static void begin_text(verifier *v, int revision, char *path, long long index, char *md5, char *sha1) {
+	node_text *t;
+	if (md5[0] == '\0' && sha1[0] == '\0') {
+		return;
+	}
+	if ((t = (node_text*)calloc(1, sizeof(node_text))) == NULL) {
+		exit_with_error("calloc failed", 2);
+	}
+	init_digest(&t->md5, 0);
+	init_digest(&t->sha1, 1);
+	strcpy(t->expected_md5, md5);
+	strcpy(t->expected_sha1, sha1);
+	t->path = str_malloc(strlen(path) + 1);
+	strcpy(t->path, path);
+	t->revision = revision;
+	t->index = index;
+	v->current = t;
+}
+
+static void verify_text(verifier *v, const unsigned char *data, size_t len) {
+	if (v->current == NULL) {
+		return;
+	}
+#ifndef _WIN32
+	if (v->workers_len > 0) {
+		queue_text(v, data, len, 0);
+		return;
+	}
+#endif
+	hash_text(v->current, data, len);
+}
+
+static void end_text(verifier *v) {
+	if (v->current == NULL) {
+		return;
+	}
+#ifndef _WIN32
+	if (v->workers_len > 0) {
+		queue_text(v, NULL, 0, 1);
+		v->next_worker = (v->next_worker + 1) % v->workers_len;
+		v->current = NULL;
+		return;
+	}
+#endif
+	check_text(v, v->current);
+	v->current = NULL;
+}
+
+static int compare_texts(const void *a, const void *b) {
+	long long x = (*(node_text**)a)->index;
+	long long y = (*(node_text**)b)->index;
+	return x < y ? -1 : x > y;
+}
+
+// Waits for the workers to hash what they have been given, and stops them. What a worker
+// that failed was left with is freed, and so is a text that was cut short.
+static void stop_verifier(verifier *v) {
+#ifndef _WIN32
+	int i;
+	text_chunk *c;
+	if (v->workers_len > 0) {
+		pthread_mutex_lock(&v->lock);
+		v->stopping = 1;
+		for (i = 0; i < v->workers_len; ++i) {
+			pthread_cond_signal(&v->workers[i].work);
 		}
-		if (redefined_root) {
-			free(temp);
+		pthread_mutex_unlock(&v->lock);
+		for (i = 0; i < v->workers_len; ++i) {
+			pthread_join(v->workers[i].thread, NULL);
+			pthread_cond_destroy(&v->workers[i].work);
+			while ((c = v->workers[i].head) != NULL) {
+				v->workers[i].head = c->next;
+				if (c->last) {
+					free(c->text->path);
+					free(c->text);
+				}
+				free(c->data);
+				free(c);
+			}
 		}
+		pthread_mutex_destroy(&v->lock);
+		pthread_cond_destroy(&v->room);
+		free(v->workers);
+		v->workers = NULL;
+		v->workers_len = 0;
+	}
+#endif
+	if (v->current) {
+		free(v->current->path);
+		free(v->current);
+		v->current = NULL;
+	}
+}
+
+// Stops the verifying without reporting anything, after an error.
+static void free_verifier(verifier *v) {
+	int i;
+	stop_verifier(v);
+	for (i = 0; i < v->failed_len; ++i) {
+		free(v->failed[i]->path);
+		free(v->failed[i]);
+	}
+	free(v->failed);
+	v->failed = NULL;
+	v->failed_len = 0;
+}
+
+// Waits for the hashing to finish, and reports the nodes whose checksums don't match.
+// Returns the number of such nodes.
+static int finish_verifier(verifier *v, FILE *messages) {
+	int i, failed;
+	stop_verifier(v);
+	qsort(v->failed, v->failed_len, sizeof(node_text*), compare_texts);
+	for (i = 0; i < v->failed_len; ++i) {
+		fprintf(messages, "Checksum mismatch (%s) in revision %d: %s\n", v->failed[i]->failed_md5 ? (v->failed[i]->failed_sha1 ? "MD5 and SHA-1" : "MD5") : "SHA-1", v->failed[i]->revision, v->failed[i]->path);
+		free(v->failed[i]->path);
+		free(v->failed[i]);
 	}
+	fprintf(messages, "Verified the checksums of %lld nodes, %d did not match.\n", v->verified, v->failed_len);
+	failed = v->failed_len;
+	free(v->failed);
+	return failed;
 }
 
 /*******************************************************************************
  *
- * Main method
+ * Output-related functions
  *
  ******************************************************************************/
 
-int main(int argc, char **argv) {
-	// Misc temporary variables
- 	int i, j, k, ch, want_by_default, new_number, empty, temp_int, is_dir, should_do, maxp_len;
-	off_t offset, con_len, pcon_len;
-	time_t rawtime;
-	struct tm *ptm;
-	char *temp_str = NULL;
-	char *temp_str2 = NULL;
-	char *minfo = NULL;
-	int to_file = 1;
-	int query = 0;
-	int add_delete = 0;
-
-	// Variables to help analyze user input 
-	int in = 0;
-	int out = 0;
-	int incl = 0;
-	int excl = 0;
-	int drop = 0;
-	int redef = 0;
-	int del = 0;
-	int why = 0;
+static void add_filter_path(char ***paths, int *len, char *path) {
+	if ((*paths = (char**)realloc(*paths, (*len + 1) * sizeof(char*))) == NULL) {
+		exit_with_error("realloc failed", 2);
+	}
+	// Allow the user to escape a directory in the repository root, that starts with a
+	// hyphen, using a slash.
+	if (starts_with(path, "/")) {
+		(*paths)[*len] = &path[1];
+	}
+	else {
+		(*paths)[*len] = path;
+	}
+	++*len;
+}
 
-	// Variables related to files and paths
-	FILE *infile = NULL;
-	FILE *outfile = NULL;
-	FILE *messages = stdout;
-	char **include = NULL; // Holds the paths the user wants to keep
-	char **exclude = NULL; // Holds the paths the user wants to discard
-	char **exc_slash = NULL;
-	char **inc_slash = NULL;
-	char **to_delete = NULL;
-	char *redefined_root = NULL;
-	char *why_file = NULL;
-	node **redef_rollback = NULL;
-
-	// Variables to hold the size of 2D pseudoarrays
-	int inc_len = 0;
-	int exc_len = 0;
-	int del_len = 0;
-	int cur_len = 0;
-	int cur_max = 80;
+// Returns the index of the first include the redefined root doesn't fit, or -1 if it fits them all.
+static int get_redefine_mismatch(filter *f) {
+	int i;
+	char *temp_str = add_slash_to(f->redefined_root);
+	for (i = 0; i < f->inc_len; ++i) {
+		if (!(strcmp(f->include[i], f->redefined_root) == 0 || starts_with(f->include[i], temp_str))) {
+			free(temp_str);
+			return i;
+		}
+	}
+	free(temp_str);
+	return -1;
+}
 
-	// File reading & writing variables
-	char *current_line;
-	if ((current_line = (char*)calloc(cur_max, 1)) == NULL) {
-		exit_with_error("calloc failed", 2);
+static void build_filter_slashes(filter *f) {
+	int i;
+	if (f->inc_len > 0) {
+		if ((f->inc_slash = (char**)malloc(f->inc_len * sizeof(char*))) == NULL) {
+			exit_with_error("malloc failed", 2);
+		}
+		for (i = 0; i < f->inc_len; ++i) {
+			f->inc_slash[i] = add_slash_to(f->include[i]);
+		}
 	}
-	int reading_node = 0;
-	int writing = 1;
-	int toggle = 0;
-	int merge = 0;
+	if (f->exc_len > 0) {
+		if ((f->exc_slash = (char**)malloc(f->exc_len * sizeof(char*))) == NULL) {
+			exit_with_error("malloc failed", 2);
+		}
+		for (i = 0; i < f->exc_len; ++i) {
+			f->exc_slash[i] = add_slash_to(f->exclude[i]);
+		}
+	}
+}
 
-	// Variables related to revisions and nodes
-	int drop_empty = 0;
-	int rev_len = -1;
-	int rev_max = 10;
-	int rev = -1;
-	revision *revisions;
-	if ((revisions = (revision*)malloc(rev_max * sizeof(revision))) == NULL) {
-		exit_with_error("malloc failed", 2);
+// Exits if the filter makes no sense.
+static void check_filter(filter *f) {
+	int i;
+	char message[1024];
+	if (f->include == NULL && f->exclude == NULL) {
+		exit_with_error("You must specify something to either include or exclude", 1);
 	}
-	int nod_len = -1;
-	int nod = -1;
-	node *current_node = NULL;
-	node **node_ptr = NULL;
+	if (f->include != NULL && f->exclude != NULL) {
+		exit_with_error("You may not specify both includes and excludes", 1);
+	}
+	if (f->exclude != NULL && f->redefined_root != NULL) {
+		exit_with_error("You may not redefine root when using excludes", 1);
+	}
+	if (f->redefined_root != NULL && (i = get_redefine_mismatch(f)) >= 0) {
+		snprintf(message, sizeof(message), "%s can not be redefined as root for include %s", f->redefined_root, f->include[i]);
+		exit_with_error(message, 1);
+	}
+}
 
-	// Create repotree root node
-	repotree rt;
-	rt.children = NULL;
-	rt.path = NULL;
-	rt.map = NULL;
-	rt.chi_len = 0;
-	repotree *subtree;
+static void init_output(output *out) {
+	out->file = NULL;
+	out->path = NULL;
+	out->filt.include = NULL;
+	out->filt.exclude = NULL;
+	out->filt.inc_slash = NULL;
+	out->filt.exc_slash = NULL;
+	out->filt.redefined_root = NULL;
+	out->filt.inc_len = 0;
+	out->filt.exc_len = 0;
+	out->wanted = NULL;
+	out->numbers = NULL;
+	out->to_delete = NULL;
+	out->del_len = 0;
+	out->drop_empty = 0;
+	out->add_delete = 0;
+	out->writing = 1;
+	out->toggle = 0;
+	out->crosses = 1;
+	out->chunk_revisions = 0;
+	out->chunk_size = 0;
+	out->chunk = 0;
+	out->chunk_revs = 0;
+	out->chunk_first = 0;
+	out->chunk_last = 0;
+	out->header = NULL;
+	out->header_len = 0;
+	out->manifest = NULL;
+	out->sums = NULL;
+	out->sum_len = 0;
+	out->finished_bytes = 0;
+	out->sum_written = 0;
+}
 
-	mergeinfo *mi = NULL;
-	int mi_max = 0;
-	int mi_len = 0;
-	int act_mi = -1;
-	
-	/*******************************************************************************
-	 *
-	 * Parameter analysis
-	 *
-	 *******************************************************************************/
+static void free_chunk_sum(chunk_sum *sum) {
+	free(sum->name);
+	free(sum);
+}
 
-	for (i = 1 ; i < argc ; ++i) {
-		if (starts_with(argv[i], "-")) {
-			if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0) {
-				free(current_line);
-				free(revisions);
-				free(include);
-				free(exclude);
-				show_help_and_exit();
-			}
-			if (strcmp(argv[i], "--version") == 0 || strcmp(argv[i], "-v") == 0) {
-				free(current_line);
-				free(revisions);
-				free(include);
-				free(exclude);
-				show_version_and_exit();
-			}
-			in = (!strcmp(argv[i], "--infile") || !strcmp(argv[i], "-i"));
-			out = (!strcmp(argv[i], "--outfile") || !strcmp(argv[i], "-o"));
-			incl = (!strcmp(argv[i], "--include") || !strcmp(argv[i], "-n"));
-			excl = (!strcmp(argv[i], "--exclude") || !strcmp(argv[i], "-e"));
-			drop = (!strcmp(argv[i], "--drop-empty") || !strcmp(argv[i], "-d"));
-			redef = (!strcmp(argv[i], "--redefine-root") || !strcmp(argv[i], "-r"));
-			del = (!strcmp(argv[i], "--add-delete") || !strcmp(argv[i], "-a"));
-			why = (!strcmp(argv[i], "--query") || !strcmp(argv[i], "-q"));
-			if (!(in || out || incl || excl || drop || redef || del || why)) {
-				exit_with_error(strcat(argv[i], " is not a valid parameter. Use -h for help."), 1);
-			}
-			else if (drop) {
-				drop_empty = 1;
-			}
-			else if (del) {
-				add_delete = 1;
-			}
-			else if (why) {
-				query = 1;
-			}
+static void free_output(output *out) {
+	int i;
+	for (i = 0; i < out->filt.inc_len && out->filt.inc_slash; ++i) {
+		free(out->filt.inc_slash[i]);
+	}
+	for (i = 0; i < out->filt.exc_len && out->filt.exc_slash; ++i) {
+		free(out->filt.exc_slash[i]);
+	}
+	free(out->filt.include);
+	free(out->filt.exclude);
+	free(out->filt.inc_slash);
+	free(out->filt.exc_slash);
+	free(out->wanted);
+	free(out->numbers);
+	free(out->to_delete);
+	free(out->header);
+	// Files whose lines are still missing after an error may still be being hashed.
+	for (i = out->sum_written; i < out->sum_len; ++i) {
+#ifndef _WIN32
+		if (out->sums[i]->threaded) {
+			pthread_join(out->sums[i]->thread, NULL);
 		}
-		else if (in && infile == NULL) {
-			infile = fopen(argv[i],"rb");
-			if (infile == NULL) {
-				exit_with_error(strcat(argv[i], " can not be opened as infile") , 3);
-			}
+#endif
+		free_chunk_sum(out->sums[i]);
+	}
+	free(out->sums);
+}
+
+// Copies a checksum of len hex digits from the dump in lower case, or an empty string if it
+// doesn't look like one.
+static void read_checksum(char *checksum, char *hex, int len) {
+	int i;
+	checksum[0] = '\0';
+	if ((int)strlen(hex) != len) {
+		return;
+	}
+	for (i = 0; i < len; ++i) {
+		if (hex[i] >= 'A' && hex[i] <= 'F') {
+			checksum[i] = hex[i] - 'A' + 'a';
 		}
-		else if (out && outfile == NULL) {
-			outfile = fopen(argv[i],"wb");
-			if (outfile == NULL) {
-				exit_with_error(strcat(argv[i], " can not be opened as outfile") , 3);
-			}
+		else if ((hex[i] >= '0' && hex[i] <= '9') || (hex[i] >= 'a' && hex[i] <= 'f')) {
+			checksum[i] = hex[i];
 		}
-		else if (incl) {
-			if ((include = (char**)realloc(include, (inc_len + 1) * sizeof(char*))) == NULL) {
-				exit_with_error("realloc failed", 2);
-			}
-			// Allow the user to escape a directory in the repository root, that starts with a
-			// hyphen, using a slash.
-			if (starts_with(argv[i], "/")) {
-				include[inc_len] = &argv[i][1];
-			}
-			else {
-				include[inc_len] = argv[i];
-			}
-			++inc_len;			
+		else {
+			checksum[0] = '\0';
+			return;
 		}
-		else if (excl) {
-			if ((exclude = (char**)realloc(exclude, (exc_len + 1) * sizeof(char*))) == NULL) {
-				exit_with_error("realloc failed", 2);
-			}
-			if (starts_with(argv[i], "/")) {
-				exclude[exc_len] = &argv[i][1];
+	}
+	checksum[len] = '\0';
+}
+
+// Copies count bytes from the input to every output currently writing, and to the verifier
+// if there is one. Should the file end prematurely (the final padding is sometimes missing)
+// we output the same EOF bytes as earlier versions did.
+static void copy_to_outputs(input *in, output *outs, int out_len, off_t count, verifier *v) {
+	int i;
+	size_t chunk;
+	unsigned char *data;
+	while (count > 0) {
+		if ((chunk = input_chunk(in, &data, count)) == 0) {
+			for (i = 0; i < out_len; ++i) {
+				if (outs[i].writing) {
+					for (chunk = 0; (off_t)chunk < count; ++chunk) {
+						fputc(EOF, outs[i].file);
+					}
+				}
 			}
-			else {
-				exclude[exc_len] = argv[i];
+			return;
+		}
+		for (i = 0; i < out_len; ++i) {
+			if (outs[i].writing) {
+				fwrite(data, 1, chunk, outs[i].file);
 			}
-			++exc_len;
 		}
-		else if (redef && redefined_root == NULL) {
-			redefined_root = argv[i];
+		if (v) {
+			verify_text(v, data, chunk);
 		}
-		else {
-			exit_with_error(strcat(argv[i], " is not a valid parameter. Use -h for help."), 1);
+		count -= chunk;
+	}
+}
+
+// Starts file number out->chunk of an output written in chunks. The files are named after the
+// outfile, e.g. repo.dump.000, repo.dump.001 and so on. Returns NULL if it can't be opened.
+static FILE* open_chunk(output *out) {
+	char *name = str_malloc(strlen(out->path) + num_len(out->chunk) + 5);
+	sprintf(name, "%s.%.3d", out->path, out->chunk);
+	out->file = fopen(name, "wb");
+	free(name);
+	return out->file;
+}
+
+// Reads back a finished file for its SHA-1, while it's still likely to be in the page cache.
+static void hash_chunk(chunk_sum *sum) {
+	FILE *f;
+	unsigned char *buffer;
+	size_t len;
+	digest d;
+	if ((f = fopen(sum->name, "rb")) == NULL) {
+		exit_with_error("Could not read back an outfile for the manifest", 3);
+	}
+	if ((buffer = (unsigned char*)malloc(INPUT_BUFFER_SIZE)) == NULL) {
+		exit_with_error("malloc failed", 2);
+	}
+	init_digest(&d, 1);
+	while ((len = fread(buffer, 1, INPUT_BUFFER_SIZE, f)) > 0) {
+		update_digest(&d, buffer, len);
+	}
+	fclose(f);
+	free(buffer);
+	finish_digest(&d, sum->sha1);
+}
+
+#ifndef _WIN32
+static void* hash_chunk_in_thread(void *arg) {
+	chunk_sum *sum = (chunk_sum*)arg;
+	int code;
+	jmp_buf jump;
+	if ((code = setjmp(jump)) != 0) {
+		keep_thread_error(&sum->err, code);
+		return NULL;
+	}
+	error_jump = &jump;
+	hash_chunk(sum);
+	return NULL;
+}
+#endif
+
+// Adds the oldest finished file whose line is still missing to the manifest.
+static void write_chunk_sum(output *out) {
+	chunk_sum *sum = out->sums[out->sum_written++];
+#ifndef _WIN32
+	thread_error err;
+	if (sum->threaded) {
+		pthread_join(sum->thread, NULL);
+		if (has_thread_error(&sum->err)) {
+			err = sum->err;
+			free_chunk_sum(sum);
+			rethrow_thread_error(&err);
 		}
 	}
-	if (infile == NULL) {
-		exit_with_error("You must specify an infile", 1);
+#endif
+	fprintf(out->manifest, "%s %d %d %s\n", sum->name, sum->first, sum->last, sum->sha1);
+	fflush(out->manifest);
+	free_chunk_sum(sum);
+}
+
+// Closes the file being written, and has its checksum computed. Hashing is much slower than
+// copying, so that's done on threads of their own while the writing goes on, as many at a
+// time as --threads allows.
+static void finish_chunk(output *out) {
+	chunk_sum *sum;
+	out->finished_bytes += ftello(out->file);
+	if (fclose(out->file) != 0) {
+		exit_with_error("Could not write to outfile", 3);
 	}
-	if (outfile == NULL) {
-		to_file = 0;
-		outfile = stdout;
-// Without this output may be corrupted on windows.
-#ifdef _WIN32
-		_setmode(_fileno(outfile), _O_BINARY);
+	out->file = NULL;
+	if ((sum = (chunk_sum*)malloc(sizeof(chunk_sum))) == NULL) {
+		exit_with_error("malloc failed", 2);
+	}
+	sum->name = str_malloc(strlen(out->path) + num_len(out->chunk) + 5);
+	sprintf(sum->name, "%s.%.3d", out->path, out->chunk);
+	sum->first = out->chunk_first;
+	sum->last = out->chunk_last;
+#ifndef _WIN32
+	sum->threaded = 0;
 #endif
-		messages = stderr;
+	if ((out->sums = (chunk_sum**)realloc(out->sums, (out->sum_len + 1) * sizeof(chunk_sum*))) == NULL) {
+		exit_with_error("realloc failed", 2);
+	}
+	out->sums[out->sum_len++] = sum;
+#ifdef _WIN32
+	hash_chunk(sum);
+#else
+	while (out->sum_len - out->sum_written > get_threads()) {
+		write_chunk_sum(out);
+	}
+	init_thread_error(&sum->err);
+	// A file whose thread can't be started is hashed right away.
+	sum->threaded = pthread_create(&sum->thread, NULL, hash_chunk_in_thread, sum) == 0;
+	if (!sum->threaded) {
+		hash_chunk(sum);
 	}
-	if (include == NULL && exclude == NULL) {
-		fclose(infile);
-		if (to_file) {
-			fclose(outfile);
+#endif
+}
+
+// Called before writing revision number rev to an output written in chunks. If the current
+// file is full, it's finished and the next one started with the dump header, so that every
+// file is a valid incremental dump. A file is full once it has chunk_revisions revisions, or
+// has grown to at least chunk_size bytes.
+static void add_revision_to_chunk(output *out, int rev) {
+	if (out->chunk_revs > 0 && ((out->chunk_revisions && out->chunk_revs >= out->chunk_revisions) || (out->chunk_size && ftello(out->file) >= out->chunk_size))) {
+		finish_chunk(out);
+		++out->chunk;
+		if (open_chunk(out) == NULL) {
+			exit_with_error("Could not open the next outfile", 3);
 		}
-		exit_with_error("You must specify something to either include or exclude", 1);
+		fwrite(out->header, 1, out->header_len, out->file);
+		out->chunk_revs = 0;
+	}
+	if (out->chunk_revs == 0) {
+		out->chunk_first = rev;
+	}
+	out->chunk_last = rev;
+	++out->chunk_revs;
+}
+
+// Reads the dump header, which is written at the start of every file of the chunked outputs.
+// It's everything before the first revision, which starts at end.
+static void read_chunk_header(input *infile, output *outs, int out_len, off_t end) {
+	int o;
+	size_t len = 0;
+	size_t chunk;
+	unsigned char *data;
+	char *header = str_malloc((size_t)end + 1);
+	input_seek(infile, 0);
+	while (len < (size_t)end && (chunk = input_chunk(infile, &data, end - len)) > 0) {
+		memcpy(&header[len], data, chunk);
+		len += chunk;
 	}
-	if (include != NULL && exclude != NULL) {
-		fclose(infile);
-		if (to_file) {
-			fclose(outfile);
+	for (o = 0; o < out_len; ++o) {
+		if (outs[o].manifest) {
+			outs[o].header = str_malloc(len + 1);
+			memcpy(outs[o].header, header, len);
+			outs[o].header_len = len;
 		}
-		exit_with_error("You may not specify both includes and excludes", 1);
 	}
-	if (exclude != NULL && redefined_root != NULL) {
-		fclose(infile);
-		if (to_file) {
-			fclose(outfile);
+	free(header);
+}
+
+// Finishes the last file of the chunked outputs, and their manifests.
+static void finish_chunks(output *outs, int out_len) {
+	int o;
+	for (o = 0; o < out_len; ++o) {
+		if (outs[o].manifest) {
+			finish_chunk(&outs[o]);
+			while (outs[o].sum_written < outs[o].sum_len) {
+				write_chunk_sum(&outs[o]);
+			}
+			fclose(outs[o].manifest);
+			outs[o].manifest = NULL;
 		}
-		exit_with_error("You may not redefine root when using excludes", 1);
 	}
-	if (redefined_root != NULL) {
-		temp_str = add_slash_to(redefined_root);
-		for (i = 0; i < inc_len; ++i) {
-			if (!(strcmp(include[i], redefined_root) == 0 || starts_with(include[i], temp_str))) {
-				fclose(infile);
-				if (outfile != NULL) {
-					fclose(outfile);
-				}
-				temp_str2 = str_malloc(strlen(redefined_root) + strlen(include[i]) + 43);
-				strcpy(temp_str2, redefined_root);
-				strcat(temp_str2, " can not be redefined as root for include ");
-				strcat(temp_str2, include[i]);
-				exit_with_error(temp_str2, 1);
+}
+
+static int get_delete_revision_number(int *numbers, int rev_len, int drop_empty) {
+	int i = 1;
+	int num;
+	if (!drop_empty) {
+		return rev_len;
+	}
+	do {
+		num = numbers[rev_len - i] + 1;
+		++i;
+	} while (num == 0);
+	return num;
+}
+
+static void write_delete_revision(FILE *outfile, char **to_delete, int del_len, int *numbers, int rev_len, int drop_empty) {
+	int i;
+	int num = get_delete_revision_number(numbers, rev_len, drop_empty);
+	time_t rawtime;
+	struct tm *ptm;
+	time(&rawtime);
+	ptm = gmtime(&rawtime);
+	fprintf(outfile, "Revision-number: %d\n", num);
+	fprintf(outfile, "Prop-content-length: 133\n");
+	fprintf(outfile, "Content-length: 133\n\n");
+	fprintf(outfile, "K 7\nsvn:log\nV 22\n");
+	fprintf(outfile, "Deleted unwanted nodes\n");
+	fprintf(outfile, "K 10\nsvn:author\nV 16\nsvndumpsanitizer\nK 8\nsvn:date\nV 27\n");
+	fprintf(outfile, "%d-%.2d-%.2dT%.2d:%.2d:%.2d.000000Z\n", ptm->tm_year + 1900, ptm->tm_mon + 1, ptm->tm_mday, ptm->tm_hour, ptm->tm_min, ptm->tm_sec);
+	fprintf(outfile, "PROPS-END\n\n");
+	for (i = 0; i < del_len; ++i) {
+		fprintf(outfile, "Node-path: %s\n", to_delete[i]);
+		fprintf(outfile, "Node-action: delete\n\n\n");
+	}
+}
+
+// Adds the deleting revision to the outputs that have something to delete.
+static void write_delete_revisions(output *outs, int out_len, int rev_len) {
+	int o;
+	for (o = 0; o < out_len; ++o) {
+		if (outs[o].del_len > 0) {
+			if (outs[o].manifest) {
+				add_revision_to_chunk(&outs[o], get_delete_revision_number(outs[o].numbers, rev_len, outs[o].drop_empty));
 			}
+			write_delete_revision(outs[o].file, outs[o].to_delete, outs[o].del_len, outs[o].numbers, rev_len, outs[o].drop_empty);
 		}
-		free(temp_str);
 	}
-	want_by_default = 10;
-	if (include) {
-		want_by_default = 0;
+}
+
+// Copies the copied extents of the plan that start where the infile is, to every output.
+// Extents that have been passed are skipped. Returns the index of the next extent.
+static int copy_extents(input *infile, output *outs, int out_len, extent_plan *plan, int next, int *rev, int act_mi, off_t *node_index, checkpoint *cp, progress *prog) {
+	int o;
+	off_t pos = input_tell(infile);
+	extent *e;
+	for (; next < plan->len && (e = &plan->extents[next])->start <= pos; ++next) {
+		if (!e->copy || e->start < pos) {
+			continue;
+		}
+		save_position(cp, outs, out_len, *rev, act_mi, *node_index, pos);
+		for (o = 0; o < out_len; ++o) {
+			outs[o].writing = 1;
+			// Extents of chunked outputs are single revisions.
+			if (outs[o].manifest && e->first >= 0) {
+				add_revision_to_chunk(&outs[o], outs[o].numbers[e->first]);
+			}
+		}
+		copy_to_outputs(infile, outs, out_len, e->end - e->start, NULL);
+		*rev = e->last;
+		*node_index += e->nodes;
+		pos = input_tell(infile);
+		update_progress(prog, *rev, pos);
 	}
+	return next;
+}
 
-	/*******************************************************************************
-	 *
-	 * Reading the metadata
-	 *
-	 *******************************************************************************/
-	while ((ch = fgetc(infile)) != EOF) {
-		// Once we reach a newline character we need to analyze the data.
+// Copies the infile to the outputs, leaving out the unwanted parts, and modifying whatever
+// the dropped revisions, redefined roots and mergeinfo require. The extents of the plan that
+// need none of that are copied as they are. Last comes the revision --add-delete adds.
+// Writing starts from the position in cp, which is the beginning unless resuming. With a
+// verifier, the text of every node written is checked against the checksums in the dump.
+static void write_outputs(input *infile, output *outs, int out_len, int rev_len, mergeinfo *mi, int mi_len, extent_plan *plan, checkpoint *cp, verifier *v, progress *prog) {
+	int ch, o, temp_int, any;
+	int next_extent = 0;
+	int cur_len = 0;
+	int cur_max = 80;
+	int reading_node = 0;
+	int rev = cp->rev;
+	int nod = -1;
+	int act_mi = cp->act_mi < mi_len ? cp->act_mi : -1;
+	off_t con_len, offset;
+	off_t pcon_len = 0;
+	off_t text_len = -1;
+	off_t node_index = cp->node_index;
+	int text_delta = 0;
+	char text_md5[33];
+	char text_sha1[41];
+	char *node_path = NULL;
+	char *temp_str;
+	char *current_line;
+	output *out;
+	if ((current_line = (char*)calloc(cur_max, 1)) == NULL) {
+		exit_with_error("calloc failed", 2);
+	}
+	start_phase(prog, "Writing", rev_len);
+	count_written(prog, outs, out_len);
+	input_seek(infile, cp->input);
+	next_extent = copy_extents(infile, outs, out_len, plan, next_extent, &rev, act_mi, &node_index, cp, prog);
+	while ((ch = input_getc(infile)) != EOF) {
 		if (ch == NEWLINE) {
-			// Data inside nodes needs special treatment.
 			if (reading_node) {
-				// An empty line while reading a node, means the node stops here.
 				if (strlen(current_line) == 0) {
 					reading_node = 0;
+					for (o = 0; o < out_len; ++o) {
+						outs[o].writing = 1;
+					}
+				}
+				else if (starts_with(current_line, "Node-copyfrom-rev: ")) {
+					for (o = 0; o < out_len; ++o) {
+						out = &outs[o];
+						if (out->writing && out->drop_empty) {
+							temp_int = atoi(&current_line[19]);
+							// It's possible for the copyfrom-rev argument to point to a revision that is being removed.
+							// If this is the case we change it to point to the first revision prior to it, that remains.
+							while (out->numbers[temp_int] < 0) {
+								--temp_int;
+							}
+							fprintf(out->file, "Node-copyfrom-rev: %d\n", out->numbers[temp_int]);
+							out->toggle = 1;
+						}
+					}
+				}
+				else if (starts_with(current_line, "Node-copyfrom-path: ")) {
+					for (o = 0; o < out_len; ++o) {
+						out = &outs[o];
+						if (out->writing && out->filt.redefined_root) {
+							temp_str = reduce_path(out->filt.redefined_root, &current_line[20]);
+							fprintf(out->file, "Node-copyfrom-path: %s\n", temp_str);
+							out->toggle = 1;
+						}
+					}
+				}
+				else if (act_mi >= 0 && mi[act_mi].revision == rev && mi[act_mi].node == nod && starts_with(current_line, "Prop-content-length: ")) {
+					pcon_len = (off_t)atol(&current_line[21]);
+					for (o = 0; o < out_len; ++o) {
+						outs[o].toggle = 1;
+					}
+				}
+				else if (v && starts_with(current_line, "Text-content-length: ")) {
+					text_len = (off_t)atol(&current_line[21]);
+				}
+				else if (v && starts_with(current_line, "Text-content-md5: ")) {
+					read_checksum(text_md5, &current_line[18], 32);
+				}
+				else if (v && starts_with(current_line, "Text-content-sha1: ")) {
+					read_checksum(text_sha1, &current_line[19], 40);
+				}
+				else if (v && strcmp(current_line, "Text-delta: true") == 0) {
+					text_delta = 1;
 				}
-				// A line starting with "Content-lenth: " means that the content
-				// of the node is the only thing left of it.
 				else if (starts_with(current_line, "Content-length: ")) {
-					offset = (off_t)atol(&current_line[16]) + CONTENT_PADDING;
-					if (is_dir && offset > 10 + CONTENT_PADDING) {
-						minfo = str_malloc(offset + 1);
-						i = 0;
-						while ((ch = fgetc(infile)) != EOF && i < offset) {
-							// NULL instead of newline means needed string operations are easier later.
-							if (ch == NEWLINE) {
-								minfo[i] = '\0';
+					con_len = (off_t)atol(&current_line[16]);
+					any = 0;
+					for (o = 0; o < out_len; ++o) {
+						out = &outs[o];
+						if (out->writing) {
+							any = 1;
+							if (pcon_len) {
+								write_mergeinfo(out->file, mi[act_mi].data, out->numbers, out->filt.redefined_root, mi[act_mi].orig_size, con_len, pcon_len);
 							}
 							else {
-								minfo[i] = ch;
+								fprintf(out->file, "%s\n", current_line);
+							}
+						}
+					}
+					if (any) {
+						offset = input_tell(infile);
+						if (pcon_len) {
+							// -10 is because of the "PROPS-END\n" that is included in orig_size.
+							input_skip(infile, mi[act_mi].orig_size - 10);
+							while ((ch = input_getc(infile)) != NEWLINE && ch != EOF) {}
+							++act_mi;
+							if (act_mi == mi_len) {
+								act_mi = -1;
 							}
-							++i;
 						}
-						minfo[i] = '\0';
-						mi = create_mergeinfo(mi, minfo, rev_len, nod_len, &mi_len);
-						free(minfo);
+						// The text is at the end of the content, which starts after the empty line. Deltas
+						// can't be checked, since the checksums are of the text after applying them.
+						if (v && text_len >= 0 && !text_delta && offset + 1 + con_len - text_len >= input_tell(infile)) {
+							copy_to_outputs(infile, outs, out_len, offset + 1 + con_len - text_len - input_tell(infile), NULL);
+							begin_text(v, rev, node_path, node_index, text_md5, text_sha1);
+							copy_to_outputs(infile, outs, out_len, text_len, v);
+							end_text(v);
+						}
+						// Copy whatever is left of the content. Outputs not writing this node must end up
+						// at the same place, so this has to cover exactly the same bytes as the skip below.
+						copy_to_outputs(infile, outs, out_len, offset + con_len + CONTENT_PADDING - input_tell(infile), NULL);
 					}
 					else {
-						fseeko(infile, offset, SEEK_CUR);
+						input_skip(infile, con_len + CONTENT_PADDING);
 					}
 					reading_node = 0;
-				}
-				else if (starts_with(current_line, "Node-action: ")) {
-					if (strcmp(&current_line[13], "add") == 0) {
-						current_node[nod_len].action = ADD;
-					}
-					else if (strcmp(&current_line[13], "delete") == 0) {
-						current_node[nod_len].action = DELETE;
-					}
-					else if (strcmp(&current_line[13], "change") == 0) {
-						current_node[nod_len].action = CHANGE;
-					}
-					else {
-						current_node[nod_len].action = REPLACE;
+					for (o = 0; o < out_len; ++o) {
+						outs[o].writing = 1;
+						outs[o].toggle = 1;
 					}
 				}
-				else if (starts_with(current_line, "Node-kind: ")) {
-					is_dir = !strcmp(&current_line[11], "dir"); // Keep this info for now in case we need to analyze mergeinfo
+			}
+			else if (starts_with(current_line, "Node-path: ")) {
+				reading_node = 1;
+				++nod;
+				++node_index;
+				while (act_mi >= 0 && rev == mi[act_mi].revision && nod > mi[act_mi].node) {
+					++act_mi;
+					if (act_mi == mi_len) {
+						act_mi = -1;
+					}
 				}
-				else if (starts_with(current_line, "Node-copyfrom-path: ")) {
-					current_node[nod_len].copyfrom = str_malloc(strlen(&current_line[19]));
-					strcpy(current_node[nod_len].copyfrom, &current_line[20]);
+				pcon_len = 0;
+				if (v) {
+					text_len = -1;
+					text_delta = 0;
+					text_md5[0] = '\0';
+					text_sha1[0] = '\0';
+					free(node_path);
+					node_path = str_malloc(strlen(&current_line[11]) + 1);
+					strcpy(node_path, &current_line[11]);
 				}
-				else if (starts_with(current_line, "Node-copyfrom-rev: ")) {
-					current_node[nod_len].copyfrom_rev = atoi(&current_line[19]);
+				for (o = 0; o < out_len; ++o) {
+					out = &outs[o];
+					out->writing = (out->wanted[node_index / 8] >> (node_index % 8)) & 1;
+					if (out->writing && out->filt.redefined_root != NULL) {
+						temp_str = reduce_path(out->filt.redefined_root, &current_line[11]);
+						fprintf(out->file, "Node-path: %s\n", temp_str);
+						out->toggle = 1;
+					}
 				}
-			} // End of "if (reading_node)"
-			else if (starts_with(current_line, "Node-path: ")) {
-				++nod_len;
-				++revisions[rev_len].size;
-				if (nod_len == 0) {
-					if ((current_node = (node*)malloc(sizeof(node))) == NULL) {
-						exit_with_error("malloc failed", 2);
+			}
+			else if (starts_with(current_line, "Revision-number: ")) {
+				save_position(cp, outs, out_len, rev, act_mi, node_index, input_tell(infile) - cur_len - 1);
+				++rev;
+				update_progress(prog, rev, input_tell(infile));
+				while (act_mi >= 0 && rev > mi[act_mi].revision) {
+					++act_mi;
+					if (act_mi == mi_len) {
+						act_mi = -1;
 					}
 				}
-				else if ((current_node = (node*)realloc(current_node, (nod_len + 1) * sizeof(node))) == NULL) {
-					exit_with_error("realloc failed", 2);
+				nod = -1;
+				for (o = 0; o < out_len; ++o) {
+					out = &outs[o];
+					out->writing = (!out->drop_empty || out->numbers[rev] >= 0);
+					if (out->manifest && out->writing) {
+						add_revision_to_chunk(out, out->numbers[rev]);
+					}
+					if (out->drop_empty && out->writing) {
+						temp_int = atoi(&current_line[17]);
+						fprintf(out->file, "Revision-number: %d\n", out->numbers[temp_int]);
+						out->toggle = 1;
+					}
 				}
-				init_new_node(&current_node[nod_len]);
-				current_node[nod_len].path = str_malloc(strlen(&current_line[10]));
-				strcpy(current_node[nod_len].path, &current_line[11]);
-				current_node[nod_len].wanted = want_by_default;
-				current_node[nod_len].revision = rev_len;
-				reading_node = 1;
 			}
-			else if (starts_with(current_line,"Revision-number: ")) {
-				if (rev_len >= 0) {
-					revisions[rev_len].nodes = current_node;
+			for (o = 0; o < out_len; ++o) {
+				out = &outs[o];
+				if (out->writing && !out->toggle) {
+					// Had to replace fprintf(outfile, "%s\n", current_line); with this,
+					// because, apparently it's possible to have NULL characters in SVN
+					// commit messages... (WTF?)
+					fwrite(current_line, 1, cur_len, out->file);
+					fputc('\n', out->file);
 				}
-				++rev_len;
-				print_progress(messages, "Reading revision", rev_len);
-				if (rev_len == rev_max) {
-					rev_max += INCREMENT;
-					if ((revisions = (revision*)realloc(revisions, (rev_max * sizeof(revision)))) == NULL) {
-						exit_with_error("realloc failed", 2);
-					}
+				else {
+					out->toggle = 0;
 				}
-				current_node = NULL;
-				revisions[rev_len].nodes = NULL;
-				revisions[rev_len].fakes = NULL;
-				revisions[rev_len].size = 0;
-				revisions[rev_len].fake_size = 0;
-				revisions[rev_len].number = rev_len;
-				nod_len = -1;
 			}
 			current_line[0] = '\0';
 			cur_len = 0;
-		} // End of "if (ch != NEWLINE)" 
+			if (next_extent < plan->len && plan->extents[next_extent].start <= input_tell(infile)) {
+				next_extent = copy_extents(infile, outs, out_len, plan, next_extent, &rev, act_mi, &node_index, cp, prog);
+			}
+		}
 		else {
 			if (cur_len == cur_max - 1) {
 				cur_max += INCREMENT;
@@ -1281,569 +6384,982 @@ int main(int argc, char **argv) {
 			++cur_len;
 			current_line[cur_len] = '\0';
 		}
-	 } // End of "while ((ch = fgetc(infile)) != EOF)"
-	if (rev_len >= 0) {
-		revisions[rev_len].nodes = current_node;
 	}
-	++rev_len;
-	current_line[0] = '\0';
-	cur_len = 0;
-	fprintf(messages, "\n");
+	update_progress(prog, rev_len, input_tell(infile));
+	write_delete_revisions(outs, out_len, rev_len);
+	end_phase(prog);
+	free(current_line);
+	free(node_path);
+}
 
-	/***********************************************************************************
-	 *
-	 * Create dependencies
-	 *
-	 ***********************************************************************************/
+/*******************************************************************************
+ *
+ * Library API, see svndumpsanitizer.h
+ *
+ ******************************************************************************/
+
+// The node pool is global, so only one dump can be loaded at a time.
+static model *loaded_model = NULL;
+
+// What sds_run has opened and allocated, apart from the model.
+typedef struct {
+	output *outs;
+	int out_len;
+	int resume;
+	checkpoint ckpt;
+	extent_plan extents;
+	plan_result *results;
+	verifier ver;
+	int verifying; // Whether ver has been started, and not yet finished
+} run;
+
+// What a library function was in the middle of when it failed, so that it can be freed.
+// The model being loaded holds the infile and everything in the global node pool, path
+// index and memory arena.
+static model *pending_model = NULL;
+static output *pending_output = NULL;
+static run *pending_run = NULL;
 
-	if (mi_len > 0) {
-		act_mi = 0;
+static void free_run(run *r) {
+	int i, o;
+	// The workers verifying the checksums are stopped before anything else goes.
+	if (r->verifying) {
+		free_verifier(&r->ver);
 	}
-	
-	for (i = 0; i < rev_len; ++i) {
-		print_progress(messages, "Analyzing revision", i);
-		merge = -1;
-		for (j = 0; j < revisions[i].size; ++j) {
-			add_event(&rt, &revisions[i].nodes[j]);
-			// Some add nodes need this...
-			if (revisions[i].nodes[j].action == ADD) {
-				add_dir_dep_to_node(&rt, &revisions[i].nodes[j], i);
-				add_file_dep_to_node(&rt, &revisions[i].nodes[j]);
-			}
-			if (act_mi >= 0 && mi[act_mi].revision == i && mi[act_mi].node == j) {
-				merge = act_mi;
-				++act_mi;
-				if (act_mi == mi_len) {
-					act_mi = -1;
-				}
+	for (o = 0; o < r->out_len; ++o) {
+		if (r->outs[o].file && r->outs[o].file != stdout) {
+			fclose(r->outs[o].file);
+		}
+		if (r->outs[o].manifest) {
+			fclose(r->outs[o].manifest);
+		}
+		// Only the deletes loaded from a checkpoint have paths of their own.
+		for (i = 0; i < r->outs[o].del_len && r->resume; ++i) {
+			free(r->outs[o].to_delete[i]);
+		}
+		free_output(&r->outs[o]);
+	}
+	if (r->ckpt.file) {
+		fclose(r->ckpt.file);
+	}
+	free(r->ckpt.offsets);
+	free(r->results);
+	free(r->outs);
+	free_extent_plan(&r->extents);
+	max_threads = 0;
+	mem.limit = 0;
+}
+
+// Frees what the library function that just failed was working on, so that the next call
+// starts from a clean slate.
+static void recover(void) {
+	if (opening) {
+		close_input(opening);
+		opening = NULL;
+	}
+	if (pending_output) {
+		free_output(pending_output);
+		free(pending_output);
+		pending_output = NULL;
+	}
+	if (pending_run) {
+		free_run(pending_run);
+		pending_run = NULL;
+	}
+	if (pending_model) {
+		free_model(pending_model);
+		free(pending_model);
+		pending_model = NULL;
+		memset(&stats, 0, sizeof(stats));
+	}
+}
+
+// Every API function that can fail starts with this. An error anywhere below it comes back
+// here through exit_with_error, and the function returns the exit code as error code.
+#define CATCH_ERRORS(jump, code) \
+	if ((code = setjmp(jump)) != 0) { \
+		error_jump = NULL; \
+		recover(); \
+		return code; \
+	} \
+	error_jump = &jump;
+
+// Starts a model of the dump in the infiles. It's pending until it has been read and
+// analyzed.
+static model* open_model(char **paths, int len) {
+	model *m;
+	if (loaded_model) {
+		exit_with_error("Only one dump can be loaded at a time", 1);
+	}
+	if ((m = (model*)malloc(sizeof(model))) == NULL) {
+		exit_with_error("malloc failed", 2);
+	}
+	memset(&stats, 0, sizeof(stats));
+	init_model(m, NULL);
+	pending_model = m;
+	m->infile = open_input(paths, len);
+	return m;
+}
+
+// Sets up an output with the filter, which is checked like the one given on the command line.
+static void init_output_with(output *out, const sds_filter *f) {
+	int i;
+	init_output(out);
+	for (i = 0; i < f->inc_len; ++i) {
+		add_filter_path(&out->filt.include, &out->filt.inc_len, (char*)f->include[i]);
+	}
+	for (i = 0; i < f->exc_len; ++i) {
+		add_filter_path(&out->filt.exclude, &out->filt.exc_len, (char*)f->exclude[i]);
+	}
+	out->filt.redefined_root = (char*)f->redefined_root;
+	out->drop_empty = f->drop_empty;
+	out->add_delete = f->add_delete;
+	check_filter(&out->filt);
+	build_filter_slashes(&out->filt);
+}
+
+const char* sds_version(void) {
+	return SDS_VERSION;
+}
+
+const char* sds_error(void) {
+	return error_message;
+}
+
+void sds_init_options(sds_options *options) {
+	memset(options, 0, sizeof(sds_options));
+}
+
+int sds_load(const char *infile, sds_model **model_out) {
+	jmp_buf jump;
+	int code;
+	model *m;
+	char *path;
+	progress quiet;
+	*model_out = NULL;
+	CATCH_ERRORS(jump, code);
+	path = (char*)infile;
+	m = open_model(&path, 1);
+	init_progress(&quiet, NULL, NULL, 0);
+	load_dump(m, 0, &quiet, stderr);
+	pending_model = NULL;
+	loaded_model = m;
+	*model_out = m;
+	error_jump = NULL;
+	return SDS_OK;
+}
+
+int sds_select(sds_model *m, const sds_filter *f, sds_output **output_out) {
+	jmp_buf jump;
+	int code;
+	output *out;
+	progress quiet;
+	*output_out = NULL;
+	CATCH_ERRORS(jump, code);
+	if ((out = (output*)calloc(1, sizeof(output))) == NULL) {
+		exit_with_error("calloc failed", 2);
+	}
+	pending_output = out;
+	init_output_with(out, f);
+	init_progress(&quiet, NULL, NULL, 0);
+	mark_output(m, out, &quiet);
+	finish_output(m, out, &quiet);
+	pending_output = NULL;
+	*output_out = out;
+	error_jump = NULL;
+	return SDS_OK;
+}
+
+int sds_root_redefined(const sds_output *out) {
+	return out->filt.redefined_root != NULL;
+}
+
+int sds_write(sds_model *m, sds_output **outputs, FILE **files, int len) {
+	jmp_buf jump;
+	int code, i;
+	output *outs;
+	checkpoint cp;
+	progress quiet;
+	extent_plan plan;
+	CATCH_ERRORS(jump, code);
+	// The outputs are written side by side, like with --split.
+	if ((outs = (output*)malloc(len * sizeof(output) + 1)) == NULL) {
+		exit_with_error("malloc failed", 2);
+	}
+	for (i = 0; i < len; ++i) {
+		outs[i] = *outputs[i];
+		outs[i].file = files[i];
+		outs[i].writing = 1;
+		outs[i].toggle = 0;
+	}
+	init_checkpoint(&cp);
+	init_progress(&quiet, NULL, NULL, 0);
+	build_extent_plan(&plan, m->revisions, m->rev_len, outs, len, m->mi, m->mi_len, 0);
+	write_outputs(m->infile, outs, len, m->rev_len, m->mi, m->mi_len, &plan, &cp, NULL, &quiet);
+	free_extent_plan(&plan);
+	free(outs);
+	error_jump = NULL;
+	return SDS_OK;
+}
+
+void sds_free_output(sds_output *out) {
+	if (out) {
+		free_output(out);
+		free(out);
+	}
+}
+
+void sds_free_model(sds_model *m) {
+	if (m) {
+		free_model(m);
+		free(m);
+		if (loaded_model == m) {
+			loaded_model = NULL;
+		}
+	}
+}
+
+// Does the job of sds_run, keeping what it opens and allocates in r.
+static int run_job(const sds_job *job, run *r) {
+	int i, o;
+	int to_stdout = 0;
+	int chunked = job->chunk_revisions > 0 || job->chunk_size > 0;
+	int exit_code = SDS_OK;
+	char *temp_str;
+	FILE *messages = job->options.messages;
+	FILE *warnings = messages ? messages : stderr;
+	output *outs;
+	model *m;
+	progress prog;
+	memset(r, 0, sizeof(run));
+	init_checkpoint(&r->ckpt);
+	init_extent_plan(&r->extents);
+	r->resume = job->resume;
+	pending_run = r;
+	if (job->in_len == 0) {
+		exit_with_error("You must specify an infile", 1);
+	}
+#ifdef _WIN32
+	if (job->options.memory_limit > 0) {
+		exit_with_error("--memory-limit is not supported on this platform", 1);
+	}
+#endif
+	mem.limit = job->options.memory_limit;
+	max_threads = job->options.threads;
+	m = open_model((char**)job->infiles, job->in_len);
+	if (job->query && m->infile->spill) {
+		exit_with_error("You may not use query when reading from stdin", 1);
+	}
+	if (job->profile_repo && (job->target_len > 0 || job->plan || job->query || job->checkpoint || job->export_plan)) {
+		exit_with_error("You may not use outfile, include, exclude, redefine root, query, split, plan, checkpoint, resume or export-plan with profile-repo", 1);
+	}
+	if (job->plan && (job->checkpoint || job->export_plan)) {
+		exit_with_error("You may not use checkpoint, resume or export-plan with plan", 1);
+	}
+	if (job->target_len == 0 && !job->profile_repo) {
+		exit_with_error("You must specify something to either include or exclude", 1);
+	}
+	// Nothing but the profile is written with it.
+	r->out_len = job->profile_repo ? 0 : job->target_len;
+	if ((r->outs = (output*)calloc(r->out_len + 1, sizeof(output))) == NULL) {
+		exit_with_error("calloc failed", 2);
+	}
+	outs = r->outs;
+	for (o = 0; o < r->out_len; ++o) {
+		init_output_with(&outs[o], &job->targets[o].filter);
+		outs[o].path = (char*)job->targets[o].outfile;
+		outs[o].chunk_revisions = job->chunk_revisions;
+		outs[o].chunk_size = (off_t)job->chunk_size;
+		// When planning the outfile just names the candidate.
+		to_stdout |= outs[o].path == NULL && !job->plan;
+	}
+	if (to_stdout && r->out_len > 1) {
+		exit_with_error("Only one output can be written to stdout", 1);
+	}
+	if (job->checkpoint && (to_stdout || m->infile->spill)) {
+		exit_with_error("You may not use checkpoint or resume when reading from stdin or writing to stdout", 1);
+	}
+	if (job->resume && (job->query || job->stats)) {
+		exit_with_error("You may not use query or stats with resume", 1);
+	}
+	if (chunked && (to_stdout || job->plan || job->profile_repo || job->checkpoint)) {
+		exit_with_error("You may not use split-output-every when writing to stdout, or with plan, checkpoint or resume", 1);
+	}
+	// The outfiles are opened only now, so that they aren't truncated before we know whether we are resuming.
+	for (o = 0; o < r->out_len && !job->plan; ++o) {
+		if (to_stdout) {
+			outs[o].file = stdout;
+// Without this output may be corrupted on windows.
+#ifdef _WIN32
+			_setmode(_fileno(stdout), _O_BINARY);
+#endif
+		}
+		else if (chunked) {
+			temp_str = str_malloc(strlen(outs[o].path) + 10);
+			sprintf(temp_str, "%s.manifest", outs[o].path);
+			if ((outs[o].manifest = fopen(temp_str, "w")) == NULL) {
+				exit_with_file_error(temp_str, " can not be opened as manifest", 3);
 			}
-			if (merge >= 0) {
-				for (k = 0; k < mi[merge].data->size; ++k) {
-					add_merge_dep_to_node(&rt, &revisions[i].nodes[j], mi[merge].data->path[k], revisions[i].nodes[mi[merge].node].path, mi[merge].data->to[k]);
-				}
+			free(temp_str);
+			fprintf(outs[o].manifest, "# file first_revision last_revision sha1\n");
+			if (open_chunk(&outs[o]) == NULL) {
+				exit_with_file_error(outs[o].path, " can not be opened as outfile", 3);
 			}
-			// Copyfrom and delete events can affect entire subtrees. This is dealt with here.
-			if (revisions[i].nodes[j].copyfrom || revisions[i].nodes[j].action == DELETE) {
-				if (revisions[i].nodes[j].copyfrom) {
-					subtree = get_subtree(&rt, revisions[i].nodes[j].copyfrom, 1);
-					node_ptr = get_relevant_nodes_at_revision(subtree, revisions[i].nodes[j].copyfrom_rev, 0, &temp_int);
-				}
-				else {
-					subtree = get_subtree(&rt, revisions[i].nodes[j].path, 1);
-					node_ptr = get_relevant_nodes_at_revision(subtree, i, 0, &temp_int);
-				}
-				if (temp_int == 0) {
-					continue;
-				}
-				if ((revisions[i].fakes = (node**)realloc(revisions[i].fakes, (revisions[i].fake_size + temp_int) * sizeof(node*))) == NULL) {
-					exit_with_error("realloc failed", 2);
-				}
-				for (k = 0; k < temp_int; ++k) {
-					if ((current_node = (node*)malloc(sizeof(node))) == NULL) {
-						exit_with_error("malloc failed", 2);
-					}
-					init_new_node(current_node);
-					current_node->revision = i;
-					current_node->action = revisions[i].nodes[j].action;
-					current_node->wanted = want_by_default;
-					if (revisions[i].nodes[j].copyfrom) {
-						current_node->copyfrom = node_ptr[k]->path;
-						current_node->copyfrom_rev = node_ptr[k]->revision;
-						current_node->path = get_dir_after_copyfrom(revisions[i].nodes[j].path, node_ptr[k]->path, revisions[i].nodes[j].copyfrom);
-					}
-					else {
-						current_node->path = node_ptr[k]->path;
-					}
-					add_event(&rt, current_node);
-					add_dependency(&revisions[i].nodes[j], current_node); // Dependency on the node that affects the subtree
-					if (revisions[i].nodes[j].copyfrom) {
-						add_dependency(node_ptr[k], current_node); // File dependency
-						add_dir_dep_to_node(&rt, current_node, i); // Dir dependency
-					}
-					revisions[i].fakes[revisions[i].fake_size] = current_node;
-					++revisions[i].fake_size;
-				}
-				free(node_ptr);
+		}
+		else if ((outs[o].file = fopen(outs[o].path, job->resume ? "r+b" : "wb")) == NULL) {
+			exit_with_file_error(outs[o].path, " can not be opened as outfile", 3);
+		}
+	}
+	init_progress(&prog, messages, job->options.machine, m->infile->size);
+	if (job->profile_repo) {
+		read_dump(m, 1, &prog, warnings);
+		profile_repo(job->profile_repo, m->revisions, m->rev_len, m->mi, m->mi_len, m->content_sizes);
+		goto finish;
+	}
+	if (job->checkpoint) {
+		r->ckpt.path = (char*)job->checkpoint;
+		if ((r->ckpt.file = fopen(r->ckpt.path, job->resume ? "r+b" : "wb")) == NULL) {
+			exit_with_file_error(r->ckpt.path, " can not be opened as checkpoint", 3);
+		}
+		if ((r->ckpt.offsets = (off_t*)calloc(r->out_len, sizeof(off_t))) == NULL) {
+			exit_with_error("calloc failed", 2);
+		}
+		temp_str = get_checkpoint_options(m->infile->size, outs, r->out_len);
+		if (job->resume) {
+			m->mi = load_checkpoint(&r->ckpt, temp_str, outs, r->out_len, &m->rev_len, &m->mi_len, &r->extents);
+			free(temp_str);
+			// Nothing but the number of revisions is known about them.
+			free(m->revisions);
+			if ((m->revisions = (revision*)calloc(m->rev_len + 1, sizeof(revision))) == NULL) {
+				exit_with_error("calloc failed", 2);
+			}
+			// The texts in the extents that would be copied have to be checked too.
+			for (i = 0; i < r->extents.len && job->verify_checksums; ++i) {
+				r->extents.extents[i].copy = 0;
+			}
+			if (messages) {
+				fprintf(messages, "Resuming from revision %d.\n", r->ckpt.rev + 1);
 			}
+			goto write_outfile;
+		}
+		start_checkpoint(&r->ckpt, temp_str);
+		free(temp_str);
+	}
+	// Plain include filters may not need the dependencies at all.
+	if (!job->plan && !job->query && !job->stats) {
+		load_dump_for(m, outs, r->out_len, &prog, warnings);
+	}
+	else {
+		load_dump(m, job->plan != NULL, &prog, warnings);
+	}
+
+	if (job->plan) {
+		if ((r->results = (plan_result*)malloc(r->out_len * sizeof(plan_result))) == NULL) {
+			exit_with_error("malloc failed", 2);
+		}
+		evaluate_plans(&m->rt, m->revisions, m->rev_len, outs, r->out_len, m->content_sizes, r->results);
+		write_plan(job->plan, outs, r->out_len, r->results);
+		goto finish;
+	}
+
+	// Analyze what to keep
+	for (o = 0; o < r->out_len; ++o) {
+		if (!outs[o].crosses) {
+			select_prefix(m, &outs[o], &prog);
+			continue;
+		}
+		mark_output(m, &outs[o], &prog);
+		// If user wants to question the reason for files being included, we do that now.
+		if (job->query && !query_wanted(m, &outs[o].filt)) {
+			goto cleanup;
+		}
+		finish_output(m, &outs[o], &prog);
+	}
+	build_extent_plan(&r->extents, m->revisions, m->rev_len, outs, r->out_len, m->mi, m->mi_len, job->verify_checksums);
+	if (r->ckpt.file) {
+		save_checkpoint(&r->ckpt, m->revisions, m->rev_len, outs, r->out_len, m->mi, m->mi_len, &r->extents);
+	}
+
+	// Write the outfiles
+ write_outfile:
+	if (job->export_plan) {
+		export_extent_plan(job->export_plan, &r->extents);
+	}
+	if (job->verify_checksums) {
+		init_verifier(&r->ver, get_threads());
+		r->verifying = 1;
+	}
+	if (chunked) {
+		read_chunk_header(m->infile, outs, r->out_len, m->rev_len > 0 ? m->revisions[0].offset : 0);
+	}
+	write_outputs(m->infile, outs, r->out_len, m->rev_len, m->mi, m->mi_len, &r->extents, &r->ckpt, job->verify_checksums ? &r->ver : NULL, &prog);
+	finish_chunks(outs, r->out_len);
+	if (r->ckpt.file) {
+		finish_checkpoint(&r->ckpt, outs, r->out_len);
+	}
+	r->verifying = 0;
+	if (job->verify_checksums && finish_verifier(&r->ver, warnings) > 0) {
+		snprintf(error_message, sizeof(error_message), "Some checksums did not match");
+		exit_code = SDS_ERROR_FILE;
+	}
+
+ finish:
+	if (job->stats) {
+		write_stats(job->stats, &m->rt, m->revisions, m->rev_len, m->rev_max, m->mi, m->mi_len, outs, r->out_len);
+	}
+	if (messages) {
+		print_phase_summary(&prog);
+		fprintf(messages, "\nAll done.\n");
+	}
+ cleanup:
+	for (o = 0; o < r->out_len; ++o) {
+		if (outs[o].file == stdout) {
+			fflush(stdout);
+			outs[o].file = NULL;
+		}
+	}
+	free_run(r);
+	pending_run = NULL;
+	free_model(m);
+	free(m);
+	pending_model = NULL;
+	return exit_code;
+}
+
+int sds_run(const sds_job *job) {
+	jmp_buf jump;
+	int code;
+	run r;
+	// The command line tool exits on errors.
+	if (!job->options.exit_on_error) {
+		CATCH_ERRORS(jump, code);
+	}
+	code = run_job(job, &r);
+	error_jump = NULL;
+	return code;
+}
+
+/*******************************************************************************
+ *
+ * Command line
+ *
+ ******************************************************************************/
+
+#ifndef SDS_LIBRARY
+// Appends path to the infiles or the paths of a filter given on the command line.
+static void append_path(const char ***paths, int *len, char *path) {
+	if ((*paths = (const char**)realloc(*paths, (*len + 1) * sizeof(char*))) == NULL) {
+		exit_with_error("realloc failed", 2);
+	}
+	(*paths)[(*len)++] = path;
+}
+
+static void show_help_and_exit() {
+	printf("svndumpsanitizer usage:\n\n");
+	printf("svndumpsanitizer [-i, --infile INFILE...] [-o, --outfile OUTFILE] [OPTIONS]\n\n");
+	printf("INFILE is mandatory; OUTFILE is optional. If omitted the output will be printed to\n");
+	printf("stdout. If INFILE is \"-\" the dump is read from stdin. Because svndumpsanitizer needs\n");
+	printf("the data twice (once for analyzing, once for copying the selected parts) everything read\n");
+	printf("from stdin is spooled to a temporary spill file, which will need as much disk space as the\n");
+	printf("dump itself. The spill file is created in TMPDIR (or /tmp) and removed automatically.\n\n");
+	printf("INFILE may also be several files, e.g. the slices of an incremental dump, which are\n");
+	printf("then read one after the other in the given order, as if they were one file. The dump\n");
+	printf("header the files after the first start with is skipped. An INFILE of \"@LIST\" reads the\n");
+	printf("paths of the files from LIST, one per line.\n\n");
+	printf("An INFILE compressed with bgzip, or with zstd in the seekable format, is read as it is,\n");
+	printf("decompressing only the parts needed, on several threads. This needs a build with\n");
+	printf("HAVE_ZLIB (for bgzip) or HAVE_ZSTD defined.\n\n");
+	printf("OPTIONS\n");
+	printf("\t-n, --include [PATHS]\n");
+	printf("\t\tList of repository paths to include.\n\n");
+	printf("\t-e, --exclude [PATHS]\n");
+	printf("\t\tList of repository paths to exclude.\n\n");
+	printf("\t\tYou must specify at least one path to include OR at least one path to exclude\n");
+	printf("\t\tYou may not specify includes and excludes at the same time.\n\n");
+	printf("\t\tPATHS are space separated paths as they appear in the svn repository\n");
+	printf("\t\twithout leading or trailing slashes. E.g. \"-n trunk/foo/bar branches/baz\".\n\n");
+	printf("\t\tThe only exception to this are directories in the repository root that start with a\n");
+	printf("\t\thyphen. In order to not have this hyphen misinterpreted as a command, it must be\n");
+	printf("\t\tescaped using a slash. E.g. \"-n /--foobar branches/baz\". Please notice that only\n");
+	printf("\t\ta leading hyphen should be escaped, and only for the repository root.\n\n");
+	printf("\t-d, --drop-empty\n");
+	printf("\t\tAny revision that after sanitizing, contains no actions will be dropped altogether.\n");
+	printf("\t\tThe remaining revisions will be renumbered. You will lose the commit messages for\n");
+	printf("\t\tthe dropped revisions.\n\n");
+	printf("\t-a, --add-delete\n");
+	printf("\t\tAutomatically add a deleting revision to the end of the file that removes stuff that\n");
+	printf("\t\tsvndumpsanitizer has been forced to keep due to dependencies, but actually resides in\n");
+	printf("\t\tdirectories the user has specified he doesn't want. If no such files exist, no revision\n");
+	printf("\t\twill be added. This was the default behavior prior to version 2.\n\n");
+	printf("\t-r, --redefine-root [PATH]\n");
+	printf("\t\tRedefines the repository root. This option can only be used with the include option.\n");
+	printf("\t\tThe path provided to this option must be the beginning of (or the whole) path\n");
+	printf("\t\tprovided to the include option. If more than one path is provided you can provide\n");
+	printf("\t\ta path only up to the point where the paths diverge. The operation is not guaranteed\n");
+	printf("\t\tto succeed on every repository. If the repository layout prevents redefining, a warning\n");
+	printf("\t\twill be displayed, and the sanitizing will be performed without changing any paths.\n\n");
+	printf("\t\tE.g.\n\t\t\"-n foo/bar/trunk -r foo/bar\" - OK. (This is probably the typical case.)\n");
+	printf("\t\t\"-n foo/bar/trunk -r foo/bar/trunk\" - OK.\n");
+	printf("\t\t\"-n foo/bar/trunk foo/baz/trunk -r foo\" - OK.\n");
+	printf("\t\t\"-n foo/bar/trunk foo/baz/trunk -r foo/bar\" - WRONG.\n\n");
+	printf("\t-s, --split SPEC\n");
+	printf("\t\tWrite several sanitized dumps in one run. The infile is read and analyzed once, and\n");
+	printf("\t\tall the outfiles are written during the same read of the infile. SPEC is a file with\n");
+	printf("\t\tone line per outfile: the outfile, the paths to include and optionally \"-r PATH\" to\n");
+	printf("\t\tredefine the root. Empty lines and lines starting with # are ignored. E.g.\n");
+	printf("\t\t\"repo1.dump trunk/repo1 branches/repo1 -r trunk/repo1\"\n");
+	printf("\t\t--drop-empty and --add-delete apply to every outfile. This option can not be combined\n");
+	printf("\t\twith --outfile, --include, --exclude, --redefine-root or --query.\n\n");
+	printf("\t--plan SPEC\n");
+	printf("\t\tStop after the analysis, and report what each candidate in SPEC would keep: the\n");
+	printf("\t\tnumber of revisions that aren't empty, the number of nodes, the content bytes of the\n");
+	printf("\t\tnodes, how many of those bytes are kept only because of dependencies (i.e. are outside\n");
+	printf("\t\tthe paths included), how many paths --add-delete would delete, and whether the root\n");
+	printf("\t\tcould be redefined. SPEC has the same format as for --split, except that the first\n");
+	printf("\t\ttoken of each line is only used as the name of the candidate. Nothing is written. The\n");
+	printf("\t\tcandidates are evaluated in parallel, each in a process of its own, as many at a time\n");
+	printf("\t\tas there are processors. On Windows and with --memory-limit they are evaluated one\n");
+	printf("\t\tafter another.\n\n");
+	printf("\t--split-output-every N|SIZE\n");
+	printf("\t\tWrite each outfile as a numbered series of files, OUTFILE.000, OUTFILE.001 and so on,\n");
+	printf("\t\tstarting a new one after every N revisions, or at the first revision after the file has\n");
+	printf("\t\tgrown to SIZE (e.g. 10G). Every file starts with the dump header, so each one after the\n");
+	printf("\t\tfirst is a valid incremental dump, to be loaded in order. OUTFILE.manifest gets a line\n");
+	printf("\t\tfor every file: its name, its first and last revision and its SHA-1 checksum. Can not\n");
+	printf("\t\tbe used with stdout, --checkpoint or --resume.\n\n");
+	printf("\t--progress-fd FD\n");
+	printf("\t\tAlso write the progress in a machine readable form to the file descriptor FD. One\n");
+	printf("\t\tline of space separated key=value pairs is written each time the progress is updated,\n");
+	printf("\t\tstarting with \"progress\" during the phases and with \"summary\" at the end.\n\n");
+	printf("\t--memory-limit SIZE\n");
+	printf("\t\tKeep the memory use of the analysis within SIZE (e.g. 512M or 16G). Once the limit is\n");
+	printf("\t\texceeded, the nodes and their dependencies are moved to a temporary file in TMPDIR\n");
+	printf("\t\t(or /tmp), which is memory mapped. The sanitizing will be slower, but it won't run out of\n");
+	printf("\t\tmemory. The temporary file can grow as large as the analysis data. Not available on Windows.\n\n");
+	printf("\t--threads N\n");
+	printf("\t\tThe number of threads used for marking the nodes to keep. The default is one per\n");
+	printf("\t\tprocessor. With more than one, the infile is also read in a thread of its own while the\n");
+	printf("\t\trevisions already read are analyzed. The result is the same whatever the number. Not\n");
+	printf("\t\tavailable on Windows.\n\n");
+	printf("\t--verify-checksums\n");
+	printf("\t\tCheck the text of every node written against its Text-content-md5 and Text-content-sha1\n");
+	printf("\t\tchecksums, and report the revision and path of every node that doesn't match. The exit\n");
+	printf("\t\tstatus is then 3. The hashing is done in parallel with the writing, on as many threads as\n");
+	printf("\t\t--threads allows. Deltas are not checked, since their checksums are of the full text.\n\n");
+	printf("\t--checkpoint FILE\n");
+	printf("\t\tSave the result of the analysis to FILE, and while writing, every %.0f seconds the\n", CHECKPOINT_INTERVAL);
+	printf("\t\tposition reached. If the run is interrupted, it can be continued with --resume.\n");
+	printf("\t\tFILE is removed when the run is done. Can not be used with stdin or stdout.\n\n");
+	printf("\t--resume FILE\n");
+	printf("\t\tContinue a run that was interrupted, using the checkpoint FILE. The command must\n");
+	printf("\t\tbe the same as for the interrupted run, except --resume instead of --checkpoint. The\n");
+	printf("\t\toutfiles are cut back to the last saved position and writing continues from there,\n");
+	printf("\t\twithout reading and analyzing the infile again. Can not be used with --query or --stats.\n\n");
+	printf("\t--stats FILE\n");
+	printf("\t\tWrite statistics about the analysis to FILE as JSON: the number of nodes, fake nodes\n");
+	printf("\t\tand dependencies of each kind, the shape of the repository tree, how many times the\n");
+	printf("\t\tcostliest lookups were made, and the number of bytes used by each data structure.\n\n");
+	printf("\t--profile-repo FILE\n");
+	printf("\t\tOnly read the infile, and write a profile of the repository to FILE, for planning what\n");
+	printf("\t\tto include. For the root and every path down to %d levels below it, the report tells\n", PROFILE_DEPTH);
+	printf("\t\thow many nodes there are in it, the content bytes of those nodes, the revisions with\n");
+	printf("\t\tnodes in it, how many nodes were copied into it from another top level directory and out\n");
+	printf("\t\tof it to another one, how many mergeinfo properties were set in it, and how many\n");
+	printf("\t\tmergeinfo rows name a source in it. Nothing is analyzed or written.\n\n");
+	printf("\t--export-plan FILE\n");
+	printf("\t\tWrite the plan for writing the outfiles to FILE. Runs of revisions that every outfile\n");
+	printf("\t\tkeeps exactly as they are in the infile are copied as they are; the rest is rewritten\n");
+	printf("\t\tline by line. FILE has one line per run: \"copy\" or \"rewrite\", the offsets in the\n");
+	printf("\t\tinfile where the run starts and ends, its first and last revision (-1 for the header of\n");
+	printf("\t\tthe dump) and its number of nodes.\n\n");
+	printf("\t-q, --query\n");
+	printf("\t\tOption used mostly for debugging purposes. If passed, svndumpsanitizer will after\n");
+	printf("\t\treading and analyzing (but before writing) enter an interactive state where the user\n");
+	printf("\t\tcan query the rationale why specific files are being included with the given options.\n");
+	printf("\t\tThis query will locate the *first* dependency it can find that will include the file,\n");
+	printf("\t\tnot all the dependencies, which might be numerous. When done, one can opt to either\n");
+	printf("\t\tquit or proceed with writing the outfile.\n\n");
+	printf("\t-v, --version\n");
+	printf("\t\tPrint version and exit.\n");
+	exit(0);
+}
+
+static void show_version_and_exit() {
+	printf("svndumpsanitizer %s\n", SDS_VERSION);
+	exit(0);
+}
+
+// Reads a manifest listing infiles in the order they should be read. Every line that isn't
+// empty or a comment (starting with #) is the path of one infile. The paths are appended to
+// paths, and point into "contents".
+static int read_manifest(char *path, char **contents, const char ***paths, int *len) {
+	FILE *f;
+	char *line, *next;
+	long size, i;
+	if ((f = fopen(path, "rb")) == NULL) {
+		return 0;
+	}
+	fseek(f, 0, SEEK_END);
+	size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	*contents = str_malloc(size + 1);
+	size = fread(*contents, 1, size, f);
+	(*contents)[size] = '\0';
+	fclose(f);
+	for (i = 0; i < size; ++i) {
+		if ((*contents)[i] == '\r' || (*contents)[i] == NEWLINE) {
+			(*contents)[i] = '\0';
+		}
+	}
+	for (line = *contents; line < *contents + size; line = next) {
+		next = line + strlen(line) + 1;
+		if (line[0] == '\0' || line[0] == '#') {
+			continue;
 		}
+		append_path(paths, len, line);
+	}
+	return 1;
+}
+
+// Parses a size such as 512M or 4G. Returns -1 if the size is invalid.
+static long long parse_size(char *str) {
+	char *end;
+	long long size = strtoll(str, &end, 10);
+	if (end == str || size < 0) {
+		return -1;
+	}
+	switch (*end) {
+		case 'k': case 'K': size <<= 10; ++end; break;
+		case 'm': case 'M': size <<= 20; ++end; break;
+		case 'g': case 'G': size <<= 30; ++end; break;
+		case 't': case 'T': size <<= 40; ++end; break;
 	}
+	if (*end == 'B' || *end == 'b') {
+		++end;
+	}
+	return *end == '\0' ? size : -1;
+}
 
-	/***********************************************************************************
-	 *
-	 * Analyze what to keep
-	 *
-	 ***********************************************************************************/
+// Terminates and returns the next space separated token in the line, or NULL if there are none.
+static char* next_token(char **pos) {
+	char *token;
+	while (**pos == ' ' || **pos == '\t') {
+		++*pos;
+	}
+	if (**pos == '\0') {
+		return NULL;
+	}
+	token = *pos;
+	while (**pos != ' ' && **pos != '\t' && **pos != '\0') {
+		++*pos;
+	}
+	if (**pos != '\0') {
+		**pos = '\0';
+		++*pos;
+	}
+	return token;
+}
 
-	// Include strategy
-	if (include) {
-		if ((inc_slash = (char**)malloc(inc_len * sizeof(char*))) == NULL) {
-			exit_with_error("malloc failed", 2);
-		}
-		for (i = 0; i < inc_len; ++i) {
-			inc_slash[i] = add_slash_to(include[i]);
-		}
-		for (i = rev_len - 1; i > 0; --i) {
-			for (j = 0; j < revisions[i].size; ++j) {
-				if (is_cluded(revisions[i].nodes[j].path, include, inc_slash, inc_len)) {
-					set_wanted(&revisions[i].nodes[j]);
-				}
-			}
-			for (j = 0; j < revisions[i].fake_size; ++j) {
-				if (is_cluded(revisions[i].fakes[j]->path, include, inc_slash, inc_len)) {
-					set_wanted(revisions[i].fakes[j]);
-				}
-			}
+// Reads a split specification. Every line that isn't empty or a comment (starting with #)
+// describes one output: the outfile followed by the paths to include, and optionally
+// "-r PATH" to redefine the root. E.g. "repo1.dump trunk/repo1 branches/repo1 -r trunk/repo1"
+// The contents are kept in "spec", since the targets point into it.
+static sds_target* read_split_spec(char *path, char **spec, int *out_len) {
+	FILE *f;
+	sds_target *targets = NULL;
+	sds_target *t;
+	char *line, *next, *pos, *token;
+	long size, i;
+	int redef;
+	*out_len = 0;
+	if ((f = fopen(path, "rb")) == NULL) {
+		return NULL;
+	}
+	fseek(f, 0, SEEK_END);
+	size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	*spec = str_malloc(size + 1);
+	size = fread(*spec, 1, size, f);
+	(*spec)[size] = '\0';
+	fclose(f);
+	for (i = 0; i < size; ++i) {
+		if ((*spec)[i] == '\r' || (*spec)[i] == NEWLINE) {
+			(*spec)[i] = '\0';
 		}
 	}
-	// Exclude strategy
-	else {
-		if ((exc_slash = (char**)malloc(exc_len * sizeof(char*))) == NULL) {
-			exit_with_error("malloc failed", 2);
+	for (line = *spec; line < *spec + size; line = next) {
+		next = line + strlen(line) + 1;
+		pos = line;
+		token = next_token(&pos);
+		if (token == NULL || token[0] == '#') {
+			continue;
 		}
-		for (i = 0; i < exc_len; ++i) {
-			exc_slash[i] = add_slash_to(exclude[i]);
+		if ((targets = (sds_target*)realloc(targets, (*out_len + 1) * sizeof(sds_target))) == NULL) {
+			exit_with_error("realloc failed", 2);
 		}
-		parse_exclude_preparation(revisions, exclude, exc_slash, rev_len, exc_len);
-		for (i = rev_len - 1; i > 0; --i) {
-			for (j = 0; j < revisions[i].size; ++j) {
-				if (!is_cluded(revisions[i].nodes[j].path, exclude, exc_slash, exc_len)) {
-					set_wanted(&revisions[i].nodes[j]);
-				}
+		t = &targets[(*out_len)++];
+		memset(t, 0, sizeof(sds_target));
+		t->outfile = token;
+		redef = 0;
+		while ((token = next_token(&pos)) != NULL) {
+			if (strcmp(token, "-r") == 0 || strcmp(token, "--redefine-root") == 0) {
+				redef = 1;
 			}
-		}
-		for (i = rev_len - 1; i > 0; --i) {
-			for (j = 0; j < revisions[i].fake_size; ++j) {
-				if (!is_cluded(revisions[i].fakes[j]->path, exclude, exc_slash, exc_len)) {
-					set_wanted(revisions[i].fakes[j]);
-				}
+			else if (redef && t->filter.redefined_root == NULL) {
+				t->filter.redefined_root = token;
+			}
+			else {
+				append_path(&t->filter.include, &t->filter.inc_len, token);
 			}
 		}
+		if (t->filter.inc_len == 0) {
+			exit_with_error("Every line of the split specification must include something", 1);
+		}
 	}
+	return targets;
+}
+
+/*******************************************************************************
+ *
+ * Main method
+ *
+ ******************************************************************************/
+
+int main(int argc, char **argv) {
+	// Misc temporary variables
+ 	int i, o;
+	int plan = 0;
+	int drop_empty = 0;
+	int add_delete = 0;
+	int exit_code;
+
+	// Variables to help analyze user input 
+	int in = 0;
+	int out = 0;
+	int incl = 0;
+	int excl = 0;
+	int drop = 0;
+	int redef = 0;
+	int del = 0;
+	int why = 0;
+	int split = 0;
+	int prog_fd = 0;
+	int stat = 0;
+	int mem_limit = 0;
+	int chkpt = 0;
+	int res = 0;
+	int plan_arg = 0;
+	int thr = 0;
+	int ver_arg = 0;
+	int exp = 0;
+	int prof = 0;
+	int every = 0;
+
+	// Variables related to files and paths
+	const char **infiles = NULL; // The paths of the infiles, which are read as one dump
+	int in_len = 0;
+	char *manifest = NULL;
+	char *outfile = NULL;
+	char *spec = NULL;
+	sds_target *split_targets = NULL;
+	int split_len = 0;
 
-	/***********************************************************************************
+	// What to do. Unless --split is used there is exactly one target.
+	sds_job job;
+	sds_target target;
+	sds_filter *filt = &target.filter;
+	memset(&job, 0, sizeof(job));
+	memset(&target, 0, sizeof(target));
+	sds_init_options(&job.options);
+	job.options.messages = stdout;
+	job.options.exit_on_error = 1;
+	
+	/*******************************************************************************
 	 *
-	 * If user wants to question the reason for files being included, we do that now.
+	 * Parameter analysis
 	 *
-	 ***********************************************************************************/
-	
-	if (query) {
-		maxp_len = get_max_path_size(&rt) + 10;
-		why_file = str_malloc(maxp_len);
-		do {
-			printf("\nPlease enter the full (case sensitive) path name you wish to inquire about\n\"/quit\" will exit program, and \"/write\" proceed with writing the outfile:\n");
-			fgets (why_file, maxp_len, stdin);
-			i = 0;
-			while (why_file[i] != NEWLINE && why_file[i] != '\0') {
-				++i;
-			}
-			why_file[i] = '\0';
-			if (strcmp(why_file, "/quit") == 0) {
-				free(why_file);
-				goto cleanup;
-			}
-			if (strcmp(why_file, "/write") == 0) {
-				free(why_file);
-				break;
+	 *******************************************************************************/
+
+	for (i = 1 ; i < argc ; ++i) {
+		if (starts_with(argv[i], "-") && strcmp(argv[i], "-") != 0) {
+			if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0) {
+				show_help_and_exit();
 			}
-			node_ptr = NULL;
-			temp_int = -1;
-			for (i = 0; i < rev_len; ++i) {
-				for (j = 0; j < revisions[i].size; ++j) {
-					if (revisions[i].nodes[j].wanted) {
-						if (!node_ptr) {
-							if (strcmp(revisions[i].nodes[j].path, why_file) == 0) {
-								if ((node_ptr = (node**)malloc(sizeof(node*))) == NULL) {
-									exit_with_error("malloc failed", 2);
-								}
-								++temp_int;
-								node_ptr[temp_int] = &revisions[i].nodes[j];
-							}
-						}
-						else {
-							for (k = 0; k < revisions[i].nodes[j].dep_len; ++k) {
-								if (revisions[i].nodes[j].deps[k] == node_ptr[temp_int]) {
-									++temp_int;
-									if ((node_ptr = (node**)realloc(node_ptr, (temp_int + 1) * sizeof(node*))) == NULL) {
-										exit_with_error("realloc failed", 2);
-									}
-									node_ptr[temp_int] = &revisions[i].nodes[j];
-									break;
-								}
-							}
-						}
-					}
-				}
-				for (j = 0; j < revisions[i].fake_size; ++j) {
-					if (revisions[i].fakes[j]->wanted) {
-						for (k = 0; k < revisions[i].fakes[j]->dep_len; ++k) {
-							if (node_ptr && revisions[i].fakes[j]->deps[k] == node_ptr[temp_int]) {
-								++temp_int;
-								if ((node_ptr = (node**)realloc(node_ptr, (temp_int + 1) * sizeof(node*))) == NULL) {
-									exit_with_error("realloc failed", 2);
-								}
-								node_ptr[temp_int] = revisions[i].fakes[j];
-								break;
-							}
-						}
-					}
-				}
+			if (strcmp(argv[i], "--version") == 0 || strcmp(argv[i], "-v") == 0) {
+				show_version_and_exit();
 			}
-			print_why(node_ptr, include, inc_slash, exclude, exc_slash, why_file, temp_int, inc_len, exc_len);
-			free(node_ptr);
-		}	while (1);
-	}
-	
-	// Restore wanted delete nodes
-	for (i = 0; i < rev_len; ++i) {
-		for (j = 0; j < revisions[i].size; ++j) {
-			if (revisions[i].nodes[j].action == DELETE && !revisions[i].nodes[j].wanted) {
-				restore_delete_node_if_needed(&rt, revisions, &revisions[i].nodes[j]);
+			in = (!strcmp(argv[i], "--infile") || !strcmp(argv[i], "-i"));
+			out = (!strcmp(argv[i], "--outfile") || !strcmp(argv[i], "-o"));
+			incl = (!strcmp(argv[i], "--include") || !strcmp(argv[i], "-n"));
+			excl = (!strcmp(argv[i], "--exclude") || !strcmp(argv[i], "-e"));
+			drop = (!strcmp(argv[i], "--drop-empty") || !strcmp(argv[i], "-d"));
+			redef = (!strcmp(argv[i], "--redefine-root") || !strcmp(argv[i], "-r"));
+			del = (!strcmp(argv[i], "--add-delete") || !strcmp(argv[i], "-a"));
+			why = (!strcmp(argv[i], "--query") || !strcmp(argv[i], "-q"));
+			split = (!strcmp(argv[i], "--split") || !strcmp(argv[i], "-s"));
+			prog_fd = !strcmp(argv[i], "--progress-fd");
+			stat = !strcmp(argv[i], "--stats");
+			mem_limit = !strcmp(argv[i], "--memory-limit");
+			chkpt = !strcmp(argv[i], "--checkpoint");
+			res = !strcmp(argv[i], "--resume");
+			plan_arg = !strcmp(argv[i], "--plan");
+			thr = !strcmp(argv[i], "--threads");
+			ver_arg = !strcmp(argv[i], "--verify-checksums");
+			exp = !strcmp(argv[i], "--export-plan");
+			prof = !strcmp(argv[i], "--profile-repo");
+			every = !strcmp(argv[i], "--split-output-every");
+			if (!(in || out || incl || excl || drop || redef || del || why || split || prog_fd || stat || mem_limit || chkpt || res || plan_arg || thr || ver_arg || exp || prof || every)) {
+				exit_with_error(strcat(argv[i], " is not a valid parameter. Use -h for help."), 1);
 			}
-		}
-	}
-
-	// Renumber the revisions if the empty ones are to be dropped
-	if (drop_empty) {
-		revisions[0].number = 0; // Revision 0 is special, and should never be dropped.
-		new_number = 1;
-		for (i = 1; i < rev_len; ++i) {
-			empty = 1;
-			for (j = 0; j < revisions[i].size; ++j) {
-				if (revisions[i].nodes[j].wanted) {
-					empty = 0;
-					break;
-				}
+			else if (drop) {
+				drop_empty = 1;
 			}
-			if (empty) {
-				revisions[i].number = -1;
+			else if (del) {
+				add_delete = 1;
 			}
-			else {
-				revisions[i].number = new_number;
-				++new_number;
+			else if (why) {
+				job.query = 1;
 			}
-		}
-	}
-	fprintf(messages, "\n");
-
-	// Remove any directory entries that should no longer exist with the redefined root
-	if (redefined_root) {
-		// First check whether the redefining even has a chance to succeed.
-		for (i = 0; i < rev_len; ++i) {
-			for (j = 0; j < revisions[i].size; ++j) {
-				if (revisions[i].nodes[j].copyfrom && revisions[i].nodes[j].wanted) {
-					// If we're trying to copy the (new) root directory itself from somewhere, it won't work.
-					if (strcmp(revisions[i].nodes[j].path, redefined_root) == 0) {
-						fprintf(stderr, "WARNING: Detected move operation of the redefined root directory.\n         Redefine operation will not be performed.\n");
-						redefined_root = NULL;
-						goto write_out;
-					}
-					// If we have a redefined root of "trunk/foo", and then try to do a copyfrom
-					// operation from "trunk", we're pretty much doomed...
-					temp_str = reduce_path(redefined_root, revisions[i].nodes[j].copyfrom);
-					if (strcmp(temp_str, "") == 0 && strcmp(redefined_root, revisions[i].nodes[j].copyfrom) != 0) {
-						fprintf(stderr, "WARNING: Critical files detected upstream of redefined root.\n         Redefine operation will not be performed.\n");
-						redefined_root = NULL;
-						free(temp_str);
-						goto write_out;
-					}
-					free(temp_str);
-				}
+			else if (ver_arg) {
+				job.verify_checksums = 1;
 			}
 		}
-		temp_int = 0;
-		for (i = rev_len - 1; i >= 0; --i) {
-			for (j = revisions[i].size - 1; j >= 0; --j) {
-				if (revisions[i].nodes[j].wanted) {
-					temp_str = add_slash_to(redefined_root);
-					for (k = strlen(temp_str) - 1; k > 0; --k) {
-						if (temp_str[k] == '/') {
-							temp_str[k] = '\0';
-							if (strcmp(temp_str, revisions[i].nodes[j].path) == 0) {
-								if (revisions[i].nodes[j].wanted) {
-									if ((redef_rollback = (node**)realloc(redef_rollback, (temp_int + 1) * sizeof(node*))) == NULL) {
-										exit_with_error("realloc failed", 2);
-									}
-									redef_rollback[temp_int] = &revisions[i].nodes[j];
-									++temp_int;
-								}
-								revisions[i].nodes[j].wanted = 0;
-							}
-						}
-					}
-					free(temp_str);
-				}
+		else if (in && starts_with(argv[i], "@")) {
+			if (manifest) {
+				exit_with_error("Only one manifest of infiles may be given", 1);
+			}
+			if (!read_manifest(&argv[i][1], &manifest, &infiles, &in_len)) {
+				exit_with_error(strcat(argv[i], " can not be opened as manifest"), 3);
 			}
 		}
-		// Check that there are no collisions, roll back if there are.
-		if (has_redefine_collisions(&rt, &rt, redefined_root)) {
-			fprintf(stderr, "WARNING: File collisions detected with redefined root.\n         Redefine operation will not be performed.\n");
-			redefined_root = NULL;
-			for (i = 0; i < temp_int; ++i) {
-				redef_rollback[i]->wanted = 1;
+		else if (in) {
+			append_path(&infiles, &in_len, argv[i]);
+		}
+		else if (out && outfile == NULL) {
+			outfile = argv[i];
+		}
+		else if (incl) {
+			append_path(&filt->include, &filt->inc_len, argv[i]);
+		}
+		else if (excl) {
+			append_path(&filt->exclude, &filt->exc_len, argv[i]);
+		}
+		else if (redef && filt->redefined_root == NULL) {
+			filt->redefined_root = argv[i];
+		}
+		else if (prog_fd && job.options.machine == NULL) {
+			if (atoi(argv[i]) <= 0 || (job.options.machine = fdopen(atoi(argv[i]), "w")) == NULL) {
+				exit_with_error(strcat(argv[i], " can not be opened as progress file descriptor"), 3);
 			}
 		}
-		free(redef_rollback);
-	}
-	
-	/***********************************************************************************
-	 *
-	 * Write the outfile
-	 *
-	 ***********************************************************************************/
- write_out:
-	if (mi_len > 0) {
-		act_mi = 0;
-	}
-	reading_node = 0;
-	fseeko(infile, 0, SEEK_SET); // Replaced "rewind(infile);" with this because (windows + huge files + rewind) == fail.
-	while ((ch = fgetc(infile)) != EOF) {
-		if (ch == NEWLINE) {
-			if (reading_node) {
-				if (strlen(current_line) == 0) {
-					reading_node = 0;
-					writing = 1;
-				}
-				else if (drop_empty && writing && starts_with(current_line, "Node-copyfrom-rev: ")) {
-					temp_int = atoi(&current_line[19]);
-					// It's possible for the copyfrom-rev argument to point to a revision that is being removed.
-					// If this is the case we change it to point to the first revision prior to it, that remains.
-					while (revisions[temp_int].number < 0) {
-						--temp_int;
-					}
-					fprintf(outfile, "Node-copyfrom-rev: %d\n", revisions[temp_int].number);
-					toggle = 1;
-				}
-				else if(writing && redefined_root && starts_with(current_line, "Node-copyfrom-path: ")) {
-					temp_str = reduce_path(redefined_root, &current_line[20]);
-					fprintf(outfile, "Node-copyfrom-path: %s\n", temp_str);
-					toggle = 1;
-					free(temp_str);	
-				}
-				else if (act_mi >= 0 && mi[act_mi].revision == rev && mi[act_mi].node == nod && starts_with(current_line, "Prop-content-length: ")) {
-					pcon_len = (off_t)atol(&current_line[21]);
-					toggle = 1;
-				}
-				else if (starts_with(current_line, "Content-length: ")) {
-					con_len = (off_t)atol(&current_line[16]);
-					if (writing) {
-						if (pcon_len) {
-							write_mergeinfo(outfile, mi[act_mi].data, revisions, redefined_root, mi[act_mi].orig_size, con_len, pcon_len);
-							// -10 is because of the "PROPS-END\n" that is included in orig_size.
-							fseeko(infile, mi[act_mi].orig_size - 10, SEEK_CUR);
-							while (fgetc(infile) != NEWLINE) {}
-							++act_mi;
-							if (act_mi == mi_len) {
-								act_mi = -1;
-							}
-						}
-						else {
-							fprintf(outfile, "%s\n", current_line);
-						}
-						for (offset = pcon_len; offset < con_len + CONTENT_PADDING; ++offset) {
-							fputc(fgetc(infile), outfile);
-						}
-					}
-					else {
-						fseeko(infile, con_len + CONTENT_PADDING, SEEK_CUR);
-					}
-					reading_node = 0;
-					writing = 1;
-					toggle = 1;
-				}
+		else if (mem_limit && job.options.memory_limit == 0) {
+			if ((job.options.memory_limit = parse_size(argv[i])) <= 0) {
+				exit_with_error(strcat(argv[i], " is not a valid memory limit"), 1);
 			}
-			else if (starts_with(current_line, "Node-path: ")) {
-				reading_node = 1;
-				++nod;
-				while (act_mi >= 0 && rev == mi[act_mi].revision && nod > mi[act_mi].node) {
-					++act_mi;
-					if (act_mi == mi_len) {
-						act_mi = -1;
-					}
-				}
-				pcon_len = 0;
-				writing = revisions[rev].nodes[nod].wanted;
-				if (writing && redefined_root != NULL) {
-					temp_str = reduce_path(redefined_root, &current_line[11]);
-					fprintf(outfile, "Node-path: %s\n", temp_str);
-					toggle = 1;
-					free(temp_str);
-				}
+		}
+		else if (thr && job.options.threads == 0) {
+			if ((job.options.threads = atoi(argv[i])) <= 0) {
+				exit_with_error(strcat(argv[i], " is not a valid number of threads"), 1);
 			}
-			else if (starts_with(current_line, "Revision-number: ")) {
-				++rev;
-				print_progress(messages, "Writing revision", rev);
-				while (act_mi >= 0 && rev > mi[act_mi].revision) {
-					++act_mi;
-					if (act_mi == mi_len) {
-						act_mi = -1;
-					}
-				}
-				nod = -1;
-				writing = (!drop_empty || revisions[rev].number >= 0);
-				if (drop_empty && writing) {
-					temp_int = atoi(&current_line[17]);
-					fprintf(outfile, "Revision-number: %d\n", revisions[temp_int].number);
-					toggle = 1;
-				}
+		}
+		else if ((chkpt || res) && job.checkpoint == NULL) {
+			job.checkpoint = argv[i];
+			job.resume = res;
+		}
+		else if (stat && job.stats == NULL) {
+			if ((job.stats = fopen(argv[i], "w")) == NULL) {
+				exit_with_error(strcat(argv[i], " can not be opened as stats file"), 3);
 			}
-			if (writing && !toggle) {
-				// Had to replace fprintf(outfile, "%s\n", current_line); with this,
-				// because, apparently it's possible to have NULL characters in SVN
-				// commit messages... (WTF?)
-				fwrite(current_line, 1, cur_len, outfile);
-				fputc('\n', outfile);
+		}
+		else if (every && job.chunk_revisions == 0 && job.chunk_size == 0) {
+			// A plain number is a number of revisions, anything else a size.
+			if (is_plain_number(argv[i], atoi(argv[i]))) {
+				job.chunk_revisions = atoi(argv[i]);
 			}
 			else {
-				toggle = 0;
+				job.chunk_size = parse_size(argv[i]);
+			}
+			if (job.chunk_revisions <= 0 && job.chunk_size <= 0) {
+				exit_with_error(strcat(argv[i], " is not a valid number of revisions or size"), 1);
 			}
-			current_line[0] = '\0';
-			cur_len = 0;
 		}
-		else {
-			current_line[cur_len] = ch;
-			++cur_len;
-			current_line[cur_len] = '\0';
+		else if (prof && job.profile_repo == NULL) {
+			if ((job.profile_repo = fopen(argv[i], "w")) == NULL) {
+				exit_with_error(strcat(argv[i], " can not be opened as profile file"), 3);
+			}
 		}
-	}
-
-	/***********************************************************************************
-	 *
-	 * Add deleting revision if wanted.
-	 *
-	 ***********************************************************************************/
-
-	if (add_delete) {
-		node_ptr = get_relevant_nodes_at_revision(&rt, rev_len, 1, &temp_int);
-		if (include) {
-			for (i = 0; i < temp_int; ++i) {
-				should_do = 1;
-				if (!is_cluded(node_ptr[i]->path, include, inc_slash, inc_len)) {
-					temp_str = add_slash_to(node_ptr[i]->path);
-					for (j = 0; j < inc_len; ++j) {
-						if (starts_with(include[j], temp_str)) {
-							should_do = 0;
-							break;
-						}
-					}
-					free(temp_str);
-					if (!should_do) {
-						continue;
-					}
-					for (j = 0; j < del_len; ++j) {
-						temp_str = add_slash_to(to_delete[j]);
-						if (starts_with(node_ptr[i]->path, temp_str)) {
-							free(temp_str);
-							should_do = 0;
-							break;
-						}
-						free(temp_str);
-					}
-					if (should_do) {
-						if ((to_delete = (char**)realloc(to_delete, (del_len + 1) * sizeof(char*))) == NULL) {
-							exit_with_error("realloc failed", 2);
-						}
-						to_delete[del_len] = node_ptr[i]->path;
-						++del_len;
-					}
-				}
+		else if (exp && job.export_plan == NULL) {
+			if ((job.export_plan = fopen(argv[i], "w")) == NULL) {
+				exit_with_error(strcat(argv[i], " can not be opened as plan file"), 3);
 			}
 		}
-		else {
-			for (i = 0; i < temp_int; ++i) {
-				should_do = 1;
-				if (is_cluded(node_ptr[i]->path, exclude, exc_slash, exc_len)) {
-					for (j = 0; j < del_len; ++j) {
-						temp_str = add_slash_to(to_delete[j]);
-						if (starts_with(node_ptr[i]->path, temp_str)) {
-							free(temp_str);
-							should_do = 0;
-							break;
-						}
-						free(temp_str);
-					}
-					if (should_do) {
-						if ((to_delete = (char**)realloc(to_delete, (del_len + 1) * sizeof(char*))) == NULL) {
-							exit_with_error("realloc failed", 2);
-						}
-						to_delete[del_len] = node_ptr[i]->path;
-						++del_len;
-					}
-				}
+		else if ((split || plan_arg) && spec == NULL) {
+			plan = plan_arg;
+			split_targets = read_split_spec(argv[i], &spec, &split_len);
+			if (split_targets == NULL) {
+				exit_with_error(strcat(argv[i], " can not be opened as split specification") , 3);
+			}
+			if (split_len == 0) {
+				exit_with_error("The split specification does not contain any outputs", 1);
 			}
 		}
-		free(node_ptr);
+		else {
+			exit_with_error(strcat(argv[i], " is not a valid parameter. Use -h for help."), 1);
+		}
 	}
-
-	if (del_len > 0) {
-		time(&rawtime);
-		ptm = gmtime(&rawtime);
-		if (drop_empty) {
-			i = 1;
-			do {
-				temp_int = revisions[rev_len - i].number + 1;
-				++i;
-			} while (temp_int == 0);
+	job.infiles = infiles;
+	job.in_len = in_len;
+	if (spec) {
+		if (outfile || filt->inc_len > 0 || filt->exc_len > 0 || filt->redefined_root || job.query) {
+			exit_with_error("You may not use outfile, include, exclude, redefine root or query with split or plan", 1);
 		}
-		else {
-			temp_int = rev_len;
+		job.targets = split_targets;
+		job.target_len = split_len;
+		// Nothing is written when planning; the first token of each line just names the candidate.
+		if (plan) {
+			job.plan = stdout;
 		}
-		fprintf(outfile, "Revision-number: %d\n", temp_int);
-		fprintf(outfile, "Prop-content-length: 133\n");
-		fprintf(outfile, "Content-length: 133\n\n");
-		fprintf(outfile, "K 7\nsvn:log\nV 22\n");
-		fprintf(outfile, "Deleted unwanted nodes\n");
-		fprintf(outfile, "K 10\nsvn:author\nV 16\nsvndumpsanitizer\nK 8\nsvn:date\nV 27\n");
-		fprintf(outfile, "%d-%.2d-%.2dT%.2d:%.2d:%.2d.000000Z\n", ptm->tm_year + 1900, ptm->tm_mon + 1, ptm->tm_mday, ptm->tm_hour, ptm->tm_min, ptm->tm_sec);
-		fprintf(outfile, "PROPS-END\n\n");
-		for (i = 0; i < del_len; ++i) {
-			fprintf(outfile, "Node-path: %s\n", to_delete[i]);
-			fprintf(outfile, "Node-action: delete\n\n\n");
+	}
+	// Nothing but the profile is written with --profile-repo, so it needs no target.
+	else if (!job.profile_repo || outfile || filt->inc_len > 0 || filt->exc_len > 0 || filt->redefined_root) {
+		target.outfile = outfile;
+		job.targets = &target;
+		job.target_len = 1;
+		if (outfile == NULL && !job.profile_repo) {
+			job.options.messages = stderr;
 		}
 	}
-	
-	fprintf(messages, "\nAll done.\n");
+	for (o = 0; o < job.target_len; ++o) {
+		split_targets = (sds_target*)job.targets;
+		split_targets[o].filter.drop_empty = drop_empty;
+		split_targets[o].filter.add_delete = add_delete;
+	}
+
+	exit_code = sds_run(&job);
+
 	// Clean everything up
- cleanup:
-	fclose(infile);
-	if (to_file) {
-		fclose(outfile);
+	for (o = 0; o < job.target_len; ++o) {
+		free(job.targets[o].filter.include);
+		free(job.targets[o].filter.exclude);
 	}
-	for (i = 0; i < rev_len; ++i) {
-		for (j = 0; j < revisions[i].size; ++j) {
-			free(revisions[i].nodes[j].copyfrom);
-			free(revisions[i].nodes[j].deps);
-		}
-		for (j = 0; j < revisions[i].fake_size; ++j) {
-			free(revisions[i].fakes[j]->deps);
-			free(revisions[i].fakes[j]);
-		}
-		free(revisions[i].nodes);
-		free(revisions[i].fakes);
+	if (spec) {
+		free((sds_target*)job.targets);
 	}
-	for (i = 0; i < mi_len; ++i) {
-		for (j = 0; j < mi[i].data->size; ++j) {
-			free(mi[i].data->path[j]);
-		}
-		free(mi[i].data->path);
-		free(mi[i].data->from);
-		free(mi[i].data->to);
-		free(mi[i].data);
-	}
-	free(mi);
-	for (i = 0; i < inc_len; ++i) {
-		free(inc_slash[i]);
-	}
-	free(inc_slash);
-	for (i = 0; i < exc_len; ++i) {
-		free(exc_slash[i]);
-	}
-	free(exc_slash);
-	free_tree(&rt);
-	free(rt.children);
-	free(revisions);
-	free(include);
-	free(exclude);
-	free(current_line);
-	free(to_delete);
-	return 0;
+	free(spec);
+	free(infiles);
+	free(manifest);
+	if (job.options.machine) {
+		fclose(job.options.machine);
+	}
+	if (job.stats) {
+		fclose(job.stats);
+	}
+	if (job.export_plan) {
+		fclose(job.export_plan);
+	}
+	if (job.profile_repo) {
+		fclose(job.profile_repo);
+	}
+	return exit_code;
 }
+#endif
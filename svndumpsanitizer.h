@@ -0,0 +1,135 @@
+/*
+	svndumpsanitizer version 2.0.7, released 16 May 2018
+
+	Copyright 2011,2012,2013,2014,2015,2016,2017,2018 Daniel Suni
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// The library interface of svndumpsanitizer. Compiling svndumpsanitizer.c with SDS_LIBRARY
+// defined leaves out main(), e.g.
+//
+//   gcc -c -O2 -pthread -DSDS_LIBRARY svndumpsanitizer.c -o svndumpsanitizer.o
+//
+// A dump is loaded once with sds_load, which reads it and builds the dependencies between
+// its nodes. Any number of filters can then be run against the loaded dump with sds_select,
+// and the results written with sds_write, several of them during the same read of the dump
+// if wanted. sds_run instead does everything the command line tool does in one call, which
+// is in fact all the command line tool does.
+//
+// The functions that can fail return SDS_OK or one of the error codes below, which are the
+// same as the exit codes of the command line tool, and sds_error() describes the last error.
+// A failed sds_load or sds_run closes the infile and frees the dump it had read so far, but
+// the memory allocated by other calls that fail is not always freed. The calls use threads
+// like the command line tool does, and an error in any of them is returned from the call,
+// and described by sds_error() on the thread that made it. The candidates of a plan are
+// only evaluated in processes of their own with exit_on_error, otherwise one after another.
+// Only one dump can be loaded at a time, and the functions must not be called from several
+// threads at once.
+
+#ifndef SVNDUMPSANITIZER_H
+#define SVNDUMPSANITIZER_H
+
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SDS_OK 0
+#define SDS_ERROR_USAGE 1 // Invalid filter, or a dump is already loaded
+#define SDS_ERROR_MEMORY 2 // Out of memory, or some other system call failed
+#define SDS_ERROR_FILE 3 // A file could not be opened, read or written
+
+typedef struct sds_model sds_model; // A loaded and analyzed dump
+typedef struct sds_output sds_output; // The result of running a filter against a dump
+
+// The same choices as on the command line. Paths are given without leading or trailing
+// slashes, and the strings must stay valid until the output is freed.
+typedef struct {
+	const char **include;
+	int inc_len;
+	const char **exclude;
+	int exc_len;
+	const char *redefined_root; // NULL to keep the root
+	int drop_empty;
+	int add_delete;
+} sds_filter;
+
+// A sanitized dump to write, and the filter it's made with.
+typedef struct {
+	const char *outfile; // NULL for stdout. When planning it only names the candidate.
+	sds_filter filter;
+} sds_target;
+
+// How sds_run reports, and what it may use. sds_init_options sets the defaults: no messages,
+// no memory limit, one thread per processor, and errors returned rather than exiting.
+typedef struct {
+	FILE *messages; // Progress and results, or NULL for none
+	FILE *machine; // Machine readable progress as with --progress-fd, or NULL
+	long long memory_limit; // In bytes as with --memory-limit, 0 for none
+	int threads; // As with --threads, 0 for one per processor
+	int exit_on_error; // Print the error and exit, as the command line tool does
+} sds_options;
+
+// A run of the command line tool. Every field has the option of the same name, and is off
+// when it's 0 or NULL.
+typedef struct {
+	const char **infiles; // Read as one dump, "-" for stdin
+	int in_len;
+	const sds_target *targets; // Not needed with profile
+	int target_len;
+	FILE *plan; // Evaluate the targets and report on them here, instead of writing them
+	int query;
+	int verify_checksums;
+	const char *checkpoint;
+	int resume; // Resume from the checkpoint instead of starting it
+	int chunk_revisions; // --split-output-every a number of revisions
+	long long chunk_size; // --split-output-every a size
+	FILE *stats;
+	FILE *export_plan;
+	FILE *profile_repo;
+	sds_options options;
+} sds_job;
+
+const char* sds_version(void);
+const char* sds_error(void);
+
+// Reads and analyzes the dump in the file infile, or stdin if infile is "-".
+int sds_load(const char *infile, sds_model **model);
+
+// Works out what to keep of the dump with the filter.
+int sds_select(sds_model *model, const sds_filter *filter, sds_output **output);
+
+// Returns 1 if the root was redefined, and 0 if it wasn't: either the filter didn't ask for a
+// new root, or the repository didn't allow it. Only the filter tells the two apart.
+int sds_root_redefined(const sds_output *output);
+
+// Writes the sanitized dumps of len outputs to the files, which must be open for writing.
+int sds_write(sds_model *model, sds_output **outputs, FILE **files, int len);
+
+void sds_free_output(sds_output *output);
+void sds_free_model(sds_model *model);
+
+void sds_init_options(sds_options *options);
+
+// Does the job. Returns SDS_ERROR_FILE also if the checksums were verified, and some didn't
+// match, after the outputs have been written.
+int sds_run(const sds_job *job);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
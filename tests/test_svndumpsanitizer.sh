@@ -25,6 +25,62 @@ fi
 fail=0
 pass=0
 messages=""
+
+# Compares an output with test.dump, the output of the plain run. The revision added by
+# --add-delete is dated when it's written, so dates are left out if the test has a timestamp.
+same_output() {
+	if [ -f timestamp.txt ] ; then
+		cmp -s <(grep -av '^[0-9-]*T[0-9:.]*Z$' test.dump) <(grep -av '^[0-9-]*T[0-9:.]*Z$' $1)
+	else
+		cmp -s test.dump $1
+	fi
+}
+
+# Counts a check of the current test as passed if the command succeeds.
+check() {
+	local name=$1
+	shift
+	if "$@" ; then
+		((pass++))
+	else
+		messages=$messages"$subdir: $name mismatch.\n"
+		((fail++))
+	fi
+}
+
+# Writes the line of a --split specification doing what the options do, and prints the
+# options that are left for the command line. Fails if some option can't be expressed so.
+split_spec() {
+	local spec=$1 line=$2 mode="" rest=""
+	shift 2
+	for opt in "$@" ; do
+		case $opt in
+			-n|--include) mode=incl ;;
+			-r|--redefine-root) mode=redef ; line="$line -r" ;;
+			-d|--drop-empty|-a|--add-delete) mode="" ; rest="$rest $opt" ;;
+			-*) return 1 ;;
+			*) [ -z "$mode" ] && return 1 ; line="$line $opt" ;;
+		esac
+	done
+	echo "$line" > $spec
+	echo $rest
+}
+
+# A series of files written by --split-output-every, put back together: every file after
+# the first starts with the dump header.
+join_series() {
+	local f
+	cat $1.000
+	for f in `ls $1.[0-9]* | tail -n +2` ; do
+		sed '1,/^Revision-number:/{/^Revision-number:/!d}' $f
+	done
+}
+
+# The checksums in the manifest of a series have to match the files.
+check_manifest() {
+	grep -v '^#' $1.manifest | awk '{print $4 "  " $1}' | sha1sum -c --quiet -
+}
+
 pushd `dirname $0`
 for subdir in `ls -l | grep ^d | sed 's/.*[ \t]//'` ; do
 	pushd $subdir
@@ -65,6 +121,56 @@ for subdir in `ls -l | grep ^d | sed 's/.*[ \t]//'` ; do
 			((pass++))
 		fi
 	fi
+	# The counts --plan reports have to match what is actually written.
+	if [ -f plan.txt ] ; then
+		planned=`$sds -i source.dump --plan plan.txt | grep -A1 ^Candidate | tail -1 | awk '{print $2, $3}'`
+		written="`grep -ac ^Revision-number: test.dump` `grep -ac ^Node-path: test.dump`"
+		if [[ "$planned" != "$written" ]] ; then
+			messages=$messages"$subdir: Plan mismatch ($planned planned, $written written).\n"
+			((fail++))
+		else
+			((pass++))
+		fi
+	fi
+	# The other ways of reading the infile and writing the outfile have to give the same.
+	opts=`cat options.txt`
+	work=`mktemp -d`
+	$sds -i - -o $work/stdin.dump $opts < source.dump > /dev/null
+	check stdin same_output $work/stdin.dump
+	# Two slices, both starting with the dump header.
+	offsets=(`grep -ab '^Revision-number: ' source.dump | cut -d: -f1`)
+	middle=${offsets[$((${#offsets[@]} / 2))]}
+	head -c $middle source.dump > $work/slice1.dump
+	( head -c ${offsets[0]} source.dump ; tail -c +$((middle + 1)) source.dump ) > $work/slice2.dump
+	$sds -i $work/slice1.dump $work/slice2.dump -o $work/slices.dump $opts > /dev/null
+	check "Multiple infile" same_output $work/slices.dump
+	$sds -i source.dump -o $work/verify.dump $opts --verify-checksums > $work/verify.txt
+	status=$?
+	check "--verify-checksums" same_output $work/verify.dump
+	# checksums.txt lists the nodes whose checksums don't match, which fails the run.
+	if [ -f checksums.txt ] ; then
+		check "--verify-checksums status" [ $status -eq 3 ]
+		check "--verify-checksums messages" cmp -s checksums.txt <(grep -a '^Checksum mismatch' $work/verify.txt)
+	else
+		check "--verify-checksums status" [ $status -eq 0 ]
+	fi
+	$sds -i source.dump -o $work/every.dump $opts --split-output-every 2 > /dev/null
+	join_series $work/every.dump > $work/joined.dump
+	check "--split-output-every" same_output $work/joined.dump
+	check "--split-output-every manifest" check_manifest $work/every.dump
+	# Interrupted by the file size limit as soon as a kilobyte has been written.
+	( ulimit -f 1 ; $sds -i source.dump -o $work/resume.dump $opts --checkpoint $work/checkpoint ) > /dev/null 2>&1
+	$sds -i source.dump -o $work/resume.dump $opts --resume $work/checkpoint > /dev/null
+	check "--resume" same_output $work/resume.dump
+	# Two identical outputs from one --split run.
+	if rest=`split_spec $work/spec $work/split1.dump $opts` ; then
+		split_spec $work/spec.2 $work/split2.dump $opts > /dev/null
+		cat $work/spec.2 >> $work/spec
+		$sds -i source.dump --split $work/spec $rest > /dev/null
+		check "First --split" same_output $work/split1.dump
+		check "Second --split" same_output $work/split2.dump
+	fi
+	rm -rf $work
 	popd
 done
 popd